@@ -0,0 +1,823 @@
+/*
+ * Copyright 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Long-uptime graphics memory fragmentation model.
+ *
+ * nvmap_carveout_compactor runs one fixed allocate/free pattern against the
+ * Tegra carveout. This tool runs the same idea against any allocator: each
+ * step it retires the allocations whose lifetime has expired and makes one
+ * new allocation, with sizes and lifetimes drawn from configurable
+ * distributions. Every report interval it prints allocation latency, the
+ * failures seen so far and how much high-order free memory the kernel has
+ * left, so the effect of growing fragmentation is visible over time.
+ *
+ * Backends:
+ *   dmabuf_heap  buffers from a /dev/dma_heap heap, mmap'd and faulted in
+ *   gbm          linear GBM buffer objects on vgem (needs HAVE_GBM)
+ *   gl           GLES2 textures on a surfaceless EGL context
+ */
+
+#define _GNU_SOURCE
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/dma-heap.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_GBM
+#include <gbm.h>
+#endif
+
+#define DEFAULT_OPS            100000
+#define DEFAULT_MIN_KB         64
+#define DEFAULT_MAX_KB         8192
+#define DEFAULT_LIFETIME       2000
+#define DEFAULT_TARGET_MB      512
+#define DEFAULT_INTERVAL       10000
+#define DEFAULT_HEAP           "/dev/dma_heap/system"
+#define PAGE_BYTES             4096
+/* Textures and GBM buffers are 1024 RGBA pixels, i.e. one page, wide. */
+#define ROW_PIXELS             (PAGE_BYTES / 4)
+/* Order of the buddy blocks counted as "high order" free memory (2MB). */
+#define HIGH_ORDER             9
+#define MAX_ORDER_COUNT        16
+
+enum size_dist {
+        SIZE_FIXED,
+        SIZE_UNIFORM,
+        SIZE_POW2,
+        SIZE_LOGNORMAL,
+};
+
+enum lifetime_dist {
+        LIFETIME_FIXED,
+        LIFETIME_EXPONENTIAL,
+};
+
+struct options {
+        const char *backend;
+        const char *heap;
+        enum size_dist size_dist;
+        enum lifetime_dist lifetime_dist;
+        size_t min_bytes;
+        size_t max_bytes;
+        long mean_lifetime;
+        size_t target_bytes;
+        long ops;
+        long interval;
+        unsigned int seed;
+};
+
+struct allocation {
+        size_t size;
+        long death;
+        uintptr_t handle;
+        void *map;
+};
+
+/*
+ * An allocator under test. alloc() fills in a->handle (and a->map if it
+ * keeps a mapping) and returns 0, or returns a negative errno. -E2BIG
+ * means the size is past a fixed limit of the API rather than out of
+ * memory, and is counted apart from the failures.
+ */
+struct backend {
+        const char *name;
+        int (*init)(const struct options *opts);
+        int (*alloc)(struct allocation *a);
+        void (*free)(struct allocation *a);
+        void (*cleanup)(void);
+};
+
+static int verbose = 0;
+
+/*
+ * dma-buf heap backend.
+ */
+static int heap_fd = -1;
+
+static int HeapInit(const struct options *opts)
+{
+        heap_fd = open(opts->heap, O_RDONLY | O_CLOEXEC);
+        if (heap_fd < 0) {
+                fprintf(stderr, "Failed to open %s: %s\n", opts->heap,
+                        strerror(errno));
+                return -1;
+        }
+        return 0;
+}
+
+static int HeapAlloc(struct allocation *a)
+{
+        struct dma_heap_allocation_data data;
+        size_t off;
+        void *map;
+
+        memset(&data, 0, sizeof(data));
+        data.len = a->size;
+        data.fd_flags = O_RDWR | O_CLOEXEC;
+        if (ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0)
+                return -errno;
+
+        map = mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   data.fd, 0);
+        if (map == MAP_FAILED) {
+                int err = -errno;
+                close(data.fd);
+                return err;
+        }
+
+        /* Fault in every page so the memory is really committed. */
+        for (off = 0; off < a->size; off += PAGE_BYTES)
+                ((volatile char *)map)[off] = 1;
+
+        a->handle = data.fd;
+        a->map = map;
+        return 0;
+}
+
+static void HeapFree(struct allocation *a)
+{
+        munmap(a->map, a->size);
+        close((int)a->handle);
+}
+
+static void HeapCleanup(void)
+{
+        close(heap_fd);
+}
+
+#ifdef HAVE_GBM
+/*
+ * GBM on vgem backend.
+ */
+static int vgem_fd = -1;
+static struct gbm_device *gbm;
+
+static int OpenVgem(void)
+{
+        char name[64];
+        struct stat st;
+        int i;
+
+        for (i = 0; i < 16; i++) {
+                snprintf(name, sizeof(name),
+                         "/sys/bus/platform/devices/vgem/drm/card%d", i);
+                if (stat(name, &st) == -1)
+                        continue;
+                snprintf(name, sizeof(name), "/dev/dri/card%d", i);
+                return open(name, O_RDWR | O_CLOEXEC);
+        }
+        return -1;
+}
+
+static int GbmInit(const struct options *opts)
+{
+        vgem_fd = OpenVgem();
+        if (vgem_fd < 0) {
+                fprintf(stderr, "Failed to open vgem device\n");
+                return -1;
+        }
+        gbm = gbm_create_device(vgem_fd);
+        if (!gbm) {
+                fprintf(stderr, "Failed to create gbm device on vgem\n");
+                close(vgem_fd);
+                return -1;
+        }
+        return 0;
+}
+
+static int GbmAlloc(struct allocation *a)
+{
+        uint32_t height = (a->size + PAGE_BYTES - 1) / PAGE_BYTES;
+        uint32_t stride, y;
+        void *map_data = NULL;
+        struct gbm_bo *bo;
+        char *addr;
+
+        bo = gbm_bo_create(gbm, ROW_PIXELS, height, GBM_FORMAT_ARGB8888,
+                           GBM_BO_USE_LINEAR | GBM_BO_USE_SW_READ_OFTEN |
+                           GBM_BO_USE_SW_WRITE_OFTEN);
+        if (!bo)
+                return errno ? -errno : -ENOMEM;
+
+        /* vgem backs buffers lazily; touch one byte per row (page). */
+        addr = gbm_bo_map(bo, 0, 0, ROW_PIXELS, height,
+                          GBM_BO_TRANSFER_WRITE, &stride, &map_data, 0);
+        if (addr == MAP_FAILED || !addr) {
+                gbm_bo_destroy(bo);
+                return -ENOMEM;
+        }
+        for (y = 0; y < height; y++)
+                addr[(size_t)y * stride] = 1;
+        gbm_bo_unmap(bo, map_data);
+
+        a->handle = (uintptr_t)bo;
+        return 0;
+}
+
+static void GbmFree(struct allocation *a)
+{
+        gbm_bo_destroy((struct gbm_bo *)a->handle);
+}
+
+static void GbmCleanup(void)
+{
+        gbm_device_destroy(gbm);
+        close(vgem_fd);
+}
+#endif  /* HAVE_GBM */
+
+/*
+ * GLES2 texture backend.
+ */
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+static GLuint fbo;
+
+static int GlInit(const struct options *opts)
+{
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+        EGLConfig config;
+        EGLint num_config;
+        EGLint config_attr[] = {
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_NONE
+        };
+        EGLint ctx_attr[] = {
+                EGL_CONTEXT_CLIENT_VERSION, 2,
+                EGL_NONE
+        };
+
+        get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+                eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display)
+                egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                                   EGL_DEFAULT_DISPLAY, NULL);
+        if (egl_display == EGL_NO_DISPLAY)
+                egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (egl_display == EGL_NO_DISPLAY ||
+            !eglInitialize(egl_display, NULL, NULL)) {
+                fprintf(stderr, "EGL failed to initialize\n");
+                return -1;
+        }
+
+        if (!eglChooseConfig(egl_display, config_attr, &config, 1,
+                             &num_config) || num_config < 1) {
+                fprintf(stderr, "EGL failed to choose config\n");
+                return -1;
+        }
+
+        egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT,
+                                       ctx_attr);
+        if (egl_context == EGL_NO_CONTEXT ||
+            !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                            egl_context)) {
+                fprintf(stderr, "EGL failed to make a surfaceless context "
+                        "current\n");
+                return -1;
+        }
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        return 0;
+}
+
+static int GlAlloc(struct allocation *a)
+{
+        GLsizei height = (a->size + PAGE_BYTES - 1) / PAGE_BYTES;
+        GLuint tex;
+        GLenum err;
+
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ROW_PIXELS, height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        /*
+         * Drivers may defer the backing store until first use, so render to
+         * the texture and wait for it.
+         */
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, tex, 0);
+        glViewport(0, 0, ROW_PIXELS, height);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glFinish();
+
+        err = glGetError();
+        if (err != GL_NO_ERROR) {
+                glDeleteTextures(1, &tex);
+                if (err == GL_OUT_OF_MEMORY)
+                        return -ENOMEM;
+                /* Taller than GL_MAX_TEXTURE_SIZE. */
+                return err == GL_INVALID_VALUE ? -E2BIG : -EINVAL;
+        }
+
+        a->handle = tex;
+        return 0;
+}
+
+static void GlFree(struct allocation *a)
+{
+        GLuint tex = (GLuint)a->handle;
+        glDeleteTextures(1, &tex);
+}
+
+static void GlCleanup(void)
+{
+        glDeleteFramebuffers(1, &fbo);
+        eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+        eglDestroyContext(egl_display, egl_context);
+        eglTerminate(egl_display);
+}
+
+static const struct backend backends[] = {
+        {"dmabuf_heap", HeapInit, HeapAlloc, HeapFree, HeapCleanup},
+#ifdef HAVE_GBM
+        {"gbm", GbmInit, GbmAlloc, GbmFree, GbmCleanup},
+#endif
+        {"gl", GlInit, GlAlloc, GlFree, GlCleanup},
+};
+
+/*
+ * Live allocations, kept as a binary min-heap on death time so that
+ * expiring the oldest is O(log n).
+ */
+static struct allocation *live;
+static long live_count;
+static long live_capacity;
+static size_t live_bytes;
+
+static void HeapSwap(long i, long j)
+{
+        struct allocation tmp = live[i];
+        live[i] = live[j];
+        live[j] = tmp;
+}
+
+static int LivePush(const struct allocation *a)
+{
+        long i;
+
+        if (live_count == live_capacity) {
+                long capacity = live_capacity ? live_capacity * 2 : 1024;
+                struct allocation *grown = realloc(live,
+                                                   capacity * sizeof(*live));
+                if (!grown)
+                        return -1;
+                live = grown;
+                live_capacity = capacity;
+        }
+
+        i = live_count++;
+        live[i] = *a;
+        while (i > 0 && live[(i - 1) / 2].death > live[i].death) {
+                HeapSwap(i, (i - 1) / 2);
+                i = (i - 1) / 2;
+        }
+        live_bytes += a->size;
+        return 0;
+}
+
+static struct allocation LivePop(void)
+{
+        struct allocation top = live[0];
+        long i = 0;
+
+        live[0] = live[--live_count];
+        for (;;) {
+                long l = 2 * i + 1, r = l + 1, min = i;
+                if (l < live_count && live[l].death < live[min].death)
+                        min = l;
+                if (r < live_count && live[r].death < live[min].death)
+                        min = r;
+                if (min == i)
+                        break;
+                HeapSwap(i, min);
+                i = min;
+        }
+        live_bytes -= top.size;
+        return top;
+}
+
+/* Uniform double in (0, 1]. */
+static double RandUnit(unsigned int *seed)
+{
+        return (rand_r(seed) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+static size_t PageAlign(size_t size)
+{
+        return (size + PAGE_BYTES - 1) & ~(size_t)(PAGE_BYTES - 1);
+}
+
+static size_t NextSize(const struct options *opts, unsigned int *seed)
+{
+        double lo = opts->min_bytes, hi = opts->max_bytes, size;
+
+        switch (opts->size_dist) {
+        case SIZE_FIXED:
+                size = hi;
+                break;
+        case SIZE_UNIFORM:
+                size = lo + (hi - lo) * RandUnit(seed);
+                break;
+        case SIZE_POW2: {
+                /* Uniform over the powers of two in [lo, hi]. */
+                int lo_order = (int)ceil(log2(lo));
+                int hi_order = (int)floor(log2(hi));
+                int order = lo_order;
+                if (hi_order > lo_order)
+                        order += rand_r(seed) % (hi_order - lo_order + 1);
+                size = ldexp(1.0, order);
+                break;
+        }
+        case SIZE_LOGNORMAL:
+        default: {
+                /*
+                 * Log-normal with its median at the geometric mean of the
+                 * bounds and [lo, hi] spanning +-2 sigma, clamped.
+                 */
+                double mu = (log(lo) + log(hi)) / 2;
+                double sigma = (log(hi) - log(lo)) / 4;
+                double z = sqrt(-2 * log(RandUnit(seed))) *
+                           cos(2 * M_PI * RandUnit(seed));
+                size = exp(mu + sigma * z);
+                if (size < lo)
+                        size = lo;
+                if (size > hi)
+                        size = hi;
+                break;
+        }
+        }
+        return PageAlign((size_t)size);
+}
+
+static long NextLifetime(const struct options *opts, unsigned int *seed)
+{
+        if (opts->lifetime_dist == LIFETIME_FIXED)
+                return opts->mean_lifetime;
+        return (long)(-log(RandUnit(seed)) * opts->mean_lifetime) + 1;
+}
+
+/*
+ * Sums free buddy blocks of at least HIGH_ORDER across all zones, in MB.
+ * This drops as memory fragments even when total free memory does not.
+ * Returns -1 if /proc/buddyinfo is not readable.
+ */
+static long HighOrderFreeMB(void)
+{
+        char line[512];
+        long pages = 0;
+        FILE *f;
+
+        f = fopen("/proc/buddyinfo", "r");
+        if (!f)
+                return -1;
+        while (fgets(line, sizeof(line), f)) {
+                char *p = strstr(line, "zone");
+                int order = 0, n;
+                long count;
+
+                if (!p)
+                        continue;
+                p += 4;
+                /* Skip the zone name. */
+                while (*p == ' ')
+                        p++;
+                while (*p && *p != ' ')
+                        p++;
+                while (order < MAX_ORDER_COUNT &&
+                       sscanf(p, "%ld%n", &count, &n) == 1) {
+                        if (order >= HIGH_ORDER)
+                                pages += count << order;
+                        p += n;
+                        order++;
+                }
+        }
+        fclose(f);
+        return pages * PAGE_BYTES / (1024 * 1024);
+}
+
+static uint64_t NowNs(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+        uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+        return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted array, in microseconds. */
+static double PercentileUs(const uint64_t *sorted, long count, int pct)
+{
+        long rank = (pct * count + 99) / 100;
+        if (rank < 1)
+                rank = 1;
+        return sorted[rank - 1] / 1000.0;
+}
+
+static void PrintLatency(uint64_t *samples, long count)
+{
+        if (!count) {
+                printf(" alloc_us p50 - p99 - max -");
+                return;
+        }
+        qsort(samples, count, sizeof(*samples), CompareU64);
+        printf(" alloc_us p50 %.1f p99 %.1f max %.1f",
+               PercentileUs(samples, count, 50),
+               PercentileUs(samples, count, 99),
+               samples[count - 1] / 1000.0);
+}
+
+static int RunEngine(const struct backend *be, const struct options *opts)
+{
+        uint64_t *window = malloc(opts->interval * sizeof(uint64_t));
+        uint64_t *all = malloc(opts->ops * sizeof(uint64_t));
+        unsigned int seed = opts->seed;
+        long window_count = 0, all_count = 0;
+        long failures = 0, window_failures = 0, oversize = 0;
+        long first_failure_op = -1;
+        size_t first_failure_live = 0, first_failure_size = 0;
+        long op;
+
+        if (!window || !all) {
+                fprintf(stderr, "Out of memory\n");
+                return -1;
+        }
+
+        printf("backend %s ops %ld target_mb %zu size_kb %zu-%zu "
+               "mean_lifetime %ld seed %u\n", be->name, opts->ops,
+               opts->target_bytes >> 20, opts->min_bytes >> 10,
+               opts->max_bytes >> 10, opts->mean_lifetime, opts->seed);
+
+        for (op = 0; op < opts->ops; op++) {
+                struct allocation a;
+                uint64_t start, elapsed;
+                int ret;
+
+                /* Retire everything whose lifetime is over. */
+                while (live_count && live[0].death <= op) {
+                        struct allocation dead = LivePop();
+                        be->free(&dead);
+                }
+
+                memset(&a, 0, sizeof(a));
+                a.size = NextSize(opts, &seed);
+                a.death = op + NextLifetime(opts, &seed);
+
+                /* Stay under the target by retiring early if necessary. */
+                while (live_count && live_bytes + a.size > opts->target_bytes) {
+                        struct allocation dead = LivePop();
+                        be->free(&dead);
+                }
+
+                start = NowNs();
+                ret = be->alloc(&a);
+                elapsed = NowNs() - start;
+
+                if (ret == -E2BIG) {
+                        oversize++;
+                        if (verbose)
+                                printf("op %ld: %zu KB allocation over the "
+                                       "%s size limit\n", op, a.size >> 10,
+                                       be->name);
+                } else if (ret) {
+                        failures++;
+                        window_failures++;
+                        if (first_failure_op < 0) {
+                                first_failure_op = op;
+                                first_failure_live = live_bytes;
+                                first_failure_size = a.size;
+                        }
+                        if (verbose)
+                                printf("op %ld: %zu KB allocation failed: "
+                                       "%s (live %zu MB)\n", op,
+                                       a.size >> 10, strerror(-ret),
+                                       live_bytes >> 20);
+                } else {
+                        window[window_count++] = elapsed;
+                        all[all_count++] = elapsed;
+                        if (LivePush(&a)) {
+                                be->free(&a);
+                                fprintf(stderr, "Out of memory\n");
+                                break;
+                        }
+                }
+
+                if ((op + 1) % opts->interval == 0 || op + 1 == opts->ops) {
+                        printf("op %ld live_mb %zu live_count %ld",
+                               op + 1, live_bytes >> 20, live_count);
+                        PrintLatency(window, window_count);
+                        printf(" failures %ld high_order_free_mb %ld\n",
+                               window_failures, HighOrderFreeMB());
+                        window_count = 0;
+                        window_failures = 0;
+                }
+        }
+
+        while (live_count) {
+                struct allocation dead = LivePop();
+                be->free(&dead);
+        }
+
+        printf("total allocs %ld failures %ld oversize %ld", all_count,
+               failures, oversize);
+        PrintLatency(all, all_count);
+        printf("\n");
+        if (first_failure_op >= 0)
+                printf("first_failure op %ld live_mb %zu size_kb %zu\n",
+                       first_failure_op, first_failure_live >> 20,
+                       first_failure_size >> 10);
+
+        free(all);
+        free(window);
+        return failures ? 1 : 0;
+}
+
+static void PrintUsage(void)
+{
+        int i;
+
+        printf("--------------------------------------------\n");
+        printf("gpu_mem_fragmenter [options]\n");
+        printf("  -h | --help              - Show this help screen\n");
+        printf("  -v | --verbose           - Print every failed allocation\n");
+        printf("  -b | --backend           - Allocator [def: dmabuf_heap]:");
+        for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+                printf(" %s", backends[i].name);
+        printf("\n");
+        printf("  -H | --heap              - dma-buf heap [def: %s]\n",
+               DEFAULT_HEAP);
+        printf("  -n | --ops               - # of allocations [def: %d]\n",
+               DEFAULT_OPS);
+        printf("  -s | --size_dist         - fixed|uniform|pow2|lognormal "
+               "[def: lognormal]\n");
+        printf("  -m | --min_kb            - Smallest size [def: %d]\n",
+               DEFAULT_MIN_KB);
+        printf("  -M | --max_kb            - Largest size [def: %d]\n",
+               DEFAULT_MAX_KB);
+        printf("  -L | --lifetime_dist     - fixed|exponential "
+               "[def: exponential]\n");
+        printf("  -l | --mean_lifetime     - Mean lifetime in ops [def: %d]\n",
+               DEFAULT_LIFETIME);
+        printf("  -t | --target_mb         - Cap on live memory [def: %d]\n",
+               DEFAULT_TARGET_MB);
+        printf("  -i | --interval          - Ops per report [def: %d]\n",
+               DEFAULT_INTERVAL);
+        printf("  -S | --seed              - Random seed [def: 1]\n");
+}
+
+int main(int argc, char *argv[])
+{
+        const struct backend *be = NULL;
+        struct options opts = {
+                .backend = "dmabuf_heap",
+                .heap = DEFAULT_HEAP,
+                .size_dist = SIZE_LOGNORMAL,
+                .lifetime_dist = LIFETIME_EXPONENTIAL,
+                .min_bytes = DEFAULT_MIN_KB * 1024,
+                .max_bytes = DEFAULT_MAX_KB * 1024,
+                .mean_lifetime = DEFAULT_LIFETIME,
+                .target_bytes = (size_t)DEFAULT_TARGET_MB << 20,
+                .ops = DEFAULT_OPS,
+                .interval = DEFAULT_INTERVAL,
+                .seed = 1,
+        };
+        int option_index = 0;
+        int failure;
+        int i;
+
+        static struct option long_options[] = {
+                {"help",          no_argument,       0, 'h'},
+                {"verbose",       no_argument,       0, 'v'},
+                {"backend",       required_argument, 0, 'b'},
+                {"heap",          required_argument, 0, 'H'},
+                {"ops",           required_argument, 0, 'n'},
+                {"size_dist",     required_argument, 0, 's'},
+                {"min_kb",        required_argument, 0, 'm'},
+                {"max_kb",        required_argument, 0, 'M'},
+                {"lifetime_dist", required_argument, 0, 'L'},
+                {"mean_lifetime", required_argument, 0, 'l'},
+                {"target_mb",     required_argument, 0, 't'},
+                {"interval",      required_argument, 0, 'i'},
+                {"seed",          required_argument, 0, 'S'},
+                {NULL,            0,                 NULL, 0}
+        };
+
+        while ((i = getopt_long(argc, argv, "hvb:H:n:s:m:M:L:l:t:i:S:",
+                                long_options, &option_index)) != -1)
+                switch (i) {
+                        case 'h':
+                                PrintUsage();
+                                return 0;
+                        case 'v':
+                                verbose = 1;
+                                break;
+                        case 'b':
+                                opts.backend = optarg;
+                                break;
+                        case 'H':
+                                opts.heap = optarg;
+                                break;
+                        case 'n':
+                                opts.ops = atol(optarg);
+                                break;
+                        case 's':
+                                if (!strcmp(optarg, "fixed"))
+                                        opts.size_dist = SIZE_FIXED;
+                                else if (!strcmp(optarg, "uniform"))
+                                        opts.size_dist = SIZE_UNIFORM;
+                                else if (!strcmp(optarg, "pow2"))
+                                        opts.size_dist = SIZE_POW2;
+                                else if (!strcmp(optarg, "lognormal"))
+                                        opts.size_dist = SIZE_LOGNORMAL;
+                                else
+                                        goto bad_option;
+                                break;
+                        case 'm':
+                                opts.min_bytes = (size_t)atol(optarg) * 1024;
+                                break;
+                        case 'M':
+                                opts.max_bytes = (size_t)atol(optarg) * 1024;
+                                break;
+                        case 'L':
+                                if (!strcmp(optarg, "fixed"))
+                                        opts.lifetime_dist = LIFETIME_FIXED;
+                                else if (!strcmp(optarg, "exponential"))
+                                        opts.lifetime_dist =
+                                                LIFETIME_EXPONENTIAL;
+                                else
+                                        goto bad_option;
+                                break;
+                        case 'l':
+                                opts.mean_lifetime = atol(optarg);
+                                break;
+                        case 't':
+                                opts.target_bytes = (size_t)atol(optarg) << 20;
+                                break;
+                        case 'i':
+                                opts.interval = atol(optarg);
+                                break;
+                        case 'S':
+                                opts.seed = strtoul(optarg, NULL, 0);
+                                break;
+                        default:
+                                goto bad_option;
+                }
+
+        if (opts.ops <= 0 || opts.interval <= 0 || opts.mean_lifetime <= 0 ||
+            opts.min_bytes < PAGE_BYTES || opts.max_bytes < opts.min_bytes ||
+            opts.target_bytes < opts.max_bytes)
+                goto bad_option;
+        /* pow2 needs a power of two between the bounds to draw from. */
+        if (opts.size_dist == SIZE_POW2 &&
+            ceil(log2(opts.min_bytes)) > floor(log2(opts.max_bytes)))
+                goto bad_option;
+
+        for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+                if (!strcmp(opts.backend, backends[i].name))
+                        be = &backends[i];
+        if (!be)
+                goto bad_option;
+
+        if (be->init(&opts))
+                return -1;
+        failure = RunEngine(be, &opts);
+        be->cleanup();
+        free(live);
+
+        if (failure < 0)
+                return -1;
+        printf("Test completed [%s]: pid = %d\n",
+               failure ? "ALLOCATION FAILURES" : "SUCCESS", getpid());
+        return 0;
+
+bad_option:
+        PrintUsage();
+        return 1;
+}
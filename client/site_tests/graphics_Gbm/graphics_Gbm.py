@@ -28,8 +28,16 @@ class graphics_Gbm(graphics_utils.GraphicsTest):
         super(graphics_Gbm, self).cleanup()
 
     @graphics_utils.GraphicsTest.failure_report_decorator('graphics_Gbm')
-    def run_once(self):
+    def run_once(self, bench=False):
+        """
+        Runs gbmtest.
+
+        @param bench: run the allocator and CPU mapping benchmarks instead
+                of the correctness tests.
+        """
         cmd = os.path.join(self.srcdir, 'gbmtest')
+        if bench:
+            cmd += ' --bench'
         result = utils.run(cmd,
                            stderr_is_expected=False,
                            stdout_tee=utils.TEE_TO_LOGS,
@@ -39,3 +47,19 @@ class graphics_Gbm(graphics_utils.GraphicsTest):
         if not report:
             raise error.TestFail('Failed: Gbm test failed (' + result.stdout +
                                  ')')
+        for threads, rate in re.findall(
+                r'^alloc_scaling threads (\d+) ops_per_sec (\d+)',
+                result.stdout, re.M):
+            self.output_perf_value(
+                description='alloc_ops_per_sec_%s_threads' % threads,
+                value=int(rate),
+                units='ops_per_sec',
+                higher_is_better=True)
+        for layout, path, pattern, rate in re.findall(
+                r'^map layout (\w+) path (\w+) (\w+)_mbps (\d+)',
+                result.stdout, re.M):
+            self.output_perf_value(
+                description='%s_%s_%s' % (path, layout, pattern),
+                value=int(rate),
+                units='MB_per_sec',
+                higher_is_better=True)
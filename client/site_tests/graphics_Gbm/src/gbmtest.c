@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/dma-buf.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -19,6 +20,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -993,11 +995,510 @@ static int test_gem_map_format(int format_index,
 	return 1;
 }
 
+/*
+ * Benchmarks. These are not run by default; see usage() for how to select
+ * them. They prefer vgem so that they work without a real GPU.
+ */
+#define BENCH_ITERATIONS 200
+#define BENCH_SCALING_ITERATIONS 2000
+#define BENCH_MAX_THREADS 16
+
+#define BENCH_MAP_ITERATIONS 16
+#define BENCH_MAP_WIDTH 1920
+#define BENCH_MAP_HEIGHT 1080
+
+#define BENCH_ALLOC (1 << 0)
+#define BENCH_MAP (1 << 1)
+
+static const struct {
+	uint32_t width;
+	uint32_t height;
+} bench_size_list[] = {
+	{64, 64},
+	{256, 256},
+	{1024, 1024},
+	{1920, 1080},
+	{3840, 2160},
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of an already sorted array. */
+static uint64_t percentile(const uint64_t *sorted, int count, int pct)
+{
+	int rank = (pct * count + 99) / 100;
+
+	if (rank < 1)
+		rank = 1;
+	return sorted[rank - 1];
+}
+
+static void print_latency(const char *name, uint64_t *samples, int count)
+{
+	qsort(samples, count, sizeof(*samples), compare_u64);
+	printf(" %s_us p50 %.1f p90 %.1f p99 %.1f max %.1f", name,
+	       percentile(samples, count, 50) / 1000.0,
+	       percentile(samples, count, 90) / 1000.0,
+	       percentile(samples, count, 99) / 1000.0,
+	       samples[count - 1] / 1000.0);
+}
+
+static const char *format_name(uint32_t format)
+{
+	static char name[5];
+
+	name[0] = format & 0xff;
+	name[1] = (format >> 8) & 0xff;
+	name[2] = (format >> 16) & 0xff;
+	name[3] = (format >> 24) & 0xff;
+	name[4] = '\0';
+	return name;
+}
+
+static int bench_init()
+{
+	fd = drm_open_vgem();
+	if (fd < 0)
+		fd = drm_open();
+	CHECK(fd >= 0);
+
+	gbm = gbm_create_device(fd);
+	CHECK(gbm);
+
+	printf("bench backend %s\n", gbm_device_get_backend_name(gbm));
+	return 1;
+}
+
+/*
+ * Measures gbm_bo_create() and gbm_bo_destroy() latency for every
+ * supported format, usage and size combination.
+ */
+static int bench_alloc_free()
+{
+	uint64_t create_ns[BENCH_ITERATIONS];
+	uint64_t destroy_ns[BENCH_ITERATIONS];
+	int i, j, k, n;
+
+	for (i = 0; i < ARRAY_SIZE(usage_list); i++) {
+		uint32_t usage = usage_list[i];
+		for (j = 0; j < ARRAY_SIZE(format_list); j++) {
+			uint32_t format = format_list[j];
+			if (!gbm_device_is_format_supported(gbm, format, usage))
+				continue;
+			for (k = 0; k < ARRAY_SIZE(bench_size_list); k++) {
+				uint32_t width = bench_size_list[k].width;
+				uint32_t height = bench_size_list[k].height;
+
+				if (usage == GBM_BO_USE_CURSOR_64X64 &&
+				    (width != 64 || height != 64))
+					continue;
+
+				for (n = 0; n < BENCH_ITERATIONS; n++) {
+					struct gbm_bo *bo;
+					uint64_t start, created;
+
+					start = now_ns();
+					bo = gbm_bo_create(gbm, width, height,
+							   format, usage);
+					created = now_ns();
+					CHECK(bo);
+					gbm_bo_destroy(bo);
+					create_ns[n] = created - start;
+					destroy_ns[n] = now_ns() - created;
+				}
+
+				printf("alloc format %s usage 0x%04x size %ux%u",
+				       format_name(format), usage, width, height);
+				print_latency("create", create_ns, BENCH_ITERATIONS);
+				print_latency("destroy", destroy_ns, BENCH_ITERATIONS);
+				printf("\n");
+			}
+		}
+	}
+
+	return 1;
+}
+
+struct bench_thread {
+	pthread_t thread;
+	int iterations;
+	int failed;
+};
+
+static void *bench_alloc_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	int i;
+
+	for (i = 0; i < t->iterations; i++) {
+		struct gbm_bo *bo;
+		bo = gbm_bo_create(gbm, 1024, 1024, GBM_FORMAT_XRGB8888,
+				   GBM_BO_USE_RENDERING);
+		if (!bo) {
+			t->failed = 1;
+			break;
+		}
+		gbm_bo_destroy(bo);
+	}
+	return NULL;
+}
+
+/*
+ * Measures aggregate create/destroy throughput from 1, 2, 4, ... threads
+ * sharing one gbm device.
+ */
+static int bench_alloc_scaling(int max_threads)
+{
+	struct bench_thread threads[BENCH_MAX_THREADS];
+	double base_rate = 0;
+	int count, i;
+
+	if (!gbm_device_is_format_supported(gbm, GBM_FORMAT_XRGB8888,
+					    GBM_BO_USE_RENDERING))
+		return 1;
+
+	for (count = 1; count <= max_threads; count *= 2) {
+		uint64_t start, elapsed;
+		double rate;
+
+		memset(threads, 0, sizeof(threads));
+		start = now_ns();
+		for (i = 0; i < count; i++) {
+			threads[i].iterations = BENCH_SCALING_ITERATIONS;
+			CHECK(pthread_create(&threads[i].thread, NULL,
+					     bench_alloc_thread, &threads[i]) == 0);
+		}
+		for (i = 0; i < count; i++) {
+			pthread_join(threads[i].thread, NULL);
+			CHECK(!threads[i].failed);
+		}
+		elapsed = now_ns() - start;
+
+		rate = (double)count * BENCH_SCALING_ITERATIONS * 1e9 / elapsed;
+		if (count == 1)
+			base_rate = rate;
+		printf("alloc_scaling threads %d ops_per_sec %.0f speedup %.2f\n",
+		       count, rate, rate / base_rate);
+	}
+
+	return 1;
+}
+
+/*
+ * Buffer layouts for the CPU access benchmarks. Whether the non-linear
+ * entries are actually tiled is up to the driver; the modifier is printed
+ * alongside the results.
+ */
+static const struct {
+	const char *name;
+	uint32_t usage;
+} bench_layout_list[] = {
+	{"linear", GBM_BO_USE_LINEAR | GBM_BO_USE_SW_READ_OFTEN |
+		   GBM_BO_USE_SW_WRITE_OFTEN},
+	{"rendering", GBM_BO_USE_RENDERING | GBM_BO_USE_SW_READ_RARELY |
+		      GBM_BO_USE_SW_WRITE_RARELY},
+	{"scanout", GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING |
+		    GBM_BO_USE_SW_READ_RARELY | GBM_BO_USE_SW_WRITE_RARELY},
+};
+
+enum access_pattern {
+	SEQ_WRITE,
+	SEQ_READ,
+	STRIDED_WRITE,
+	STRIDED_READ,
+	NUM_ACCESS_PATTERNS,
+};
+
+static const char *access_pattern_names[] = {
+	"seq_write",
+	"seq_read",
+	"strided_write",
+	"strided_read",
+};
+
+static volatile uint32_t bench_sink;
+
+static bool is_write(int pattern)
+{
+	return pattern == SEQ_WRITE || pattern == STRIDED_WRITE;
+}
+
+/*
+ * Touches every pixel of a 32bpp mapping once. The sequential patterns walk
+ * rows; the strided ones walk columns, so consecutive accesses are a full
+ * stride apart.
+ */
+static void touch_pixels(void *addr, uint32_t stride, int width, int height,
+			 int pattern)
+{
+	uint32_t stride_pixels = stride / sizeof(uint32_t);
+	uint32_t *pixel = addr;
+	uint32_t sum = 0;
+	int x, y;
+
+	switch (pattern) {
+	case SEQ_WRITE:
+		for (y = 0; y < height; ++y)
+			for (x = 0; x < width; ++x)
+				pixel[y * stride_pixels + x] = (y << 16) | x;
+		break;
+	case SEQ_READ:
+		for (y = 0; y < height; ++y)
+			for (x = 0; x < width; ++x)
+				sum += pixel[y * stride_pixels + x];
+		break;
+	case STRIDED_WRITE:
+		for (x = 0; x < width; ++x)
+			for (y = 0; y < height; ++y)
+				pixel[y * stride_pixels + x] = (y << 16) | x;
+		break;
+	case STRIDED_READ:
+		for (x = 0; x < width; ++x)
+			for (y = 0; y < height; ++y)
+				sum += pixel[y * stride_pixels + x];
+		break;
+	}
+	bench_sink = sum;
+}
+
+static double mb_per_sec(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000.0 / ns : 0;
+}
+
+/*
+ * Access bandwidth through gbm_bo_map(), plus what the map and unmap calls
+ * themselves cost (these include any detiling copy the driver does).
+ */
+static int bench_gem_map(struct gbm_bo *bo, const char *layout)
+{
+	uint64_t access_ns[BENCH_MAP_ITERATIONS];
+	uint64_t map_ns[BENCH_MAP_ITERATIONS];
+	uint64_t unmap_ns[BENCH_MAP_ITERATIONS];
+	const uint64_t bytes = (uint64_t)BENCH_MAP_WIDTH * BENCH_MAP_HEIGHT * 4;
+	int pattern, n;
+
+	for (pattern = 0; pattern < NUM_ACCESS_PATTERNS; pattern++) {
+		uint32_t flags = is_write(pattern) ? GBM_BO_TRANSFER_WRITE :
+						     GBM_BO_TRANSFER_READ;
+
+		for (n = 0; n < BENCH_MAP_ITERATIONS; n++) {
+			uint64_t t0, t1, t2, t3;
+			uint32_t stride = 0;
+			void *map_data = NULL;
+			void *addr;
+
+			t0 = now_ns();
+			addr = gbm_bo_map(bo, 0, 0, BENCH_MAP_WIDTH,
+					  BENCH_MAP_HEIGHT, flags, &stride,
+					  &map_data, 0);
+			t1 = now_ns();
+			CHECK(addr != MAP_FAILED);
+			CHECK(map_data);
+			touch_pixels(addr, stride, BENCH_MAP_WIDTH,
+				     BENCH_MAP_HEIGHT, pattern);
+			t2 = now_ns();
+			gbm_bo_unmap(bo, map_data);
+			t3 = now_ns();
+
+			map_ns[n] = t1 - t0;
+			access_ns[n] = t2 - t1;
+			unmap_ns[n] = t3 - t2;
+		}
+
+		qsort(access_ns, BENCH_MAP_ITERATIONS, sizeof(uint64_t),
+		      compare_u64);
+		printf("map layout %s path gbm_map %s_mbps %.0f", layout,
+		       access_pattern_names[pattern],
+		       mb_per_sec(bytes, percentile(access_ns,
+						    BENCH_MAP_ITERATIONS, 50)));
+		print_latency("map", map_ns, BENCH_MAP_ITERATIONS);
+		print_latency("unmap", unmap_ns, BENCH_MAP_ITERATIONS);
+		printf("\n");
+	}
+
+	return 1;
+}
+
+/*
+ * Access bandwidth through a direct mmap() of the dma-buf, bracketed by
+ * DMA_BUF_IOCTL_SYNC as a client must do, with the cost of the two sync
+ * ioctls reported separately.
+ */
+static int bench_dmabuf_map(struct gbm_bo *bo, const char *layout)
+{
+	uint64_t access_ns[BENCH_MAP_ITERATIONS];
+	uint64_t start_ns[BENCH_MAP_ITERATIONS];
+	uint64_t end_ns[BENCH_MAP_ITERATIONS];
+	const uint64_t bytes = (uint64_t)BENCH_MAP_WIDTH * BENCH_MAP_HEIGHT * 4;
+	uint32_t stride = gbm_bo_get_stride(bo);
+	uint32_t length = gbm_bo_get_plane_size(bo, 0);
+	int pattern, n, ret, prime_fd;
+	void *addr;
+
+	prime_fd = gbm_bo_get_fd(bo);
+	CHECK(prime_fd > 0);
+
+	addr = mmap(NULL, length, (PROT_READ | PROT_WRITE), MAP_SHARED, prime_fd, 0);
+	if (addr == MAP_FAILED) {
+		printf("map layout %s path dmabuf unsupported\n", layout);
+		close(prime_fd);
+		return 1;
+	}
+
+	for (pattern = 0; pattern < NUM_ACCESS_PATTERNS; pattern++) {
+		uint64_t dir = is_write(pattern) ? DMA_BUF_SYNC_WRITE :
+						   DMA_BUF_SYNC_READ;
+
+		for (n = 0; n < BENCH_MAP_ITERATIONS; n++) {
+			struct dma_buf_sync sync_start = { 0 };
+			struct dma_buf_sync sync_end = { 0 };
+			uint64_t t0, t1, t2, t3;
+
+			sync_start.flags = DMA_BUF_SYNC_START | dir;
+			sync_end.flags = DMA_BUF_SYNC_END | dir;
+
+			t0 = now_ns();
+			ret = HANDLE_EINTR(ioctl(prime_fd, DMA_BUF_IOCTL_SYNC,
+						 &sync_start));
+			t1 = now_ns();
+			CHECK(ret == 0);
+			touch_pixels(addr, stride, BENCH_MAP_WIDTH,
+				     BENCH_MAP_HEIGHT, pattern);
+			t2 = now_ns();
+			ret = HANDLE_EINTR(ioctl(prime_fd, DMA_BUF_IOCTL_SYNC,
+						 &sync_end));
+			t3 = now_ns();
+			CHECK(ret == 0);
+
+			start_ns[n] = t1 - t0;
+			access_ns[n] = t2 - t1;
+			end_ns[n] = t3 - t2;
+		}
+
+		qsort(access_ns, BENCH_MAP_ITERATIONS, sizeof(uint64_t),
+		      compare_u64);
+		printf("map layout %s path dmabuf %s_mbps %.0f", layout,
+		       access_pattern_names[pattern],
+		       mb_per_sec(bytes, percentile(access_ns,
+						    BENCH_MAP_ITERATIONS, 50)));
+		print_latency("sync_start", start_ns, BENCH_MAP_ITERATIONS);
+		print_latency("sync_end", end_ns, BENCH_MAP_ITERATIONS);
+		printf("\n");
+	}
+
+	CHECK(munmap(addr, length) == 0);
+	CHECK(close(prime_fd) == 0);
+	return 1;
+}
+
+static int bench_map()
+{
+	int result = 1;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(bench_layout_list); i++) {
+		const char *layout = bench_layout_list[i].name;
+		uint32_t usage = bench_layout_list[i].usage;
+		struct gbm_bo *bo;
+
+		if (!gbm_device_is_format_supported(gbm, GBM_FORMAT_ARGB8888,
+						    usage))
+			continue;
+
+		bo = gbm_bo_create(gbm, BENCH_MAP_WIDTH, BENCH_MAP_HEIGHT,
+				   GBM_FORMAT_ARGB8888, usage);
+		CHECK(check_bo(bo));
+		printf("map layout %s modifier 0x%016llx stride %u\n", layout,
+		       (unsigned long long)gbm_bo_get_modifier(bo),
+		       gbm_bo_get_stride(bo));
+
+		result &= bench_gem_map(bo, layout);
+		result &= bench_dmabuf_map(bo, layout);
+		gbm_bo_destroy(bo);
+	}
+
+	return result;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [--bench [alloc] [map] [--threads N]]\n", name);
+	printf("  Without arguments, runs the correctness tests.\n");
+	printf("  --bench      run the named benchmarks (default: all)\n");
+	printf("  --threads N  maximum thread count for alloc scaling (%d)\n",
+	       BENCH_MAX_THREADS);
+}
+
+static int run_benchmarks(int argc, char *argv[])
+{
+	int max_threads = BENCH_MAX_THREADS;
+	int selected = 0;
+	int result, i;
+
+	for (i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "alloc")) {
+			selected |= BENCH_ALLOC;
+		} else if (!strcmp(argv[i], "map")) {
+			selected |= BENCH_MAP;
+		} else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			max_threads = atoi(argv[++i]);
+			if (max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!selected)
+		selected = ~0;
+
+	result = bench_init();
+	if (result && (selected & BENCH_ALLOC)) {
+		result &= bench_alloc_free();
+		result &= bench_alloc_scaling(max_threads);
+	}
+	if (result && (selected & BENCH_MAP))
+		result &= bench_map();
+	if (result)
+		result &= test_destroy();
+
+	if (!result) {
+		printf("[  FAILED  ] graphics_Gbm benchmark failed\n");
+		return EXIT_FAILURE;
+	}
+	printf("[  PASSED  ] graphics_Gbm benchmark success\n");
+	return EXIT_SUCCESS;
+}
+
 
 int main(int argc, char *argv[])
 {
 	int result, i, j;
 
+	if (argc > 1 && !strcmp(argv[1], "--bench"))
+		return run_benchmarks(argc, argv);
+	if (argc > 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	result = test_init();
 	if (result == ENODISPLAY) {
 		printf("[  PASSED  ] graphics_Gbm test no connected display found\n");
@@ -35,8 +35,40 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
             self._services.restore_services()
         super(graphics_SanAngeles, self).cleanup()
 
+    def run_matrixbench(self):
+        """
+        Times the SIMD matrix routines the demo uses against their scalar
+        references. Fails if the two disagree.
+        """
+        cmd = os.path.join(self.srcdir, 'matrixbench')
+        result = utils.run(cmd,
+                           stdout_tee=utils.TEE_TO_LOGS,
+                           stderr_tee=utils.TEE_TO_LOGS,
+                           ignore_status=True)
+        if result.exit_status:
+            raise error.TestFail('Failed: matrixbench: ' + result.stderr)
+        for name, value in re.findall(r'^(\w+)_ns = ([0-9.]+)',
+                                      result.stdout, re.M):
+            self.output_perf_value(
+                description='matrix_%s' % name,
+                value=float(value),
+                units='ns',
+                higher_is_better=False)
+
     @graphics_utils.GraphicsTest.failure_report_decorator('graphics_SanAngeles')
-    def run_once(self):
+    def run_once(self, benchmark_frames=0, checksum_interval=0):
+        """
+        Runs SanAngeles once.
+
+        @param benchmark_frames: if non-zero, render exactly this many frames
+                offscreen on a fixed camera path instead of running the demo
+                against the wall clock. Needs no display server.
+        @param checksum_interval: in benchmark mode, log a checksum of every
+                checksum_interval-th frame.
+        """
+        if benchmark_frames:
+            self.run_matrixbench()
+
         cmd_gl = os.path.join(self.srcdir, 'SanOGL')
         cmd_gles = os.path.join(self.srcdir, 'SanOGLES')
         cmd_gles_s = os.path.join(self.srcdir, 'SanOGLES_S')
@@ -52,7 +84,11 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
                 '%s, %s or %s.  Test setup error.' %
                 (cmd_gl, cmd_gles, cmd_gles_s))
 
-        cmd += ' ' + utils.graphics_platform()
+        if benchmark_frames:
+            cmd += ' -b %d -c %d surfaceless_egl' % (benchmark_frames,
+                                                     checksum_interval)
+        else:
+            cmd += ' ' + utils.graphics_platform()
         result = utils.run(cmd,
                            stderr_is_expected=False,
                            stdout_tee=utils.TEE_TO_LOGS,
@@ -72,6 +108,13 @@ class graphics_SanAngeles(graphics_utils.GraphicsTest):
             value=frame_rate,
             units='fps',
             higher_is_better=True)
+        for name, value in re.findall(
+                r'^(cpu|gpu|frame)_ms p50 = ([0-9.]+)', result.stdout, re.M):
+            self.output_perf_value(
+                description='%s_time_p50' % name,
+                value=float(value),
+                units='ms',
+                higher_is_better=False)
         if 'error' in result.stderr.lower():
             raise error.TestFail('Failed: stderr while running SanAngeles: ' +
                                  result.stderr + ' (' + report[0] + ')')
@@ -49,6 +49,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include "waffle.h"
 
 #ifdef SAN_ANGELES_OBSERVATION_GLES
@@ -74,6 +76,10 @@ static struct waffle_context *sContext;
 static int sWindowWidth = WINDOW_DEFAULT_WIDTH;
 static int sWindowHeight = WINDOW_DEFAULT_HEIGHT;
 #ifdef SAN_ANGELES_OBSERVATION_GLES
+static GLuint sFramebuffer;
+static GLuint sRenderbuffers[2];
+#endif  // SAN_ANGELES_OBSERVATION_GLES
+#ifdef SAN_ANGELES_OBSERVATION_GLES
 static const char sAppName[] =
     "San Angeles Observation OpenGL ES version example (Linux)";
 #else  // !SAN_ANGELES_OBSERVATION_GLES
@@ -166,6 +172,45 @@ static int initGraphics(int32_t platform)
     return rt;
 }
 
+// Benchmark mode renders into an FBO so that nothing depends on the window
+// system; with the surfaceless platform there is no visible surface at all.
+// Desktop GL builds render into the window's own back buffer.
+static int initOffscreen()
+{
+#ifdef SAN_ANGELES_OBSERVATION_GLES
+    glGenFramebuffers(1, &sFramebuffer);
+    glGenRenderbuffers(2, sRenderbuffers);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, sRenderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB565,
+                          sWindowWidth, sWindowHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, sRenderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+                          sWindowWidth, sWindowHeight);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, sRenderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, sRenderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Error: offscreen framebuffer is incomplete\n");
+        return 0;
+    }
+#endif  // SAN_ANGELES_OBSERVATION_GLES
+    return 1;
+}
+
+static void deinitOffscreen()
+{
+#ifdef SAN_ANGELES_OBSERVATION_GLES
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &sFramebuffer);
+    glDeleteRenderbuffers(2, sRenderbuffers);
+#endif  // SAN_ANGELES_OBSERVATION_GLES
+}
+
 static void deinitGraphics()
 {
     if (!waffle_make_current(sDisplay, NULL, NULL))
@@ -190,24 +235,168 @@ static struct platform_item {
     PLATFORM(X11_EGL),
     PLATFORM(GBM),
     PLATFORM(NULL),
+    PLATFORM(SURFACELESS_EGL),
     { NULL, 0 }
 };
 
+static double monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Nearest-rank percentile of an already sorted array.
+static double percentile(const double *sorted, int count, double pct)
+{
+    int rank = (int)(pct / 100.0 * count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1];
+}
+
+static void printTimes(const char *name, double *times, int count)
+{
+    qsort(times, count, sizeof(double), compareDouble);
+    fprintf(stdout, "%s_ms p50 = %.3f p90 = %.3f p99 = %.3f max = %.3f\n",
+            name, percentile(times, count, 50), percentile(times, count, 90),
+            percentile(times, count, 99), times[count - 1]);
+}
+
+// FNV-1a over the RGBA contents of the current read framebuffer.
+static unsigned int frameChecksum(unsigned char *pixels)
+{
+    unsigned int hash = 2166136261u;
+    size_t i, size = (size_t)sWindowWidth * sWindowHeight * 4;
+
+    glReadPixels(0, 0, sWindowWidth, sWindowHeight,
+                 GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    for (i = 0; i < size; ++i)
+    {
+        hash ^= pixels[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Renders exactly |numFrames| frames with ticks spaced evenly over one pass
+ * of the demonstration, so every run sees the same camera path regardless
+ * of how fast the GPU is. Per frame, cpu is the time spent in appRender()
+ * and gpu is the time then spent blocked in glFinish().
+ */
+static int runBenchmark(int numFrames, int checksumInterval)
+{
+    long tickStep = gAppRunLength / numFrames;
+    double *cpuTimes = malloc(numFrames * sizeof(double));
+    double *gpuTimes = malloc(numFrames * sizeof(double));
+    double *frameTimes = malloc(numFrames * sizeof(double));
+    unsigned char *pixels = malloc((size_t)sWindowWidth * sWindowHeight * 4);
+    double total_time = 0.0;
+    int frame;
+
+    if (!cpuTimes || !gpuTimes || !frameTimes || !pixels)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 0;
+    }
+    if (!initOffscreen())
+        return 0;
+
+    for (frame = 0; frame < numFrames && gAppAlive; ++frame)
+    {
+        double start, rendered, finished;
+
+        // appRender() treats a zero tick as "not started", so start at 1.
+        start = monotonicMs();
+        appRender(1 + frame * tickStep, sWindowWidth, sWindowHeight);
+        rendered = monotonicMs();
+        glFinish();
+        finished = monotonicMs();
+        checkGLErrors();
+
+        cpuTimes[frame] = rendered - start;
+        gpuTimes[frame] = finished - rendered;
+        frameTimes[frame] = finished - start;
+        total_time += finished - start;
+
+        if (checksumInterval > 0 && frame % checksumInterval == 0)
+            fprintf(stdout, "checksum frame %d = %08x\n",
+                    frame, frameChecksum(pixels));
+    }
+
+    if (frame < numFrames)
+        fprintf(stderr, "Error: demo ended after %d of %d frames\n",
+                frame, numFrames);
+    if (frame > 0)
+    {
+        printTimes("cpu", cpuTimes, frame);
+        printTimes("gpu", gpuTimes, frame);
+        printTimes("frame", frameTimes, frame);
+        fprintf(stdout, "frames = %d\n", frame);
+        fprintf(stdout, "frame_rate = %.1f\n", frame * 1000.0 / total_time);
+    }
+
+    deinitOffscreen();
+    free(pixels);
+    free(frameTimes);
+    free(gpuTimes);
+    free(cpuTimes);
+    return frame == numFrames;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: SanOGLES [-b frames] [-c interval] <platform>\n"
+            "  -b frames    offscreen benchmark of a fixed number of frames\n"
+            "  -c interval  with -b, checksum every interval-th frame\n");
+}
+
 int main(int argc, char *argv[])
 {
     // TODO(fjhenigman): add waffle_to_string_to_enum to waffle then use it
     // to parse the platform arg.
     int32_t platform_value = WAFFLE_NONE;
     struct platform_item *p = platform_list;
-    while (argc == 2 && p->name && platform_value == WAFFLE_NONE) {
-        if (!strcasecmp(argv[1], p->name))
+    int benchmarkFrames = 0;
+    int checksumInterval = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            benchmarkFrames = atoi(optarg);
+            break;
+        case 'c':
+            checksumInterval = atoi(optarg);
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (optind == argc - 1 && p->name && platform_value == WAFFLE_NONE) {
+        if (!strcasecmp(argv[optind], p->name))
             platform_value = p->value;
         ++p;
     }
 
-    if (platform_value == WAFFLE_NONE)
+    if (platform_value == WAFFLE_NONE || benchmarkFrames < 0 ||
+        checksumInterval < 0)
     {
-        fprintf(stderr, "Usage: SanOGLES <platform>\n");
+        usage();
         return EXIT_FAILURE;
     }
 
@@ -223,6 +412,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (benchmarkFrames > 0)
+    {
+        int ok = runBenchmark(benchmarkFrames, checksumInterval);
+        appDeinit();
+        deinitGraphics();
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     double total_time = 0.0;
     int num_frames = 0;
 
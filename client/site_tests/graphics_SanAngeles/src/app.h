@@ -52,6 +52,11 @@ extern void appRender(long tick, int width, int height);
  */
 extern int gAppAlive;
 
+/* Length of one pass through the demonstration in ticks, i.e. the tick
+ * value at which appRender() clears gAppAlive. Defined by the application.
+ */
+extern const long gAppRunLength;
+
 
 #ifdef __cplusplus
 }
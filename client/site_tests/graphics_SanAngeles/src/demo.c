@@ -57,6 +57,8 @@
 #define RANDOM_UINT_MAX 65535
 
 
+const long gAppRunLength = RUN_LENGTH;
+
 static unsigned long sRandomSeed = 0;
 
 static void seedRandom(unsigned long seed)
@@ -753,17 +755,18 @@ static void prepareFrame(int width, int height)
 
 static void configureLightAndMaterial()
 {
-    GLfloat light0Position[] = { -4.f, 1.f, 1.f, 0 };
-    GLfloat light1Position[] = { 1.f, -2.f, -1.f, 0 };
-    GLfloat light2Position[] = { -1.f, 0, -4.f, 0 };
+    // Kept contiguous so the GLES path transforms all three in one call.
+    GLfloat lightPositions[3][4] = {
+        { -4.f, 1.f, 1.f, 0 },
+        { 1.f, -2.f, -1.f, 0 },
+        { -1.f, 0, -4.f, 0 },
+    };
+    GLfloat *light0Position = lightPositions[0];
+    GLfloat *light1Position = lightPositions[1];
+    GLfloat *light2Position = lightPositions[2];
 
 #ifdef SAN_ANGELES_OBSERVATION_GLES
-    Matrix4x4_Transform(sModelView,
-                        light0Position, light0Position + 1, light0Position + 2);
-    Matrix4x4_Transform(sModelView,
-                        light1Position, light1Position + 1, light1Position + 2);
-    Matrix4x4_Transform(sModelView,
-                        light2Position, light2Position + 1, light2Position + 2);
+    Matrix4x4_TransformVectors4(sModelView, &lightPositions[0][0], 3);
 
     bindShaderProgram(sShaderLit.program);
     glUniform3fv(sShaderLit.light_0_direction, 1, light0Position);
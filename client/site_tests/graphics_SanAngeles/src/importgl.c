@@ -53,29 +53,40 @@ int importGLInit()
 
     IMPORT_FUNC_GL(glAttachShader);
     IMPORT_FUNC_GL(glBindBuffer);
+    IMPORT_FUNC_GL(glBindFramebuffer);
+    IMPORT_FUNC_GL(glBindRenderbuffer);
     IMPORT_FUNC_GL(glBlendFunc);
     IMPORT_FUNC_GL(glBufferData);
     IMPORT_FUNC_GL(glBufferSubData);
+    IMPORT_FUNC_GL(glCheckFramebufferStatus);
     IMPORT_FUNC_GL(glClear);
     IMPORT_FUNC_GL(glClearColor);
     IMPORT_FUNC_GL(glCompileShader);
     IMPORT_FUNC_GL(glCreateProgram);
     IMPORT_FUNC_GL(glCreateShader);
     IMPORT_FUNC_GL(glDeleteBuffers);
+    IMPORT_FUNC_GL(glDeleteFramebuffers);
     IMPORT_FUNC_GL(glDeleteProgram);
+    IMPORT_FUNC_GL(glDeleteRenderbuffers);
     IMPORT_FUNC_GL(glDeleteShader);
     IMPORT_FUNC_GL(glDisable);
     IMPORT_FUNC_GL(glDisableVertexAttribArray);
     IMPORT_FUNC_GL(glDrawArrays);
     IMPORT_FUNC_GL(glEnable);
     IMPORT_FUNC_GL(glEnableVertexAttribArray);
+    IMPORT_FUNC_GL(glFinish);
+    IMPORT_FUNC_GL(glFramebufferRenderbuffer);
     IMPORT_FUNC_GL(glGenBuffers);
+    IMPORT_FUNC_GL(glGenFramebuffers);
+    IMPORT_FUNC_GL(glGenRenderbuffers);
     IMPORT_FUNC_GL(glGetAttribLocation);
     IMPORT_FUNC_GL(glGetError);
     IMPORT_FUNC_GL(glGetShaderiv);
     IMPORT_FUNC_GL(glGetShaderInfoLog);
     IMPORT_FUNC_GL(glGetUniformLocation);
     IMPORT_FUNC_GL(glLinkProgram);
+    IMPORT_FUNC_GL(glReadPixels);
+    IMPORT_FUNC_GL(glRenderbufferStorage);
     IMPORT_FUNC_GL(glShaderSource);
     IMPORT_FUNC_GL(glUniform1f);
     IMPORT_FUNC_GL(glUniform3fv);
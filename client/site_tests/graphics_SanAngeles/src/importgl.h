@@ -59,11 +59,14 @@ extern int importGLInit();
 
 FNDEF(void, glAttachShader, (GLuint program, GLuint shader));
 FNDEF(void, glBindBuffer, (GLenum target, GLuint buffer));
+FNDEF(void, glBindFramebuffer, (GLenum target, GLuint framebuffer));
+FNDEF(void, glBindRenderbuffer, (GLenum target, GLuint renderbuffer));
 FNDEF(void, glBlendFunc, (GLenum sfactor, GLenum dfactor));
 FNDEF(void, glBufferData, (GLenum target, GLsizeiptr size,
                            const void* data, GLenum usage));
 FNDEF(void, glBufferSubData, (GLenum target, GLintptr offset,
                               GLsizeiptr size, const void* data));
+FNDEF(GLenum, glCheckFramebufferStatus, (GLenum target));
 FNDEF(void, glClear, (GLbitfield mask));
 FNDEF(void, glClearColor, (GLclampf red, GLclampf green, GLclampf blue,
                            GLclampf alpha));
@@ -71,14 +74,22 @@ FNDEF(void, glCompileShader, (GLuint shader));
 FNDEF(GLuint, glCreateProgram, (void));
 FNDEF(GLuint, glCreateShader, (GLenum type));
 FNDEF(void, glDeleteBuffers, (GLsizei n, const GLuint* buffers));
+FNDEF(void, glDeleteFramebuffers, (GLsizei n, const GLuint* framebuffers));
 FNDEF(void, glDeleteProgram, (GLuint program));
+FNDEF(void, glDeleteRenderbuffers, (GLsizei n, const GLuint* renderbuffers));
 FNDEF(void, glDeleteShader, (GLuint shader));
 FNDEF(void, glDisable, (GLenum cap));
 FNDEF(void, glDisableVertexAttribArray, (GLuint index));
 FNDEF(void, glDrawArrays, (GLenum mode, GLint first, GLsizei count));
 FNDEF(void, glEnable, (GLenum cap));
 FNDEF(void, glEnableVertexAttribArray, (GLuint index));
+FNDEF(void, glFinish, (void));
+FNDEF(void, glFramebufferRenderbuffer, (GLenum target, GLenum attachment,
+                                        GLenum renderbuffertarget,
+                                        GLuint renderbuffer));
 FNDEF(void, glGenBuffers, (GLsizei n, GLuint* buffers));
+FNDEF(void, glGenFramebuffers, (GLsizei n, GLuint* framebuffers));
+FNDEF(void, glGenRenderbuffers, (GLsizei n, GLuint* renderbuffers));
 FNDEF(int, glGetAttribLocation, (GLuint program, const char* name));
 FNDEF(GLenum, glGetError, (void));
 FNDEF(void, glGetShaderiv, (GLuint shader, GLenum pname, GLint* params));
@@ -86,6 +97,10 @@ FNDEF(void, glGetShaderInfoLog, (GLuint shader, GLsizei bufsize,
                                  GLsizei* length, char* infolog));
 FNDEF(int, glGetUniformLocation, (GLuint program, const char* name));
 FNDEF(void, glLinkProgram, (GLuint program));
+FNDEF(void, glReadPixels, (GLint x, GLint y, GLsizei width, GLsizei height,
+                           GLenum format, GLenum type, void* pixels));
+FNDEF(void, glRenderbufferStorage, (GLenum target, GLenum internalformat,
+                                    GLsizei width, GLsizei height));
 FNDEF(void, glShaderSource, (GLuint shader, GLsizei count,
                              const char** string, const GLint* length));
 FNDEF(void, glUniform1f, (GLint location, GLfloat x));
@@ -110,23 +125,32 @@ FNDEF(void, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height));
 
 #define glAttachShader              FNPTR(glAttachShader)
 #define glBindBuffer                FNPTR(glBindBuffer)
+#define glBindFramebuffer           FNPTR(glBindFramebuffer)
+#define glBindRenderbuffer          FNPTR(glBindRenderbuffer)
 #define glBlendFunc                 FNPTR(glBlendFunc)
 #define glBufferData                FNPTR(glBufferData)
 #define glBufferSubData             FNPTR(glBufferSubData)
+#define glCheckFramebufferStatus    FNPTR(glCheckFramebufferStatus)
 #define glClear                     FNPTR(glClear)
 #define glClearColor                FNPTR(glClearColor)
 #define glCompileShader             FNPTR(glCompileShader)
 #define glCreateProgram             FNPTR(glCreateProgram)
 #define glCreateShader              FNPTR(glCreateShader)
 #define glDeleteBuffers             FNPTR(glDeleteBuffers)
+#define glDeleteFramebuffers        FNPTR(glDeleteFramebuffers)
 #define glDeleteProgram             FNPTR(glDeleteProgram)
+#define glDeleteRenderbuffers       FNPTR(glDeleteRenderbuffers)
 #define glDeleteShader              FNPTR(glDeleteShader)
 #define glDisable                   FNPTR(glDisable)
 #define glDisableVertexAttribArray  FNPTR(glDisableVertexAttribArray)
 #define glDrawArrays                FNPTR(glDrawArrays)
 #define glEnable                    FNPTR(glEnable)
 #define glEnableVertexAttribArray   FNPTR(glEnableVertexAttribArray)
+#define glFinish                    FNPTR(glFinish)
+#define glFramebufferRenderbuffer   FNPTR(glFramebufferRenderbuffer)
 #define glGenBuffers                FNPTR(glGenBuffers)
+#define glGenFramebuffers           FNPTR(glGenFramebuffers)
+#define glGenRenderbuffers          FNPTR(glGenRenderbuffers)
 #define glGetAttribLocation         FNPTR(glGetAttribLocation)
 #define glGetError                  FNPTR(glGetError)
 #define glGetShaderiv               FNPTR(glGetShaderiv)
@@ -134,6 +158,8 @@ FNDEF(void, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height));
 #define glGetUniformLocation        FNPTR(glGetUniformLocation)
 
 #define glLinkProgram               FNPTR(glLinkProgram)
+#define glReadPixels                FNPTR(glReadPixels)
+#define glRenderbufferStorage       FNPTR(glRenderbufferStorage)
 #define glShaderSource              FNPTR(glShaderSource)
 #define glUniform1f                 FNPTR(glUniform1f)
 #define glUniform3fv                FNPTR(glUniform3fv)
@@ -0,0 +1,137 @@
+// Copyright (c) 2010 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Micro-benchmark for matrixop.c: times the SIMD entry points against their
+// scalar references and checks that both produce the same results.
+//
+// Usage: matrixbench [iterations]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "matrixop.h"
+
+#define POINT_COUNT 4096
+#define DEFAULT_ITERATIONS 1000000
+#define TOLERANCE 1e-4f
+
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void randomMatrix(Matrix4x4 mat)
+{
+    int i;
+    for (i = 0; i < 16; ++i)
+        mat[i] = (float)rand() / RAND_MAX * 2.f - 1.f;
+}
+
+static float maxDiff(const float *a, const float *b, int n)
+{
+    float diff = 0;
+    int i;
+    for (i = 0; i < n; ++i)
+        if (fabsf(a[i] - b[i]) > diff)
+            diff = fabsf(a[i] - b[i]);
+    return diff;
+}
+
+// The running matrix is fed back into every multiply so the compiler cannot
+// hoist the call out of the loop; it is reset periodically to keep it
+// finite.
+static double benchMultiply(void (*mul)(Matrix4x4, Matrix4x4, Matrix4x4),
+                            Matrix4x4 a, Matrix4x4 b, long iterations)
+{
+    Matrix4x4 acc;
+    double start;
+    long i;
+
+    Matrix4x4_Copy(acc, a);
+    start = nowSeconds();
+    for (i = 0; i < iterations; ++i)
+    {
+        mul(acc, b, acc);
+        if ((i & 63) == 63)
+            Matrix4x4_Copy(acc, a);
+    }
+    return (nowSeconds() - start) * 1e9 / iterations;
+}
+
+static double benchTransform(void (*xform)(Matrix4x4, const float *,
+                                          float *, int),
+                             Matrix4x4 mat, const float *in, float *out,
+                             long iterations)
+{
+    double start = nowSeconds();
+    long i;
+    for (i = 0; i < iterations; ++i)
+        xform(mat, in, out, POINT_COUNT);
+    return (nowSeconds() - start) * 1e9 / ((double)iterations * POINT_COUNT);
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = DEFAULT_ITERATIONS;
+    Matrix4x4 a, b, simd, scalar;
+    float *points, *outSimd, *outScalar;
+    float diff;
+    int i;
+
+    if (argc > 2 || (argc == 2 && (iterations = atol(argv[1])) <= 0))
+    {
+        fprintf(stderr, "Usage: matrixbench [iterations]\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(15);
+    randomMatrix(a);
+    randomMatrix(b);
+
+    points = malloc(3 * POINT_COUNT * sizeof(float));
+    outSimd = malloc(3 * POINT_COUNT * sizeof(float));
+    outScalar = malloc(3 * POINT_COUNT * sizeof(float));
+    if (!points || !outSimd || !outScalar)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < 3 * POINT_COUNT; ++i)
+        points[i] = (float)rand() / RAND_MAX * 100.f - 50.f;
+
+    // Correctness first; a fast wrong answer is not interesting.
+    Matrix4x4_Multiply(simd, a, b);
+    Matrix4x4_Multiply_Scalar(scalar, a, b);
+    diff = maxDiff(simd, scalar, 16);
+    Matrix4x4_TransformPoints(a, points, outSimd, POINT_COUNT);
+    Matrix4x4_TransformPoints_Scalar(a, points, outScalar, POINT_COUNT);
+    if (maxDiff(outSimd, outScalar, 3 * POINT_COUNT) > diff)
+        diff = maxDiff(outSimd, outScalar, 3 * POINT_COUNT);
+    if (diff > TOLERANCE)
+    {
+        fprintf(stderr, "Error: SIMD result differs from scalar by %g\n",
+                diff);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "multiply_scalar_ns = %.2f\n",
+            benchMultiply(Matrix4x4_Multiply_Scalar, a, b, iterations));
+    fprintf(stdout, "multiply_simd_ns = %.2f\n",
+            benchMultiply(Matrix4x4_Multiply, a, b, iterations));
+    fprintf(stdout, "transform_point_scalar_ns = %.3f\n",
+            benchTransform(Matrix4x4_TransformPoints_Scalar, a, points,
+                           outScalar, iterations / POINT_COUNT + 1));
+    fprintf(stdout, "transform_point_simd_ns = %.3f\n",
+            benchTransform(Matrix4x4_TransformPoints, a, points,
+                           outSimd, iterations / POINT_COUNT + 1));
+
+    free(points);
+    free(outSimd);
+    free(outScalar);
+    return EXIT_SUCCESS;
+}
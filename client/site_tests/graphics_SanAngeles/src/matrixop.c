@@ -5,19 +5,27 @@
 #include "matrixop.h"
 
 #include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define MATRIXOP_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MATRIXOP_NEON 1
+#endif
 
 #define PI 3.1415926535897932384626433832795f
 
 
 void Matrix4x4_Copy(Matrix4x4 dst, Matrix4x4 src)
 {
-    int i;
-    for (i = 0; i < 16; ++i)
-        dst[i] = src[i];
+    memcpy(dst, src, sizeof(Matrix4x4));
 }
 
 
-void Matrix4x4_Multiply(Matrix4x4 result, Matrix4x4 mat1, Matrix4x4 mat2)
+void Matrix4x4_Multiply_Scalar(Matrix4x4 result,
+                               Matrix4x4 mat1, Matrix4x4 mat2)
 {
     Matrix4x4 tmp;
     int i, j, k;
@@ -33,6 +41,53 @@ void Matrix4x4_Multiply(Matrix4x4 result, Matrix4x4 mat1, Matrix4x4 mat2)
 }
 
 
+// Row i of the result is the sum over k of mat1[i][k] * (row k of mat2),
+// so each output row is four broadcast multiply-adds. All rows are computed
+// before any is stored because |result| may alias either input.
+void Matrix4x4_Multiply(Matrix4x4 result, Matrix4x4 mat1, Matrix4x4 mat2)
+{
+#if defined(MATRIXOP_SSE)
+    __m128 r0 = _mm_loadu_ps(mat2 + 0);
+    __m128 r1 = _mm_loadu_ps(mat2 + 4);
+    __m128 r2 = _mm_loadu_ps(mat2 + 8);
+    __m128 r3 = _mm_loadu_ps(mat2 + 12);
+    __m128 out[4];
+    int i;
+    for (i = 0; i < 4; ++i)
+    {
+        const float *a = mat1 + i*4;
+        __m128 acc = _mm_mul_ps(_mm_set1_ps(a[0]), r0);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(a[1]), r1));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(a[2]), r2));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(a[3]), r3));
+        out[i] = acc;
+    }
+    for (i = 0; i < 4; ++i)
+        _mm_storeu_ps(result + i*4, out[i]);
+#elif defined(MATRIXOP_NEON)
+    float32x4_t r0 = vld1q_f32(mat2 + 0);
+    float32x4_t r1 = vld1q_f32(mat2 + 4);
+    float32x4_t r2 = vld1q_f32(mat2 + 8);
+    float32x4_t r3 = vld1q_f32(mat2 + 12);
+    float32x4_t out[4];
+    int i;
+    for (i = 0; i < 4; ++i)
+    {
+        const float *a = mat1 + i*4;
+        float32x4_t acc = vmulq_n_f32(r0, a[0]);
+        acc = vmlaq_n_f32(acc, r1, a[1]);
+        acc = vmlaq_n_f32(acc, r2, a[2]);
+        acc = vmlaq_n_f32(acc, r3, a[3]);
+        out[i] = acc;
+    }
+    for (i = 0; i < 4; ++i)
+        vst1q_f32(result + i*4, out[i]);
+#else
+    Matrix4x4_Multiply_Scalar(result, mat1, mat2);
+#endif
+}
+
+
 void Matrix4x4_LoadIdentity(Matrix4x4 mat)
 {
     int i;
@@ -186,3 +241,97 @@ void Matrix4x4_Transform(Matrix4x4 mat, float *x, float *y, float *z)
     *z = tz;
 }
 
+
+void Matrix4x4_TransformPoints_Scalar(Matrix4x4 mat, const float *in,
+                                      float *out, int count)
+{
+    int n;
+    for (n = 0; n < count; ++n, in += 3, out += 3)
+    {
+        float x = in[0], y = in[1], z = in[2];
+        out[0] = mat[0*4 + 0] * x + mat[1*4 + 0] * y + mat[2*4 + 0] * z +
+                 mat[3*4 + 0];
+        out[1] = mat[0*4 + 1] * x + mat[1*4 + 1] * y + mat[2*4 + 1] * z +
+                 mat[3*4 + 1];
+        out[2] = mat[0*4 + 2] * x + mat[1*4 + 2] * y + mat[2*4 + 2] * z +
+                 mat[3*4 + 2];
+    }
+}
+
+
+void Matrix4x4_TransformPoints(Matrix4x4 mat, const float *in,
+                               float *out, int count)
+{
+#if defined(MATRIXOP_SSE) || defined(MATRIXOP_NEON)
+    float tmp[4];
+    int n;
+#if defined(MATRIXOP_SSE)
+    __m128 c0 = _mm_loadu_ps(mat + 0);
+    __m128 c1 = _mm_loadu_ps(mat + 4);
+    __m128 c2 = _mm_loadu_ps(mat + 8);
+    __m128 c3 = _mm_loadu_ps(mat + 12);
+#else
+    float32x4_t c0 = vld1q_f32(mat + 0);
+    float32x4_t c1 = vld1q_f32(mat + 4);
+    float32x4_t c2 = vld1q_f32(mat + 8);
+    float32x4_t c3 = vld1q_f32(mat + 12);
+#endif
+    // Points are packed xyz, so the 4-wide result is written through a
+    // scratch vector; |in| and |out| may be the same array.
+    for (n = 0; n < count; ++n, in += 3, out += 3)
+    {
+#if defined(MATRIXOP_SSE)
+        __m128 acc = _mm_add_ps(c3, _mm_mul_ps(_mm_set1_ps(in[0]), c0));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(in[1]), c1));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(in[2]), c2));
+        _mm_storeu_ps(tmp, acc);
+#else
+        float32x4_t acc = vmlaq_n_f32(c3, c0, in[0]);
+        acc = vmlaq_n_f32(acc, c1, in[1]);
+        acc = vmlaq_n_f32(acc, c2, in[2]);
+        vst1q_f32(tmp, acc);
+#endif
+        out[0] = tmp[0];
+        out[1] = tmp[1];
+        out[2] = tmp[2];
+    }
+#else
+    Matrix4x4_TransformPoints_Scalar(mat, in, out, count);
+#endif
+}
+
+
+void Matrix4x4_TransformVectors4(Matrix4x4 mat, float *vec, int count)
+{
+    int n;
+#if defined(MATRIXOP_SSE)
+    __m128 c0 = _mm_loadu_ps(mat + 0);
+    __m128 c1 = _mm_loadu_ps(mat + 4);
+    __m128 c2 = _mm_loadu_ps(mat + 8);
+    for (n = 0; n < count; ++n, vec += 4)
+    {
+        __m128 acc = _mm_mul_ps(_mm_set1_ps(vec[0]), c0);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(vec[1]), c1));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(vec[2]), c2));
+        _mm_storeu_ps(vec, acc);
+    }
+#elif defined(MATRIXOP_NEON)
+    float32x4_t c0 = vld1q_f32(mat + 0);
+    float32x4_t c1 = vld1q_f32(mat + 4);
+    float32x4_t c2 = vld1q_f32(mat + 8);
+    for (n = 0; n < count; ++n, vec += 4)
+    {
+        float32x4_t acc = vmulq_n_f32(c0, vec[0]);
+        acc = vmlaq_n_f32(acc, c1, vec[1]);
+        acc = vmlaq_n_f32(acc, c2, vec[2]);
+        vst1q_f32(vec, acc);
+    }
+#else
+    for (n = 0; n < count; ++n, vec += 4)
+    {
+        vec[3] = mat[0*4 + 3] * vec[0] + mat[1*4 + 3] * vec[1] +
+                 mat[2*4 + 3] * vec[2];
+        Matrix4x4_Transform(mat, vec, vec + 1, vec + 2);
+    }
+#endif
+}
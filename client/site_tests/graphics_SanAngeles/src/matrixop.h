@@ -12,6 +12,8 @@ typedef float Matrix4x4[16];
 typedef float Matrix3x3[9];
 
 // result = mat1 * mat2
+// Uses SSE or NEON when the compiler targets them. |result| may alias
+// either input.
 extern void Matrix4x4_Multiply(Matrix4x4 result,
                                Matrix4x4 mat1, Matrix4x4 mat2);
 
@@ -44,5 +46,24 @@ extern void Matrix4x4_Perspective(Matrix4x4 mat, float fovy, float aspect,
 // [x,y,z] = mat(3x3) * [x,y,z]
 extern void Matrix4x4_Transform(Matrix4x4 mat, float *x, float *y, float *z);
 
+// Batched transforms. These are the calls to use when more than one
+// vector goes through the same matrix.
+
+// out[n] = mat * [in[n], 1] for |count| packed [x,y,z] points.
+// |in| and |out| may be the same array.
+extern void Matrix4x4_TransformPoints(Matrix4x4 mat, const float *in,
+                                      float *out, int count);
+
+// vec[n] = mat * [x,y,z,0] in place for |count| packed [x,y,z,w] vectors,
+// e.g. directional light positions.
+extern void Matrix4x4_TransformVectors4(Matrix4x4 mat, float *vec, int count);
+
+// Plain C versions of the SIMD paths above, kept for matrixbench and as
+// the reference the SIMD code is checked against.
+extern void Matrix4x4_Multiply_Scalar(Matrix4x4 result,
+                                      Matrix4x4 mat1, Matrix4x4 mat2);
+extern void Matrix4x4_TransformPoints_Scalar(Matrix4x4 mat, const float *in,
+                                             float *out, int count);
+
 #endif  // MATRIXOP_H_INCLUDED
 
@@ -8,12 +8,13 @@ tests = [["aio-dio-invalidate-failure", "poo"],
          ["aio-free-ring-with-bogus-nr-pages", ""],
          ["aio-io-setup-with-nonwritable-context-pointer", ""],
          ["aio-dio-extend-stat", "file"],
+         ["aio-dio-race-fuzz", "-t 60 fuzzfile"],
         ]
 name = 0
 arglist = 1
 
 class aio_dio_bugs(test.test):
-    version = 5
+    version = 6
     preserve_srcdir = True
 
     def initialize(self):
@@ -0,0 +1,666 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <libaio.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * Race fuzzer for the bugs the other programs in this directory each
+ * reproduce with one fixed sequence.  Several threads share a few files and
+ * randomly interleave AIO-DIO writes and reads, buffered reads, truncates,
+ * fallocate, fstat and faults through a shared mapping.  Every completed
+ * aio is run past a set of invariants taken from those reproducers:
+ *
+ *   extend-stat	aio-dio-extend-stat: once an extending write has
+ *			completed, fstat must see the new size
+ *   eof-read		aio-dio-subblock-eof-read: a DIO read across EOF
+ *			returns only the bytes before EOF
+ *   single-completion	aio-dio-invalidate-failure: an iocb completes once,
+ *			and a full DIO write doesn't come back -EIO
+ *
+ * The size invariants only judge an io when nothing that could have moved
+ * EOF the other way overlapped it; the summary says how many ios each one
+ * actually checked.  Each thread has its own stream, seeded by mixing the
+ * seed with the thread number, and takes exactly one value from it per
+ * operation to seed that operation's draws.  How many draws an operation
+ * makes depends on the file sizes it sees, but that can't shift the
+ * operations after it, so a seed replays the same per-thread sequences,
+ * though not the same interleaving.
+ */
+
+#ifndef O_DIRECT
+#define O_DIRECT         040000 /* direct disk access hint */
+#endif
+
+#define MAX_THREADS	64
+#define MAX_FILES	64
+#define MAX_DEPTH	64
+#define MAX_IO		(64 * 1024)
+
+#define fail(fmt , args...) do {\
+	printf(fmt , ##args);	\
+	exit(1);		\
+} while (0)
+
+enum {
+	OP_DIO_WRITE,
+	OP_DIO_READ,
+	OP_BUFFERED_READ,
+	OP_TRUNCATE,
+	OP_FALLOCATE,
+	OP_FSTAT,
+	OP_MMAP_FAULT,
+	NR_OPS
+};
+
+static const char *op_names[NR_OPS] = {
+	"dio-write", "dio-read", "buffered-read", "truncate", "fallocate",
+	"fstat", "mmap-fault",
+};
+
+/* relative frequency of each operation */
+static const unsigned int op_weights[NR_OPS] = { 6, 4, 3, 2, 1, 2, 2 };
+
+/*
+ * Counters that let a completion tell whether EOF could have moved under
+ * it.  An operation that may shrink or grow the file bumps the matching
+ * count while it runs and the seq as it starts and finishes; an io is only
+ * judged if the count was zero when it was issued and the seq hasn't moved
+ * by the time it completes.
+ */
+struct size_guard {
+	unsigned long seq;
+	unsigned long active;
+};
+
+struct fuzz_file {
+	int dio_fd;
+	int fd;
+	char *map;
+	struct size_guard shrink;	/* truncate */
+	struct size_guard resize;	/* truncate, growing fallocate, dio writes */
+};
+
+/* one in-flight aio, the iocb comes first so an event leads back here */
+struct fuzz_io {
+	struct iocb iocb;
+	struct fuzz_file *file;
+	int in_flight;
+	off_t size;			/* fstat size when issued */
+	unsigned long shrink_seq;
+	unsigned long resize_seq;
+	int shrink_ok;
+	int resize_ok;
+};
+
+struct fuzz_thread {
+	pthread_t tid;
+	int id;
+	unsigned long long seq;		/* one value per operation */
+	unsigned long long rng;		/* the current operation's draws */
+	io_context_t ctx;
+	struct fuzz_io ios[MAX_DEPTH];
+	struct fuzz_io *free_ios[MAX_DEPTH];
+	int nr_free;
+	char *buf;
+	unsigned long long ops[NR_OPS];
+	unsigned long long sigbus;
+};
+
+/*
+ * An invariant looks at one completed aio and returns non-zero if it
+ * judged it, so the summary can say how much checking really happened.
+ * Failing is fatal.
+ */
+struct invariant {
+	const char *name;
+	int (*check)(struct fuzz_thread *t, struct fuzz_io *io, long res);
+	int enabled;
+	unsigned long long checked;
+};
+
+static unsigned long long seed;
+static int seconds = 10;
+static int nr_threads = 4;
+static int nr_files = 2;
+static int depth = 8;
+static off_t max_size = 8 << 20;
+static unsigned int align = 4096;
+static const char *path;
+
+static struct fuzz_file files[MAX_FILES];
+static struct fuzz_thread threads[MAX_THREADS];
+static volatile int stop;
+static int no_fallocate;
+
+static __thread sigjmp_buf fault_jmp;
+static __thread volatile int fault_armed;
+
+/* the splitmix64 output function, also used to seed the thread streams */
+static unsigned long long mix64(unsigned long long z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned long long splitmix64(unsigned long long *state)
+{
+	return mix64(*state += 0x9e3779b97f4a7c15ULL);
+}
+
+static unsigned long long rnd(struct fuzz_thread *t)
+{
+	return splitmix64(&t->rng);
+}
+
+static unsigned long long rnd_below(struct fuzz_thread *t,
+				    unsigned long long n)
+{
+	return rnd(t) % n;
+}
+
+static void guard_enter(struct size_guard *g)
+{
+	__atomic_add_fetch(&g->active, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&g->seq, 1, __ATOMIC_SEQ_CST);
+}
+
+static void guard_exit(struct size_guard *g)
+{
+	__atomic_add_fetch(&g->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&g->active, 1, __ATOMIC_SEQ_CST);
+}
+
+/* seq is read before active, see struct size_guard */
+static int guard_snapshot(struct size_guard *g, unsigned long *seq)
+{
+	*seq = __atomic_load_n(&g->seq, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&g->active, __ATOMIC_SEQ_CST) == 0;
+}
+
+static int guard_unchanged(struct size_guard *g, unsigned long seq)
+{
+	return __atomic_load_n(&g->seq, __ATOMIC_SEQ_CST) == seq;
+}
+
+static off_t file_size(struct fuzz_file *f)
+{
+	struct stat st;
+
+	if (fstat(f->fd, &st))
+		fail("fstat failed: %d\n", errno);
+	return st.st_size;
+}
+
+static int check_extend_stat(struct fuzz_thread *t, struct fuzz_io *io,
+			     long res)
+{
+	off_t end = io->iocb.u.c.offset + io->iocb.u.c.nbytes;
+	off_t size;
+
+	if (io->iocb.aio_lio_opcode != IO_CMD_PWRITE ||
+	    res != (long)io->iocb.u.c.nbytes || !io->shrink_ok)
+		return 0;
+	size = file_size(io->file);
+	if (!guard_unchanged(&io->file->shrink, io->shrink_seq))
+		return 0;
+	if (size < end)
+		fail("extend-stat: write of %lu bytes @%lld finished, "
+		     "expected filesize at least %lld, but got %lld "
+		     "(seed %llu thread %d)\n", io->iocb.u.c.nbytes,
+		     io->iocb.u.c.offset, (long long)end, (long long)size,
+		     seed, t->id);
+	return 1;
+}
+
+static int check_eof_read(struct fuzz_thread *t, struct fuzz_io *io,
+			  long res)
+{
+	long expect;
+
+	if (io->iocb.aio_lio_opcode != IO_CMD_PREAD || !io->resize_ok ||
+	    !guard_unchanged(&io->file->resize, io->resize_seq))
+		return 0;
+	expect = io->size - io->iocb.u.c.offset;
+	if (expect < 0)
+		expect = 0;
+	if (expect > (long)io->iocb.u.c.nbytes)
+		expect = io->iocb.u.c.nbytes;
+	if (res != expect)
+		fail("eof-read: AIO read of %lu bytes @%lld in a %lld byte "
+		     "file returned %ld, expected %ld (seed %llu thread %d)\n",
+		     io->iocb.u.c.nbytes, io->iocb.u.c.offset,
+		     (long long)io->size, res, expect, seed, t->id);
+	return 1;
+}
+
+static int check_single_completion(struct fuzz_thread *t, struct fuzz_io *io,
+				   long res)
+{
+	if (!io->in_flight)
+		fail("single-completion: iocb for %lu bytes @%lld completed "
+		     "twice, res %ld (seed %llu thread %d)\n",
+		     io->iocb.u.c.nbytes, io->iocb.u.c.offset, res, seed,
+		     t->id);
+	if (io->iocb.aio_lio_opcode == IO_CMD_PWRITE &&
+	    res != (long)io->iocb.u.c.nbytes && res != -ENOSPC)
+		fail("single-completion: DIO write of %lu bytes @%lld "
+		     "returned %ld (seed %llu thread %d)\n",
+		     io->iocb.u.c.nbytes, io->iocb.u.c.offset, res, seed,
+		     t->id);
+	if (io->iocb.aio_lio_opcode == IO_CMD_PREAD &&
+	    (res < 0 || res > (long)io->iocb.u.c.nbytes))
+		fail("single-completion: DIO read of %lu bytes @%lld "
+		     "returned %ld (seed %llu thread %d)\n",
+		     io->iocb.u.c.nbytes, io->iocb.u.c.offset, res, seed,
+		     t->id);
+	return 1;
+}
+
+static struct invariant invariants[] = {
+	{ "extend-stat", check_extend_stat, 1, 0 },
+	{ "eof-read", check_eof_read, 1, 0 },
+	{ "single-completion", check_single_completion, 1, 0 },
+};
+#define NR_INVARIANTS (sizeof(invariants) / sizeof(invariants[0]))
+
+static void complete_io(struct fuzz_thread *t, struct io_event *ev)
+{
+	struct fuzz_io *io = (struct fuzz_io *)ev->obj;
+	unsigned int i;
+
+	for (i = 0; i < NR_INVARIANTS; i++)
+		if (invariants[i].enabled &&
+		    invariants[i].check(t, io, (long)ev->res))
+			__atomic_add_fetch(&invariants[i].checked, 1,
+					   __ATOMIC_RELAXED);
+	if (io->iocb.aio_lio_opcode == IO_CMD_PWRITE)
+		guard_exit(&io->file->resize);
+	io->in_flight = 0;
+	t->free_ios[t->nr_free++] = io;
+}
+
+/* reaps at least min_nr completions */
+static void reap(struct fuzz_thread *t, int min_nr)
+{
+	struct io_event events[MAX_DEPTH];
+	int i, ret;
+
+	do {
+		ret = io_getevents(t->ctx, min_nr, MAX_DEPTH, events, NULL);
+	} while (ret == -EINTR);
+	if (ret < 0)
+		fail("io_getevents returned %d\n", ret);
+	for (i = 0; i < ret; i++)
+		complete_io(t, &events[i]);
+}
+
+static off_t aligned_offset(struct fuzz_thread *t)
+{
+	return rnd_below(t, max_size / align) * align;
+}
+
+static size_t aligned_len(struct fuzz_thread *t)
+{
+	return (rnd_below(t, MAX_IO / align) + 1) * align;
+}
+
+static void submit_dio(struct fuzz_thread *t, struct fuzz_file *f, int write)
+{
+	struct fuzz_io *io;
+	struct iocb *iocb;
+	off_t off = aligned_offset(t);
+	size_t len = aligned_len(t);
+	int ret;
+
+	if (!t->nr_free)
+		reap(t, 1);
+	io = t->free_ios[--t->nr_free];
+	io->file = f;
+
+	/* reads hug EOF half the time, that is where eof-read bites */
+	if (!write && rnd_below(t, 2)) {
+		off_t size = file_size(f);
+
+		off = size / align * align;
+		if (off && rnd_below(t, 2))
+			off -= align;
+	}
+	if (off + (off_t)len > max_size)
+		len = max_size - off;
+
+	if (write) {
+		guard_enter(&f->resize);
+		io_prep_pwrite(&io->iocb, f->dio_fd, t->buf, len, off);
+		io->shrink_ok = guard_snapshot(&f->shrink, &io->shrink_seq);
+		io->resize_ok = 0;
+	} else {
+		io_prep_pread(&io->iocb, f->dio_fd, t->buf + MAX_IO, len, off);
+		io->resize_ok = guard_snapshot(&f->resize, &io->resize_seq);
+		io->size = file_size(f);
+		io->shrink_ok = 0;
+	}
+	io->in_flight = 1;
+	iocb = &io->iocb;
+	do {
+		ret = io_submit(t->ctx, 1, &iocb);
+	} while (ret == -EINTR || ret == -EAGAIN);
+	if (ret != 1)
+		fail("io_submit returned %d instead of 1\n", ret);
+}
+
+static void buffered_read(struct fuzz_thread *t, struct fuzz_file *f)
+{
+	size_t len = rnd_below(t, MAX_IO) + 1;
+	off_t off = rnd_below(t, max_size);
+	ssize_t ret;
+
+	ret = pread(f->fd, t->buf + MAX_IO, len, off);
+	if (ret < 0 || ret > (ssize_t)len)
+		fail("buffered read of %zu bytes @%lld returned %zd (%d)\n",
+		     len, (long long)off, ret, errno);
+}
+
+/* sizes are deliberately not block aligned, for eof-read */
+static void truncate_file(struct fuzz_thread *t, struct fuzz_file *f)
+{
+	off_t size = rnd_below(t, max_size + 1);
+
+	guard_enter(&f->shrink);
+	guard_enter(&f->resize);
+	if (ftruncate(f->fd, size))
+		fail("ftruncate to %lld failed: %d\n", (long long)size, errno);
+	guard_exit(&f->resize);
+	guard_exit(&f->shrink);
+}
+
+static void fallocate_file(struct fuzz_thread *t, struct fuzz_file *f)
+{
+	static const int modes[] = {
+		0,
+		FALLOC_FL_KEEP_SIZE,
+		FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	};
+	int mode = modes[rnd_below(t, 3)];
+	off_t off = aligned_offset(t);
+	off_t len = aligned_len(t);
+
+	if (off + len > max_size)
+		len = max_size - off;
+	if (!mode)
+		guard_enter(&f->resize);
+	if (fallocate(f->fd, mode, off, len)) {
+		if (errno == EOPNOTSUPP)
+			no_fallocate = 1;
+		else if (errno != ENOSPC)
+			fail("fallocate mode %d %lld@%lld failed: %d\n", mode,
+			     (long long)len, (long long)off, errno);
+	}
+	if (!mode)
+		guard_exit(&f->resize);
+}
+
+/* a truncate racing us turns the fault into SIGBUS, which is fine */
+static void mmap_fault(struct fuzz_thread *t, struct fuzz_file *f)
+{
+	off_t size = file_size(f);
+	volatile char *p;
+
+	if (!size)
+		return;
+	p = f->map + rnd_below(t, size);
+	if (sigsetjmp(fault_jmp, 1)) {
+		t->sigbus++;
+		return;
+	}
+	fault_armed = 1;
+	if (rnd_below(t, 2))
+		*p = *p + 1;
+	else
+		(void)*p;
+	fault_armed = 0;
+}
+
+static void sigbus_handler(int sig)
+{
+	if (!fault_armed) {
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+	fault_armed = 0;
+	siglongjmp(fault_jmp, 1);
+}
+
+static int pick_op(struct fuzz_thread *t)
+{
+	unsigned int total = 0, r, op;
+
+	for (op = 0; op < NR_OPS; op++)
+		total += op_weights[op];
+	r = rnd_below(t, total);
+	for (op = 0; r >= op_weights[op]; op++)
+		r -= op_weights[op];
+	return op;
+}
+
+static void *fuzz_thread(void *arg)
+{
+	struct fuzz_thread *t = arg;
+	struct fuzz_file *f;
+	int i, op;
+
+	for (i = 0; i < depth; i++)
+		t->free_ios[t->nr_free++] = &t->ios[i];
+
+	while (!stop) {
+		t->rng = splitmix64(&t->seq);
+		f = &files[rnd_below(t, nr_files)];
+		op = pick_op(t);
+		switch (op) {
+		case OP_DIO_WRITE:
+			submit_dio(t, f, 1);
+			break;
+		case OP_DIO_READ:
+			submit_dio(t, f, 0);
+			break;
+		case OP_BUFFERED_READ:
+			buffered_read(t, f);
+			break;
+		case OP_TRUNCATE:
+			truncate_file(t, f);
+			break;
+		case OP_FALLOCATE:
+			if (no_fallocate)
+				continue;
+			fallocate_file(t, f);
+			break;
+		case OP_FSTAT:
+			file_size(f);
+			break;
+		case OP_MMAP_FAULT:
+			mmap_fault(t, f);
+			break;
+		}
+		t->ops[op]++;
+		/* pick up whatever has finished without waiting */
+		if (t->nr_free < depth)
+			reap(t, 0);
+	}
+	while (t->nr_free < depth)
+		reap(t, 1);
+	return NULL;
+}
+
+static void usage(void)
+{
+	unsigned int i;
+
+	fprintf(stderr, "usage: aio-dio-race-fuzz [-s seed] [-t seconds] "
+		"[-n threads] [-f files] [-d depth] [-m megabytes] "
+		"[-i invariant,...] filename\n");
+	fprintf(stderr, "invariants:");
+	for (i = 0; i < NR_INVARIANTS; i++)
+		fprintf(stderr, " %s", invariants[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+/* enables only the named invariants */
+static void select_invariants(char *list)
+{
+	char *name, *save;
+	unsigned int i;
+
+	for (i = 0; i < NR_INVARIANTS; i++)
+		invariants[i].enabled = 0;
+	for (name = strtok_r(list, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < NR_INVARIANTS; i++)
+			if (!strcmp(name, invariants[i].name))
+				break;
+		if (i == NR_INVARIANTS)
+			usage();
+		invariants[i].enabled = 1;
+	}
+}
+
+static void open_file(struct fuzz_file *f, int index)
+{
+	char name[4096];
+
+	snprintf(name, sizeof(name), "%s.%d", path, index);
+	f->fd = open(name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+	if (f->fd < 0)
+		fail("failed to open test file %s, errno: %d\n", name, errno);
+	f->dio_fd = open(name, O_RDWR | O_DIRECT);
+	if (f->dio_fd < 0)
+		fail("failed to open %s with O_DIRECT, errno: %d\n", name,
+		     errno);
+	f->map = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      f->fd, 0);
+	if (f->map == MAP_FAILED)
+		fail("mmap of %s failed, errno: %d\n", name, errno);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long total[NR_OPS], ops = 0, sigbus = 0;
+	struct timespec start, end;
+	double elapsed;
+	unsigned int i;
+	int opt, ret, j;
+
+	seed = time(NULL) ^ getpid();
+	while ((opt = getopt(argc, argv, "s:t:n:f:d:m:i:")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'n':
+			nr_threads = atoi(optarg);
+			break;
+		case 'f':
+			nr_files = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'm':
+			max_size = (off_t)atoi(optarg) << 20;
+			break;
+		case 'i':
+			select_invariants(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || nr_threads < 1 || nr_threads > MAX_THREADS ||
+	    nr_files < 1 || nr_files > MAX_FILES || depth < 1 ||
+	    depth > MAX_DEPTH || max_size < MAX_IO)
+		usage();
+	path = argv[optind];
+
+	printf("seed %llu, %d threads, %d files, depth %d\n", seed,
+	       nr_threads, nr_files, depth);
+	fflush(stdout);
+
+	for (j = 0; j < nr_files; j++)
+		open_file(&files[j], j);
+	signal(SIGBUS, sigbus_handler);
+
+	for (j = 0; j < nr_threads; j++) {
+		struct fuzz_thread *t = &threads[j];
+
+		t->id = j;
+		t->seq = mix64(seed ^ j);
+		ret = io_setup(MAX_DEPTH, &t->ctx);
+		if (ret)
+			fail("io_setup returned %d\n", ret);
+		/* one buffer to write from, one to read into */
+		t->buf = memalign(align, 2 * MAX_IO);
+		if (!t->buf)
+			fail("failed to allocate io buffers\n");
+		memset(t->buf, 'A' + j % 26, 2 * MAX_IO);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (j = 0; j < nr_threads; j++) {
+		ret = pthread_create(&threads[j].tid, NULL, fuzz_thread,
+				     &threads[j]);
+		if (ret)
+			fail("pthread_create returned %d\n", ret);
+	}
+	sleep(seconds);
+	stop = 1;
+	for (j = 0; j < nr_threads; j++)
+		pthread_join(threads[j].tid, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) +
+		  (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	memset(total, 0, sizeof(total));
+	for (j = 0; j < nr_threads; j++) {
+		for (i = 0; i < NR_OPS; i++)
+			total[i] += threads[j].ops[i];
+		sigbus += threads[j].sigbus;
+		io_destroy(threads[j].ctx);
+	}
+	for (i = 0; i < NR_OPS; i++) {
+		printf("%-14s %llu\n", op_names[i], total[i]);
+		ops += total[i];
+	}
+	printf("%llu mmap faults hit a truncated page\n", sigbus);
+	for (i = 0; i < NR_INVARIANTS; i++)
+		if (invariants[i].enabled)
+			printf("invariant %s checked %llu ios\n",
+			       invariants[i].name, invariants[i].checked);
+	printf("%llu ops in %.1f seconds, %.0f ops/sec, seed %llu passed\n",
+	       ops, elapsed, ops / elapsed, seed);
+
+	for (j = 0; j < nr_files; j++) {
+		char name[4096];
+
+		munmap(files[j].map, max_size);
+		close(files[j].fd);
+		close(files[j].dio_fd);
+		snprintf(name, sizeof(name), "%s.%d", path, j);
+		unlink(name);
+	}
+	return 0;
+}
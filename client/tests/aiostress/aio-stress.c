@@ -35,32 +35,76 @@
  *
  * io buffers are aligned in case you want to do raw io
  *
- * compile with gcc -Wall -laio -lpthread -o aio-stress aio-stress.c
+ * compile with gcc -Wall -laio -lpthread -lm -o aio-stress aio-stress.c
+ *
+ * io can be sent through libaio (the default) or through io_uring with
+ * -E uring.  The io_uring engine talks to the kernel with raw syscalls, so
+ * it needs nothing beyond the kernel headers at build time.
  *
  * run aio-stress -h to see the options
  *
  * Please mail Chris Mason (mason@suse.com) with bug reports or patches
  */
 #define _FILE_OFFSET_BITS 64
-#define PROG_VERSION "0.21"
+#define _GNU_SOURCE
+#define PROG_VERSION "0.22"
 #define NEW_GETEVENTS
 
 #include <stdio.h>
 #include <errno.h>
+#include <math.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <libaio.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/prctl.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * IORING_FEAT_RW_CUR_POS arrived in the same release as IORING_OP_READ and
+ * IORING_OP_WRITE, which are the only non-fixed opcodes used here.
+ */
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+#endif
 
 #define IO_FREE 0
 #define IO_PENDING 1
@@ -75,12 +119,38 @@ enum {
     READ,
     RWRITE,
     RREAD,
+    RMIX,
     LAST_STAGE,
 };
 
+/* how random stages pick their offsets */
+#define DIST_UNIFORM 0
+#define DIST_ZIPF 1
+#define DIST_HOTSPOT 2
+#define DIST_PERMUTE 3
+
+/*
+ * while waiting for the next open loop issue time with ios in flight,
+ * completions are polled at least this often (ns)
+ */
+#define RATE_POLL_NS 10000
+
 #define USE_MALLOC 0
 #define USE_SHM 1
 #define USE_SHMFS 2
+#define USE_HUGETLB 3
+
+/* highest numa node id looked at, and the mbind policy used for arenas */
+#define MAX_NODES 64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define ENGINE_LIBAIO 0
+#define ENGINE_URING 1
+
+/* upper bound on io_uring submission queue entries per thread */
+#define URING_MAX_ENTRIES 4096
 
 /* 
  * various globals, these are effectively read only by the time the threads
@@ -110,10 +180,40 @@ int stonewall = 1;
 int verify = 0;
 char *verify_buf = NULL;
 int unlink_files = 0;
+int io_engine = ENGINE_LIBAIO;
+int uring_fixed_bufs = 0;
+int uring_fixed_files = 0;
+int uring_sqpoll = 0;
+int read_pct = 50;
+int offset_dist = DIST_UNIFORM;
+double zipf_theta = 0.99;
+double hot_pct = 10;
+double hot_io_pct = 90;
+double rate_iops = 0;
+unsigned long long rng_seed_value = 1;
+int precompute_offsets = 0;
+int pin_nodes = 0;
+char *pin_cpu_list = NULL;
+int report_interval_ms = 0;
+char *report_file = "aio-stress-intervals.json";
+int header_verify = 0;
+int header_block = 4096;
+int header_lost_writes = 1;
+
+/* numa nodes that have cpus, filled in by read_numa_topology */
+int num_nodes = 0;
+int node_ids[MAX_NODES];
+cpu_set_t node_cpus[MAX_NODES];
 
 struct io_unit;
 struct thread_info;
 
+/* the stage thread 0 is running, for the interval reporter */
+int current_stage_rw = -1;
+int reporter_stop = 0;
+pthread_mutex_t reporter_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reporter_cond;
+
 /* pthread mutexes and other globals for keeping the threads in sync */
 pthread_cond_t stage_cond = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t stage_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -123,17 +223,79 @@ struct timeval global_stage_start_time;
 struct thread_info *global_thread_info;
 
 /* 
- * latencies during io_submit are measured, these are the 
- * granularities for deviations 
+ * latencies during io_submit and until completion are measured in
+ * nanoseconds and kept in log-linear histograms.  Values below
+ * 2^LAT_SUB_BITS ns get a bucket each, above that every power of two is
+ * split into 2^LAT_SUB_BITS equal buckets, which bounds the error of any
+ * reported percentile to 1/2^LAT_SUB_BITS of the value.
  */
-#define DEVIATIONS 6
-int deviations[DEVIATIONS] = { 100, 250, 500, 1000, 5000, 10000 };
+#define LAT_SUB_BITS 6
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS 40		/* ~18 minutes, anything slower is clamped */
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+#define NUM_PERCENTILES 5
+double percentiles[NUM_PERCENTILES] = { 50, 90, 99, 99.9, 99.99 };
+
 struct io_latency {
-    double max;
-    double min;
-    double total_io;
-    double total_lat;
-    double deviations[DEVIATIONS]; 
+    unsigned long long max;
+    unsigned long long min;
+    unsigned long long total_io;
+    unsigned long long total_lat;
+    unsigned long long hist[LAT_BUCKETS];
+};
+
+/*
+ * running totals for the interval reporter.  Only the owning thread
+ * writes them, with plain relaxed stores, and the reporter thread reads
+ * them, so keeping them costs the io path no locked instructions
+ */
+struct live_stats {
+    unsigned long long ios;
+    unsigned long long bytes;
+    unsigned long long hist[LAT_BUCKETS];
+};
+
+/* every thread folds its stage latencies in here, see merge_latency */
+struct io_latency global_submit_latency;
+struct io_latency global_completion_latency;
+
+/*
+ * xoshiro256** (Blackman and Vigna).  Every thread has its own, so
+ * picking offsets takes no locks, and unlike rand() it has the range to
+ * address every block of a multi terabyte file.
+ */
+struct rng {
+    unsigned long long s[4];
+};
+
+/*
+ * with -V every header_block sized block written starts with this
+ * header.  crc is the crc32c of everything in the block after it, so it
+ * covers offset and generation as well as the payload
+ */
+#define BLOCK_MAGIC 0x61696f56	/* "aioV" */
+struct block_header {
+    unsigned int magic;
+    unsigned int crc;
+    unsigned long long offset;
+    unsigned long long generation;
+};
+
+/*
+ * what the writer knows about one block of a file.  floor is the oldest
+ * generation that may be on disk once no writes are in flight, zero
+ * until the block has been written in this run
+ */
+struct block_state {
+    unsigned long long floor;
+    unsigned int inflight;
+};
+
+/* one entry of a precomputed offset stream */
+struct planned_io {
+    off_t offset;
+    int is_read;
 };
 
 /* container for a series of operations to a file */
@@ -184,6 +346,36 @@ struct io_oper {
     struct timeval start_time;
 
     char *file_name;
+
+    /* completion latency of this file for the current stage */
+    struct io_latency completion_latency;
+
+    /* slot in the thread's registered file table (io_uring -f only) */
+    int file_index;
+
+    /* number of reclen sized blocks between start and end */
+    off_t num_blocks;
+
+    /* zipf constants for num_blocks, see zipf_block */
+    double zipf_zetan;
+    double zipf_eta;
+
+    /* position of this oper in the command line, seeds its streams */
+    int id;
+
+    /* number of random ios built so far in this stage */
+    int next_index;
+
+    /* per stage key for the -D permute block shuffle */
+    unsigned long long perm_key;
+
+    /* with -p, the offsets for the whole stage, total_ios long */
+    struct planned_io *plan;
+
+    /* with -V, write generations and a state per header_block */
+    unsigned long long generation;
+    struct block_state *blocks;
+    off_t num_hblocks;
 };
 
 /* a single io, and all the tracking needed for it */
@@ -208,11 +400,52 @@ struct io_unit {
 
     struct io_unit *next;
 
-    struct timeval io_start_time;		/* time of io_submit */
+    /*
+     * with -V on reads, the oldest generation each block may hold, zero
+     * for blocks that can't be checked
+     */
+    unsigned long long *expect;
+
+    /*
+     * time of io_submit, or in open loop mode the time the io was
+     * scheduled to go out
+     */
+    unsigned long long io_start_ns;
 };
 
+#ifdef HAVE_IO_URING
+/* the mmapped io_uring rings, one per thread */
+struct uring {
+    int fd;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+#endif
+
 struct thread_info {
     io_context_t io_ctx;
+#ifdef HAVE_IO_URING
+    struct uring ring;
+#endif
     pthread_t tid;
 
     /* allocated array of io_unit structs */
@@ -251,6 +484,26 @@ struct thread_info {
 
     /* latency completion stats i/o time from io_submit until io_getevents */
     struct io_latency io_completion_latency;
+
+    /* open loop schedule, the time the next io is due and the spacing */
+    unsigned long long next_issue_ns;
+    unsigned long long issue_interval_ns;
+
+    /* offsets and read/write mixes for the random stages */
+    struct rng rng;
+
+    /*
+     * with -N or -k the thread is pinned to cpus, its numa node is node
+     * (-1 when unknown) and its io buffers live in its own arena
+     */
+    int pinned;
+    cpu_set_t cpus;
+    int node;
+    char *arena;
+    size_t arena_size;
+
+    /* totals sampled by the -T interval reporter */
+    struct live_stats live;
 };
 
 /*
@@ -282,29 +535,112 @@ static double time_since_now(struct timeval *start_tv)
     return time_since(start_tv, &stop_time);
 }
 
+/*
+ * monotonic clock in nanoseconds, used for all the latency stats
+ */
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* maps a latency in ns to its histogram bucket */
+static int lat_bucket(unsigned long long ns)
+{
+    int msb;
+
+    if (ns < LAT_SUB_BUCKETS)
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    if (msb >= LAT_MAX_BITS)
+        return LAT_BUCKETS - 1;
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS +
+           (ns >> (msb - LAT_SUB_BITS)) - LAT_SUB_BUCKETS;
+}
+
+/* the middle of the range of ns values that land in a bucket */
+static unsigned long long lat_bucket_value(int bucket)
+{
+    int shift;
+    unsigned long long low;
+
+    if (bucket < LAT_SUB_BUCKETS)
+        return bucket;
+    shift = bucket / LAT_SUB_BUCKETS - 1;
+    low = (unsigned long long)(bucket % LAT_SUB_BUCKETS + LAT_SUB_BUCKETS)
+          << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
 /*
  * Add latency info to latency struct 
  */
-static void calc_latency(struct timeval *start_tv, struct timeval *stop_tv,
-			struct io_latency *lat)
+static void calc_latency(unsigned long long start_ns,
+			 unsigned long long stop_ns, struct io_latency *lat)
 {
-    double delta;
-    int i;
-    delta = time_since(start_tv, stop_tv);
-    delta = delta * 1000;
+    unsigned long long delta = 0;
 
+    if (stop_ns > start_ns)
+        delta = stop_ns - start_ns;
     if (delta > lat->max)
     	lat->max = delta;
-    if (!lat->min || delta < lat->min)
+    if (!lat->total_io || delta < lat->min)
     	lat->min = delta;
     lat->total_io++;
     lat->total_lat += delta;
-    for (i = 0 ; i < DEVIATIONS ; i++) {
-        if (delta < deviations[i]) {
-	    lat->deviations[i]++;
+    lat->hist[lat_bucket(delta)]++;
+}
+
+/*
+ * folds one thread's stats into a shared struct.  Every thread does this
+ * at the end of a stage without taking stage_mutex, so all the updates
+ * are atomic
+ */
+static void merge_latency(struct io_latency *dst, struct io_latency *src)
+{
+    unsigned long long cur;
+    int i;
+
+    if (!src->total_io)
+        return;
+    cur = __atomic_load_n(&dst->max, __ATOMIC_RELAXED);
+    while (src->max > cur &&
+           !__atomic_compare_exchange_n(&dst->max, &cur, src->max, 0,
+	                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    /* a zero min means nothing has been merged into dst yet */
+    cur = __atomic_load_n(&dst->min, __ATOMIC_RELAXED);
+    while ((cur == 0 || src->min < cur) &&
+           !__atomic_compare_exchange_n(&dst->min, &cur, src->min, 0,
+	                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    __atomic_fetch_add(&dst->total_lat, src->total_lat, __ATOMIC_RELAXED);
+    for (i = 0 ; i < LAT_BUCKETS ; i++) {
+        if (src->hist[i])
+	    __atomic_fetch_add(&dst->hist[i], src->hist[i], __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&dst->total_io, src->total_io, __ATOMIC_RELEASE);
+}
+
+/* latency in ns below which pct percent of the samples fall */
+static unsigned long long lat_percentile(struct io_latency *lat, double pct)
+{
+    unsigned long long target;
+    unsigned long long seen = 0;
+    int i;
+
+    target = (unsigned long long)(lat->total_io * pct / 100.0 + 0.5);
+    if (target == 0)
+        target = 1;
+    for (i = 0 ; i < LAT_BUCKETS ; i++) {
+        seen += lat->hist[i];
+	if (seen >= target)
 	    break;
-	}
     }
+    if (i == LAT_BUCKETS)
+        return lat->max;
+    return lat_bucket_value(i);
 }
 
 static void oper_list_add(struct io_oper *oper, struct io_oper **list)
@@ -333,6 +669,226 @@ static void oper_list_del(struct io_oper *oper, struct io_oper **list)
         *list = oper->next;
 }
 
+/*
+ * crc32c (castagnoli), in hardware where the cpu has it.  The software
+ * fallback is slicing by 8
+ */
+static unsigned int crc32c_table[8][256];
+
+static void crc32c_init_sw(void)
+{
+    unsigned int crc;
+    int i;
+    int j;
+
+    for (i = 0 ; i < 256 ; i++) {
+	crc = i;
+	for (j = 0 ; j < 8 ; j++)
+	    crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+	crc32c_table[0][i] = crc;
+    }
+    for (i = 0 ; i < 256 ; i++) {
+	crc = crc32c_table[0][i];
+	for (j = 1 ; j < 8 ; j++) {
+	    crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+	    crc32c_table[j][i] = crc;
+	}
+    }
+}
+
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *p,
+			      size_t len)
+{
+    unsigned long long word;
+
+    crc = ~crc;
+    while (len >= 8) {
+	memcpy(&word, p, 8);
+	word ^= crc;
+	crc = crc32c_table[7][word & 0xff] ^
+	      crc32c_table[6][(word >> 8) & 0xff] ^
+	      crc32c_table[5][(word >> 16) & 0xff] ^
+	      crc32c_table[4][(word >> 24) & 0xff] ^
+	      crc32c_table[3][(word >> 32) & 0xff] ^
+	      crc32c_table[2][(word >> 40) & 0xff] ^
+	      crc32c_table[1][(word >> 48) & 0xff] ^
+	      crc32c_table[0][word >> 56];
+	p += 8;
+	len -= 8;
+    }
+    while (len--)
+	crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p,
+			      size_t len)
+{
+    unsigned long long c = ~crc;
+    unsigned long long word;
+
+    while (len >= 8) {
+	memcpy(&word, p, 8);
+	c = _mm_crc32_u64(c, word);
+	p += 8;
+	len -= 8;
+    }
+    while (len--)
+	c = _mm_crc32_u8(c, *p++);
+    return ~c;
+}
+#define HAVE_CRC32C_HW 1
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p,
+			      size_t len)
+{
+    unsigned long long word;
+
+    crc = ~crc;
+    while (len >= 8) {
+	memcpy(&word, p, 8);
+	crc = __crc32cd(crc, word);
+	p += 8;
+	len -= 8;
+    }
+    while (len--)
+	crc = __crc32cb(crc, *p++);
+    return ~crc;
+}
+#define HAVE_CRC32C_HW 1
+#endif
+
+unsigned int (*crc32c)(unsigned int, const unsigned char *, size_t) =
+	crc32c_sw;
+
+/* picks the crc32c implementation, returns its name for the banner */
+static char *crc32c_setup(void)
+{
+    crc32c_init_sw();
+#if defined(HAVE_CRC32C_HW) && defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+	crc32c = crc32c_hw;
+	return "sse4.2";
+    }
+#elif defined(HAVE_CRC32C_HW) && defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+	crc32c = crc32c_hw;
+	return "armv8 crc";
+    }
+#endif
+    return "software";
+}
+
+/*
+ * stamps every block of a write with its header.  The payload is a
+ * pattern derived from offset and generation, so a block that kept an
+ * old payload under a new header still fails the crc
+ */
+static void header_fill(struct io_oper *oper, struct io_unit *io,
+			off_t offset)
+{
+    unsigned long long gen = ++oper->generation;
+    struct block_header *hdr;
+    unsigned long long pattern;
+    unsigned long long *word;
+    char *block;
+    int nwords = (header_block - sizeof(*hdr)) / 8;
+    int b;
+    int i;
+
+    for (b = 0 ; b < oper->reclen / header_block ; b++) {
+	block = io->buf + b * header_block;
+	hdr = (struct block_header *)block;
+	hdr->magic = BLOCK_MAGIC;
+	hdr->offset = offset + b * header_block;
+	hdr->generation = gen;
+	pattern = (hdr->offset * 0x9e3779b97f4a7c15ULL) ^ gen;
+	word = (unsigned long long *)(hdr + 1);
+	for (i = 0 ; i < nwords ; i++)
+	    word[i] = pattern + i;
+	hdr->crc = crc32c(0, (unsigned char *)&hdr->offset,
+	                  header_block - offsetof(struct block_header, offset));
+    }
+}
+
+/*
+ * called as an io is built.  Writes get their headers and are recorded in
+ * the block states, reads remember what generation each block must at
+ * least have
+ */
+static void header_io_start(struct io_oper *oper, struct io_unit *io)
+{
+    off_t offset = io->iocb.u.c.offset;
+    off_t first = (offset - oper->start) / header_block;
+    int nblocks = oper->reclen / header_block;
+    struct block_state *state;
+    int b;
+
+    if (io->iocb.aio_lio_opcode == IO_CMD_PWRITE) {
+	header_fill(oper, io, offset);
+	for (b = 0 ; b < nblocks && first + b < oper->num_hblocks ; b++) {
+	    state = oper->blocks + first + b;
+	    /*
+	     * with an older write still in flight either one may end up on
+	     * disk, so the floor stays at the older generation
+	     */
+	    if (!state->inflight)
+		state->floor = oper->generation;
+	    state->inflight++;
+	}
+	return;
+    }
+    for (b = 0 ; b < nblocks ; b++) {
+	io->expect[b] = 0;
+	if (first + b >= oper->num_hblocks)
+	    continue;
+	state = oper->blocks + first + b;
+	/* blocks with writes in flight can legally hold either version */
+	if (!state->inflight)
+	    io->expect[b] = state->floor;
+    }
+}
+
+/* validates the headers of a completed read, returns the number of bad blocks */
+static int header_check(struct io_unit *io)
+{
+    struct io_oper *oper = io->io_oper;
+    off_t offset = io->iocb.u.c.offset;
+    struct block_header *hdr;
+    char *block;
+    char *why;
+    int bad = 0;
+    int b;
+
+    for (b = 0 ; (b + 1) * header_block <= io->res ; b++) {
+	if (!io->expect[b])
+	    continue;
+	block = io->buf + b * header_block;
+	hdr = (struct block_header *)block;
+	why = NULL;
+	if (hdr->magic != BLOCK_MAGIC)
+	    why = "no header, lost write";
+	else if (hdr->offset != offset + b * header_block)
+	    why = "misplaced write";
+	else if (hdr->crc != crc32c(0, (unsigned char *)&hdr->offset,
+	                    header_block - offsetof(struct block_header, offset)))
+	    why = "bad crc, torn or corrupt block";
+	else if (header_lost_writes && hdr->generation < io->expect[b])
+	    why = "stale generation, lost write";
+	if (why) {
+	    fprintf(stderr, "verify error, file %s offset %Lu: %s "
+	            "(header offset %Lu generation %Lu, expected >= %Lu)\n",
+		    oper->file_name, (unsigned long long)offset + b * header_block,
+		    why, hdr->offset, hdr->generation, io->expect[b]);
+	    bad++;
+	}
+    }
+    return bad;
+}
+
 /* worker func to check error fields in the io unit */
 static int check_finished_io(struct io_unit *io) {
     int i;
@@ -345,7 +901,7 @@ static int check_finished_io(struct io_unit *io) {
   		  * If file size is large enough for the read, then this short
   		  * read is an error.
   		  */
-  		 if ((io->io_oper->rw == READ || io->io_oper->rw == RREAD) &&
+  		 if (io->iocb.aio_lio_opcode == IO_CMD_PREAD &&
   		     s.st_size > (io->iocb.u.c.offset + io->res)) {
   
   		 		 fprintf(stderr, "io err %lu (%s) op %d, off %Lu size %d\n",
@@ -356,6 +912,24 @@ static int check_finished_io(struct io_unit *io) {
   		 		 return -1;
   		 }
     }
+    if (header_verify) {
+	off_t first = (io->iocb.u.c.offset - io->io_oper->start) / header_block;
+	struct io_oper *oper = io->io_oper;
+
+	if (io->iocb.aio_lio_opcode == IO_CMD_PWRITE) {
+	    for (i = 0 ; i < oper->reclen / header_block &&
+	                 first + i < oper->num_hblocks ; i++) {
+		oper->blocks[first + i].inflight--;
+		/* a failed write leaves the block in an unknown state */
+		if (io->res != io->buf_size)
+		    oper->blocks[first + i].floor = 0;
+	    }
+	} else if (io->res > 0 && header_check(io)) {
+	    oper->last_err = -EIO;
+	    oper->num_err++;
+	    return -1;
+	}
+    }
     if (verify && io->io_oper->rw == READ) {
         if (memcmp(io->buf, verify_buf, io->io_oper->reclen)) {
 	    fprintf(stderr, "verify error, file %s offset %Lu contents (offset:bad:good):\n", 
@@ -394,6 +968,8 @@ char *stage_name(int rw) {
         return "random write";
     case RREAD:
         return "random read";
+    case RMIX:
+        return "random mixed";
     }
     return "unknown";
 }
@@ -403,6 +979,34 @@ static inline double oper_mb_trans(struct io_oper *oper) {
                 (double)(1024 * 1024);
 }
 
+/*
+ * min/avg/max are printed in ms, the percentiles in usec since that is
+ * where the interesting tail of a fast device lives.  The report is built
+ * up first and written in one go so other threads can't split it.
+ */
+static void print_lat(char *str, struct io_latency *lat) {
+    char buf[512];
+    double avg;
+    int len;
+    int i;
+
+    if (!lat->total_io)
+        return;
+    avg = (double)lat->total_lat / lat->total_io;
+    len = snprintf(buf, sizeof(buf), "%s min %.2f avg %.2f max %.2f\n\t",
+                   str, lat->min / 1e6, avg / 1e6, lat->max / 1e6);
+
+    for (i = 0 ; i < NUM_PERCENTILES && len < sizeof(buf) ; i++) {
+	len += snprintf(buf + len, sizeof(buf) - len, " p%g %.1f",
+	                percentiles[i],
+	                lat_percentile(lat, percentiles[i]) / 1e3);
+    }
+    if (len < sizeof(buf))
+	snprintf(buf + len, sizeof(buf) - len, " usec\n");
+    fputs(buf, stderr);
+    memset(lat, 0, sizeof(*lat));
+}
+
 static void print_time(struct io_oper *oper) {
     double runtime;
     double tput;
@@ -413,23 +1017,12 @@ static void print_time(struct io_oper *oper) {
     tput = mb / runtime;
     fprintf(stderr, "%s on %s (%.2f MB/s) %.2f MB in %.2fs\n", 
 	    stage_name(oper->rw), oper->file_name, tput, mb, runtime);
-}
-
-static void print_lat(char *str, struct io_latency *lat) {
-    double avg = lat->total_lat / lat->total_io;
-    int i;
-    double total_counted = 0;
-    fprintf(stderr, "%s min %.2f avg %.2f max %.2f\n\t", 
-            str, lat->min, avg, lat->max);
-
-    for (i = 0 ; i < DEVIATIONS ; i++) {
-	fprintf(stderr, " %.0f < %d", lat->deviations[i], deviations[i]);
-	total_counted += lat->deviations[i];
+    if (completion_latency_stats) {
+	char str[256];
+	snprintf(str, sizeof(str), "%s on %s completion latency",
+	         stage_name(oper->rw), oper->file_name);
+	print_lat(str, &oper->completion_latency);
     }
-    if (total_counted && lat->total_io - total_counted)
-        fprintf(stderr, " < %.0f", lat->total_io - total_counted);
-    fprintf(stderr, "\n");
-    memset(lat, 0, sizeof(*lat));
 }
 
 static void print_latency(struct thread_info *t)
@@ -444,15 +1037,32 @@ static void print_completion_latency(struct thread_info *t)
     print_lat("completion latency", lat);
 }
 
+/* adds one completed io to the totals the interval reporter samples */
+static void live_record(struct thread_info *t, unsigned long long start_ns,
+			unsigned long long now, long bytes)
+{
+    struct live_stats *live = &t->live;
+    int bucket = lat_bucket(now > start_ns ? now - start_ns : 0);
+
+    __atomic_store_n(&live->hist[bucket], live->hist[bucket] + 1,
+                     __ATOMIC_RELAXED);
+    if (bytes > 0)
+	__atomic_store_n(&live->bytes, live->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&live->ios, live->ios + 1, __ATOMIC_RELAXED);
+}
+
 /*
  * updates the fields in the io operation struct that belongs to this
  * io unit, and make the io unit reusable again
  */
 void finish_io(struct thread_info *t, struct io_unit *io, long result,
-		struct timeval *tv_now) {
+		unsigned long long now) {
     struct io_oper *oper = io->io_oper;
 
-    calc_latency(&io->io_start_time, tv_now, &t->io_completion_latency);
+    calc_latency(io->io_start_ns, now, &t->io_completion_latency);
+    calc_latency(io->io_start_ns, now, &oper->completion_latency);
+    if (report_interval_ms)
+	live_record(t, io->io_start_ns, now, result);
     io->res = result;
     io->busy = IO_FREE;
     io->next = t->free_ious;
@@ -467,34 +1077,368 @@ void finish_io(struct thread_info *t, struct io_unit *io, long result,
     } 
 }
 
-int read_some_events(struct thread_info *t) {
-    struct io_unit *event_io;
-    struct io_event *event;
-    int nr;
-    int i; 
-    int min_nr = io_iter;
-    struct timeval stop_time;
+#ifdef HAVE_IO_URING
+/*
+ * io_uring syscalls, these return -errno on failure the same way the libaio
+ * calls do
+ */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    int ret = syscall(__NR_io_uring_setup, entries, p);
+    return ret < 0 ? -errno : ret;
+}
 
-    if (t->num_global_pending < io_iter)
-        min_nr = t->num_global_pending;
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+    int ret = syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		      flags, NULL, 0);
+    return ret < 0 ? -errno : ret;
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg,
+				 unsigned nr_args)
+{
+    int ret = syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    return ret < 0 ? -errno : ret;
+}
+
+/*
+ * register every file this thread will touch.  The table index is kept
+ * in the oper so build time doesn't need to search for it
+ */
+static int uring_register_files(struct thread_info *t)
+{
+    struct io_oper *oper = t->active_opers;
+    int *fds;
+    int i = 0;
+    int ret;
+
+    if (!oper)
+        return 0;
+    fds = malloc(t->num_files * sizeof(*fds));
+    if (!fds) {
+        fprintf(stderr, "unable to allocate registered file table\n");
+	return -ENOMEM;
+    }
+    do {
+	oper->file_index = i;
+	fds[i++] = oper->fd;
+	oper = oper->next;
+    } while (oper != t->active_opers && i < t->num_files);
+
+    ret = sys_io_uring_register(t->ring.fd, IORING_REGISTER_FILES, fds, i);
+    free(fds);
+    return ret;
+}
+
+/*
+ * setup_ious carves the thread's io units out of one contiguous piece of
+ * the shared buffer, so a single registered iovec covers all of them and
+ * every fixed io uses buf_index 0
+ */
+static int uring_register_buffers(struct thread_info *t)
+{
+    struct iovec iov;
+
+    iov.iov_base = t->ios[0].buf;
+    iov.iov_len = (size_t)(t->num_global_ios - 1) * padded_reclen +
+                  t->ios[0].buf_size;
+    return sys_io_uring_register(t->ring.fd, IORING_REGISTER_BUFFERS,
+                                 &iov, 1);
+}
+
+void uring_setup(struct thread_info *t)
+{
+    struct uring *ring = &t->ring;
+    struct io_uring_params p;
+    unsigned entries = 1;
+    char *sq_ptr;
+    char *cq_ptr;
+    int ret;
+
+    /*
+     * size the rings so every io unit can be in flight at once.  The
+     * completion ring is twice the submission ring, so it can't overflow
+     */
+    while (entries < t->num_global_ios && entries < URING_MAX_ENTRIES)
+        entries <<= 1;
+
+    memset(&p, 0, sizeof(p));
+    if (uring_sqpoll) {
+	p.flags |= IORING_SETUP_SQPOLL;
+	p.sq_thread_idle = 1000;
+    }
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if (ring->fd < 0) {
+	fprintf(stderr, "io_uring_setup(%u) returned %d (%s)\n",
+		entries, ring->fd, strerror(-ring->fd));
+	exit(3);
+    }
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+	fprintf(stderr, "kernel io_uring lacks IORING_OP_READ/WRITE\n");
+	exit(3);
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes +
+                         p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+	    ring->sq_ring_size = ring->cq_ring_size;
+	ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+			 IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        perror("mmap sq ring");
+	exit(3);
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+	                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			     ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_ring == MAP_FAILED) {
+	    perror("mmap cq ring");
+	    exit(3);
+	}
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        perror("mmap sqes");
+	exit(3);
+    }
+
+    sq_ptr = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)(sq_ptr + p.sq_off.ring_entries);
+    ring->sq_flags = (unsigned *)(sq_ptr + p.sq_off.flags);
+    ring->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+
+    cq_ptr = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+    if (uring_fixed_files && (ret = uring_register_files(t)) < 0) {
+	fprintf(stderr, "IORING_REGISTER_FILES returned %d (%s)\n",
+		ret, strerror(-ret));
+	exit(3);
+    }
+    if (uring_fixed_bufs && (ret = uring_register_buffers(t)) < 0) {
+	fprintf(stderr, "IORING_REGISTER_BUFFERS returned %d (%s), "
+	        "check ulimit -l\n", ret, strerror(-ret));
+	exit(3);
+    }
+}
+
+/* closing the ring also drops any registered files and buffers */
+void uring_release(struct thread_info *t)
+{
+    struct uring *ring = &t->ring;
+
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/*
+ * copies already built iocbs into the submission ring and tells the kernel
+ * about them.  Same return convention as io_submit: the number of ios
+ * accepted, or -errno.
+ */
+static int uring_submit(struct thread_info *t, int nr, struct iocb **my_iocbs)
+{
+    struct uring *ring = &t->ring;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    unsigned space = *ring->sq_entries - (tail - head);
+    int ret;
+    int i;
+
+    if (nr > space)
+        nr = space;
+    if (nr == 0)
+        return -EAGAIN;
 
+    for (i = 0 ; i < nr ; i++) {
+	struct io_unit *io = (struct io_unit *)my_iocbs[i];
+	unsigned idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + idx;
+	int is_write = io->iocb.aio_lio_opcode == IO_CMD_PWRITE;
+
+	memset(sqe, 0, sizeof(*sqe));
+	if (uring_fixed_bufs)
+	    sqe->opcode = is_write ? IORING_OP_WRITE_FIXED :
+	                             IORING_OP_READ_FIXED;
+	else
+	    sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+	if (uring_fixed_files) {
+	    sqe->fd = io->io_oper->file_index;
+	    sqe->flags = IOSQE_FIXED_FILE;
+	} else {
+	    sqe->fd = io->iocb.aio_fildes;
+	}
+	sqe->addr = (unsigned long)io->iocb.u.c.buf;
+	sqe->len = io->iocb.u.c.nbytes;
+	sqe->off = io->iocb.u.c.offset;
+	sqe->user_data = (unsigned long)io;
+	ring->sq_array[idx] = idx;
+	tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    if (uring_sqpoll) {
+	/*
+	 * the kernel thread finds the new tail on its own, unless it has
+	 * gone idle and needs a kick
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) &
+	    IORING_SQ_NEED_WAKEUP)
+	    sys_io_uring_enter(ring->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+	return nr;
+    }
+
+    ret = sys_io_uring_enter(ring->fd, nr, 0, 0);
+    if (ret < nr) {
+	/*
+	 * without sqpoll only io_uring_enter reads the ring, so anything it
+	 * left behind can be pulled back out.  The caller resubmits those
+	 * ios after reaping some events.
+	 */
+	tail -= nr - (ret > 0 ? ret : 0);
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+/*
+ * reaps between min_nr and nr completions into events, draining everything
+ * already posted to the completion ring before going back into the kernel
+ */
+static int uring_getevents(struct thread_info *t, int min_nr, int nr,
+			   struct io_event *events)
+{
+    struct uring *ring = &t->ring;
+    unsigned head;
+    unsigned tail;
+    int found = 0;
+    int ret;
+
+    while(1) {
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && found < nr) {
+	    struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+	    events[found].obj = (struct iocb *)(unsigned long)cqe->user_data;
+	    events[found].res = cqe->res;
+	    found++;
+	    head++;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	if (found >= min_nr)
+	    return found;
+
+	ret = sys_io_uring_enter(ring->fd, 0, min_nr - found,
+	                         IORING_ENTER_GETEVENTS);
+	if (ret < 0 && ret != -EINTR)
+	    return found ? found : ret;
+    }
+}
+#endif
+
+/* hands built iocbs to whichever io engine was selected */
+static int engine_submit(struct thread_info *t, int nr,
+			 struct iocb **my_iocbs)
+{
+#ifdef HAVE_IO_URING
+    if (io_engine == ENGINE_URING)
+        return uring_submit(t, nr, my_iocbs);
+#endif
+    return io_submit(t->io_ctx, nr, my_iocbs);
+}
+
+/* waits for at least min_nr completions from the selected io engine */
+static int engine_getevents(struct thread_info *t, int min_nr, int nr,
+			    struct io_event *events)
+{
+#ifdef HAVE_IO_URING
+    if (io_engine == ENGINE_URING)
+        return uring_getevents(t, min_nr, nr, events);
+#endif
 #ifdef NEW_GETEVENTS
-    nr = io_getevents(t->io_ctx, min_nr, t->num_global_events, t->events,NULL);
+    return io_getevents(t->io_ctx, min_nr, nr, events, NULL);
 #else
-    nr = io_getevents(t->io_ctx, t->num_global_events, t->events, NULL);
+    return io_getevents(t->io_ctx, nr, events, NULL);
 #endif
+}
+
+/* waits for at least min_nr events and finishes everything it got */
+static int reap_events(struct thread_info *t, int min_nr) {
+    struct io_unit *event_io;
+    struct io_event *event;
+    int nr;
+    int i; 
+    unsigned long long stop_time;
+
+    nr = engine_getevents(t, min_nr, t->num_global_events, t->events);
     if (nr <= 0)
         return nr;
 
-    gettimeofday(&stop_time, NULL);
+    stop_time = now_ns();
     for (i = 0 ; i < nr ; i++) {
 	event = t->events + i;
 	event_io = (struct io_unit *)((unsigned long)event->obj); 
-	finish_io(t, event_io, event->res, &stop_time);
+	finish_io(t, event_io, event->res, stop_time);
     }
     return nr;
 }
 
+int read_some_events(struct thread_info *t) {
+    int min_nr = io_iter;
+
+    if (t->num_global_pending < io_iter)
+        min_nr = t->num_global_pending;
+    return reap_events(t, min_nr);
+}
+
+/*
+ * open loop pacing.  Sleeps until the next io is due, reaping completions
+ * along the way so their latencies aren't inflated by the wait, and
+ * returns how many ios are due by now.  Falling behind the schedule
+ * doesn't move it, the late ios just carry their intended issue time.
+ */
+static int rate_wait(struct thread_info *t)
+{
+    unsigned long long now = now_ns();
+    unsigned long long wait;
+    struct timespec ts;
+
+    while (now < t->next_issue_ns) {
+	if (!t->num_global_pending || reap_events(t, 0) <= 0) {
+	    wait = t->next_issue_ns - now;
+	    if (t->num_global_pending && wait > RATE_POLL_NS)
+		wait = RATE_POLL_NS;
+	    ts.tv_sec = wait / 1000000000ULL;
+	    ts.tv_nsec = wait % 1000000000ULL;
+	    nanosleep(&ts, NULL);
+	}
+	now = now_ns();
+    }
+    return (now - t->next_issue_ns) / t->issue_interval_ns + 1;
+}
+
 /* 
  * finds a free io unit, waiting for pending requests if required.  returns
  * null if none could be found
@@ -539,57 +1483,252 @@ static int io_oper_wait(struct thread_info *t, struct io_oper *oper) {
     /* this func is not speed sensitive, no need to go wild reading
      * more than one event at a time
      */
-#ifdef NEW_GETEVENTS
-    while(io_getevents(t->io_ctx, 1, 1, &event, NULL) > 0) {
+    while(engine_getevents(t, 1, 1, &event) > 0) {
+        event_io = (struct io_unit *)((unsigned long)event.obj); 
+
+	finish_io(t, event_io, event.res, now_ns());
+
+	if (oper->num_pending == 0)
+	    break;
+    }
+done:
+    if (oper->num_err) {
+        fprintf(stderr, "%u errors on oper, last %u\n", 
+	        oper->num_err, oper->last_err);
+    }
+    return 0;
+}
+
+static unsigned long long mix64(unsigned long long x)
+{
+    /* splitmix64 finalizer */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void rng_seed(struct rng *rng, unsigned long long seed)
+{
+    int i;
+
+    /* splitmix64, so nearby seeds still give unrelated states */
+    for (i = 0 ; i < 4 ; i++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+	rng->s[i] = mix64(seed);
+    }
+}
+
+static inline unsigned long long rotl(unsigned long long x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline unsigned long long rng_next(struct rng *rng)
+{
+    unsigned long long *s = rng->s;
+    unsigned long long result = rotl(s[1] * 5, 7) * 9;
+    unsigned long long t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/* uniform double in [0, 1) */
+static inline double rng_unit(struct rng *rng)
+{
+    return (rng_next(rng) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * uniform integer in [0, n), Lemire's multiply and shift where the
+ * compiler has 128 bit integers.  32 bit targets reject the few values
+ * below 2^64 mod n that would bias a plain modulo.
+ */
+static inline unsigned long long rng_below(struct rng *rng,
+					   unsigned long long n)
+{
+#ifdef __SIZEOF_INT128__
+    return ((unsigned __int128)rng_next(rng) * n) >> 64;
 #else
-    while(io_getevents(t->io_ctx, 1, &event, NULL) > 0) {
+    unsigned long long threshold = -n % n;
+    unsigned long long r;
+
+    do {
+	r = rng_next(rng);
+    } while (r < threshold);
+    return r % n;
 #endif
-	struct timeval tv_now;
-        event_io = (struct io_unit *)((unsigned long)event.obj); 
+}
+
+/*
+ * keyed bijection on [0, n): a four round feistel network over the
+ * smallest even number of bits that holds n, cycle walking any value that
+ * lands past the end.  More than a quarter of the domain is below n, so
+ * the walk is short.
+ */
+static off_t permute_block(off_t index, off_t n, unsigned long long key)
+{
+    unsigned long long x = index;
+    unsigned long long left;
+    unsigned long long right;
+    unsigned long long tmp;
+    unsigned long long mask;
+    int half;
+    int round;
+
+    if (n <= 1)
+        return 0;
+    half = (64 - __builtin_clzll(n - 1) + 1) / 2;
+    mask = (1ULL << half) - 1;
+    do {
+	left = x >> half;
+	right = x & mask;
+	for (round = 0 ; round < 4 ; round++) {
+	    tmp = left ^ (mix64(right ^ key ^ (round + 1)) & mask);
+	    left = right;
+	    right = tmp;
+	}
+	x = (left << half) | right;
+    } while (x >= n);
+    return x;
+}
+
+static double zeta(off_t n, double theta)
+{
+    double sum = 0;
+    off_t i;
+
+    for (i = 1 ; i <= n ; i++)
+        sum += 1.0 / pow((double)i, theta);
+    return sum;
+}
+
+/* precomputes the per file constants zipf_block needs */
+static void zipf_init(struct io_oper *oper)
+{
+    double n = oper->num_blocks;
+
+    oper->zipf_zetan = zeta(oper->num_blocks, zipf_theta);
+    oper->zipf_eta = (1 - pow(2.0 / n, 1 - zipf_theta)) /
+                     (1 - zeta(2, zipf_theta) / oper->zipf_zetan);
+}
+
+/*
+ * zipf distributed block number, using the method from Gray et al,
+ * "Quickly Generating Billion-Record Synthetic Databases".  Rank 0 is the
+ * most popular; ranks are permuted over the file so the hot blocks are
+ * scattered the way a real working set would be rather than packed at
+ * the start, and every block keeps exactly one rank.
+ */
+static off_t zipf_block(struct io_oper *oper, struct rng *rng)
+{
+    double u = rng_unit(rng);
+    double uz = u * oper->zipf_zetan;
+    unsigned long long rank;
+
+    if (uz < 1)
+        rank = 0;
+    else if (uz < 1 + pow(0.5, zipf_theta))
+        rank = 1;
+    else
+        rank = oper->num_blocks *
+	       pow(oper->zipf_eta * u - oper->zipf_eta + 1,
+	           1 / (1 - zipf_theta));
+    if (rank >= oper->num_blocks)
+        rank = oper->num_blocks - 1;
+    return permute_block(rank, oper->num_blocks, oper->perm_key);
+}
 
-	gettimeofday(&tv_now, NULL);
-	finish_io(t, event_io, event.res, &tv_now);
+/*
+ * hot_io_pct percent of the ios go to the first hot_pct percent of the
+ * blocks, the rest are spread over the remainder
+ */
+static off_t hotspot_block(struct io_oper *oper, struct rng *rng)
+{
+    off_t hot_blocks = oper->num_blocks * hot_pct / 100;
+
+    if (hot_blocks < 1)
+        hot_blocks = 1;
+    if (hot_blocks >= oper->num_blocks ||
+        rng_unit(rng) * 100 < hot_io_pct)
+	return rng_below(rng, hot_blocks);
+    return hot_blocks + rng_below(rng, oper->num_blocks - hot_blocks);
+}
 
-	if (oper->num_pending == 0)
-	    break;
-    }
-done:
-    if (oper->num_err) {
-        fprintf(stderr, "%u errors on oper, last %u\n", 
-	        oper->num_err, oper->last_err);
+/*
+ * offset of the index'th random io of the stage.  The uniform case picks
+ * any buffer aligned offset that leaves room for a whole record, the
+ * other distributions work in whole records.
+ */
+off_t random_byte_offset(struct io_oper *oper, struct rng *rng, int index) {
+    off_t align = page_size_mask + 1;
+    off_t slots;
+
+    switch (offset_dist) {
+    case DIST_ZIPF:
+        return oper->start + zipf_block(oper, rng) * oper->reclen;
+    case DIST_HOTSPOT:
+        return oper->start + hotspot_block(oper, rng) * oper->reclen;
+    case DIST_PERMUTE:
+        return oper->start + permute_block(index, oper->num_blocks,
+	                                   oper->perm_key) * oper->reclen;
     }
-    return 0;
+
+    slots = 1;
+    if (oper->end - oper->start > oper->reclen)
+        slots = (oper->end - oper->start - oper->reclen) / align + 1;
+    return oper->start + rng_below(rng, slots) * align;
 }
 
-off_t random_byte_offset(struct io_oper *oper) {
-    off_t num;
-    off_t rand_byte = oper->start;
-    off_t range;
-    off_t offset = 1;
+/* picks direction and offset of a random io from rng */
+static off_t pick_random_io(struct io_oper *oper, struct rng *rng, int index,
+			    int *is_read)
+{
+    *is_read = oper->rw == RREAD ||
+               (oper->rw == RMIX && rng_unit(rng) * 100 < read_pct);
+    return random_byte_offset(oper, rng, index);
+}
 
-    range = (oper->end - oper->start) / (1024 * 1024);
-    if ((page_size_mask+1) > (1024 * 1024))
-        offset = (page_size_mask+1) / (1024 * 1024);
-    if (range < offset)
-        range = 0;
-    else
-        range -= offset;
+/*
+ * resets the random stream state of an oper at the start of each stage.
+ * With -p this also generates the whole stage up front from a generator
+ * seeded by the seed, the oper and the stage, so the stream doesn't
+ * depend on the thread count or on how the opers of a thread interleave.
+ */
+static void oper_stage_start(struct io_oper *oper)
+{
+    struct rng rng;
+    int i;
 
-    /* find a random mb offset */
-    num = 1 + (int)((double)range * rand() / (RAND_MAX + 1.0 ));
-    rand_byte += num * 1024 * 1024;
-    
-    /* find a random byte offset */
-    num = 1 + (int)((double)(1024 * 1024) * rand() / (RAND_MAX + 1.0));
+    oper->next_index = 0;
+    oper->perm_key = mix64(rng_seed_value ^
+                           ((unsigned long long)oper->id << 8 | oper->rw));
+    if (!oper->plan || oper->rw < RWRITE)
+        return;
 
-    /* page align */
-    num = (num + page_size_mask) & ~page_size_mask;
-    rand_byte += num;
+    rng_seed(&rng, oper->perm_key);
+    for (i = 0 ; i < oper->total_ios ; i++) {
+	oper->plan[i].offset = pick_random_io(oper, &rng, i,
+	                                      &oper->plan[i].is_read);
+    }
+}
+
+/* direction and offset of the next random io on oper */
+static off_t next_random_io(struct thread_info *t, struct io_oper *oper,
+			    int *is_read)
+{
+    int index = oper->next_index++;
 
-    if (rand_byte + oper->reclen > oper->end) {
-	rand_byte -= oper->reclen;
+    if (oper->plan) {
+	*is_read = oper->plan[index].is_read;
+	return oper->plan[index].offset;
     }
-    return rand_byte;
+    return pick_random_io(oper, &t->rng, index, is_read);
 }
 
 /* 
@@ -604,6 +1743,7 @@ static struct io_unit *build_iocb(struct thread_info *t, struct io_oper *oper)
 {
     struct io_unit *io;
     off_t rand_byte;
+    int is_read;
 
     io = find_iou(t, oper);
     if (!io) {
@@ -623,20 +1763,25 @@ static struct io_unit *build_iocb(struct thread_info *t, struct io_oper *oper)
 	oper->last_offset += oper->reclen;
 	break;
     case RREAD:
-	rand_byte = random_byte_offset(oper);
-	oper->last_offset = rand_byte;
-        io_prep_pread(&io->iocb,oper->fd, io->buf, oper->reclen, 
-	              rand_byte);
-        break;
     case RWRITE:
-	rand_byte = random_byte_offset(oper);
+    case RMIX:
+	rand_byte = next_random_io(t, oper, &is_read);
 	oper->last_offset = rand_byte;
-        io_prep_pwrite(&io->iocb,oper->fd, io->buf, oper->reclen, 
-	              rand_byte);
-        
-        break;
+	if (is_read)
+	    io_prep_pread(&io->iocb, oper->fd, io->buf, oper->reclen,
+	                  rand_byte);
+	else
+	    io_prep_pwrite(&io->iocb, oper->fd, io->buf, oper->reclen,
+	                   rand_byte);
+	break;
     }
 
+    if (header_verify)
+	header_io_start(oper, io);
+    if (rate_iops) {
+	io->io_start_ns = t->next_issue_ns;
+	t->next_issue_ns += t->issue_interval_ns;
+    }
     return io;
 }
 
@@ -655,6 +1800,8 @@ finish_oper(struct thread_info *t, struct io_oper *oper)
         fprintf(stderr, "oper num_pending is %d\n", oper->num_pending);
     }
     close(oper->fd);
+    free(oper->plan);
+    free(oper->blocks);
     free(oper);
     return last_err;
 }
@@ -685,6 +1832,28 @@ create_oper(int fd, int rw, off_t start, off_t end, int reclen, int depth,
     oper->rw = rw;
     oper->total_ios = (oper->end - oper->start) / oper->reclen;
     oper->file_name = file_name;
+    oper->num_blocks = oper->total_ios;
+    if (oper->num_blocks < 1)
+        oper->num_blocks = 1;
+    if (offset_dist == DIST_ZIPF)
+        zipf_init(oper);
+    if (header_verify) {
+	oper->num_hblocks = (end - start + header_block - 1) / header_block;
+	oper->blocks = calloc(oper->num_hblocks, sizeof(*oper->blocks));
+	if (!oper->blocks) {
+	    fprintf(stderr, "unable to allocate block states\n");
+	    free(oper);
+	    return NULL;
+	}
+    }
+    if (precompute_offsets && oper->total_ios) {
+	oper->plan = malloc(oper->total_ios * sizeof(*oper->plan));
+	if (!oper->plan) {
+	    fprintf(stderr, "unable to allocate offset stream\n");
+	    free(oper);
+	    return NULL;
+	}
+    }
 
     return oper;
 }
@@ -723,15 +1892,17 @@ int build_oper(struct thread_info *t, struct io_oper *oper, int num_ios,
  * counters in the associated oper struct
  */
 static void update_iou_counters(struct iocb **my_iocbs, int nr,
-	struct timeval *tv_now) 
+	unsigned long long now) 
 {
+    /* open loop ios were stamped with their intended time in build_iocb */
     struct io_unit *io;
     int i;
     for (i = 0 ; i < nr ; i++) {
 	io = (struct io_unit *)(my_iocbs[i]);
 	io->io_oper->num_pending++;
 	io->io_oper->started_ios++;
-	io->io_start_time = *tv_now;	/* set time of io_submit */
+	if (!rate_iops)
+	    io->io_start_ns = now;	/* set time of io_submit */
     }
 }
 
@@ -739,19 +1910,19 @@ static void update_iou_counters(struct iocb **my_iocbs, int nr,
 int run_built(struct thread_info *t, int num_ios, struct iocb **my_iocbs) 
 {
     int ret;
-    struct timeval start_time;
-    struct timeval stop_time;
+    unsigned long long start_time;
+    unsigned long long stop_time;
 
 resubmit:
-    gettimeofday(&start_time, NULL);
-    ret = io_submit(t->io_ctx, num_ios, my_iocbs);
-    gettimeofday(&stop_time, NULL);
-    calc_latency(&start_time, &stop_time, &t->io_submit_latency);
+    start_time = now_ns();
+    ret = engine_submit(t, num_ios, my_iocbs);
+    stop_time = now_ns();
+    calc_latency(start_time, stop_time, &t->io_submit_latency);
 
     if (ret != num_ios) {
 	/* some ios got through */
 	if (ret > 0) {
-	    update_iou_counters(my_iocbs, ret, &stop_time);
+	    update_iou_counters(my_iocbs, ret, stop_time);
 	    my_iocbs += ret;
 	    t->num_global_pending += ret;
 	    num_ios -= ret;
@@ -773,7 +1944,7 @@ resubmit:
 	fprintf(stderr, "ret %d (%s) on io_submit\n", ret, strerror(-ret));
 	return -1;
     }
-    update_iou_counters(my_iocbs, ret, &stop_time);
+    update_iou_counters(my_iocbs, ret, stop_time);
     t->num_global_pending += ret;
     return 0;
 }
@@ -798,6 +1969,9 @@ static int restart_oper(struct io_oper *oper) {
     case RWRITE:
 	if (!new_rw && stages & (1 << RREAD))
 	    new_rw = RREAD;
+    case RREAD:
+	if (!new_rw && stages & (1 << RMIX))
+	    new_rw = RMIX;
     }
 
     if (new_rw) {
@@ -861,6 +2035,15 @@ static int run_active_list(struct thread_info *t,
     struct iocb **my_iocbs = t->iocbs;
     int ret = 0;
     int num_built = 0;
+    int budget = max_io_submit;
+    int num_ios;
+
+    /* in open loop mode only the ios that are due get built */
+    if (rate_iops) {
+	budget = rate_wait(t);
+	if (budget > max_io_submit)
+	    budget = max_io_submit;
+    }
 
     oper = t->active_opers;
     while(oper) {
@@ -870,7 +2053,12 @@ static int run_active_list(struct thread_info *t,
 	        break;
 	    continue;
 	}
-	ret = build_oper(t, oper, io_iter, my_iocbs);
+	num_ios = io_iter;
+	if (num_ios > budget - num_built)
+	    num_ios = budget - num_built;
+	if (num_ios <= 0)
+	    break;
+	ret = build_oper(t, oper, num_ios, my_iocbs);
 	if (ret >= 0) {
 	    my_iocbs += ret;
 	    num_built += ret;
@@ -923,8 +2111,23 @@ void aio_setup(io_context_t *io_ctx, int n)
     }
 }
 
+/* points each io unit of a thread at its slice of base and fills it */
+static void assign_buffers(struct thread_info *t, char *base)
+{
+    int i;
+
+    for (i = 0 ; i < t->num_global_ios ; i++) {
+	t->ios[i].buf = base + (size_t)i * padded_reclen;
+	if (verify)
+	    memset(t->ios[i].buf, 'b', t->ios[i].buf_size);
+	else
+	    memset(t->ios[i].buf, 0, t->ios[i].buf_size);
+    }
+}
+
 /*
- * allocate io operation and event arrays for a given thread
+ * allocate io operation and event arrays for a given thread.  Pinned
+ * threads get their buffers later from setup_arena
  */
 int setup_ious(struct thread_info *t, 
               int num_files, int depth, 
@@ -939,17 +2142,24 @@ int setup_ious(struct thread_info *t,
     }
     memset(t->ios, 0, bytes);
 
+    t->num_global_ios = num_files * depth;
     for (i = 0 ; i < depth * num_files; i++) {
-	t->ios[i].buf = aligned_buffer;
-	aligned_buffer += padded_reclen;
 	t->ios[i].buf_size = reclen;
-	if (verify)
-	    memset(t->ios[i].buf, 'b', reclen);
-	else
-	    memset(t->ios[i].buf, 0, reclen);
+	if (header_verify) {
+	    t->ios[i].expect = calloc(reclen / header_block,
+	                              sizeof(*t->ios[i].expect));
+	    if (!t->ios[i].expect) {
+		fprintf(stderr, "unable to allocate header state\n");
+		return -1;
+	    }
+	}
 	t->ios[i].next = t->free_ious;
 	t->free_ious = t->ios + i;
     }
+    if (!t->pinned) {
+	assign_buffers(t, aligned_buffer);
+	aligned_buffer += (size_t)t->num_global_ios * padded_reclen;
+    }
     if (verify) {
         verify_buf = aligned_buffer;
         memset(verify_buf, 'b', reclen);
@@ -970,7 +2180,6 @@ int setup_ious(struct thread_info *t,
     }
     memset(t->events, 0, num_files * sizeof(struct io_event)*depth);
 
-    t->num_global_ios = num_files * depth;
     t->num_global_events = t->num_global_ios;
     return 0;
 
@@ -984,6 +2193,188 @@ free_buffers:
     return -1;
 }
 
+/* parses a cpu list like "0-3,8,10-11" */
+static int parse_cpulist(const char *str, cpu_set_t *set)
+{
+    char *end;
+    long first;
+    long last;
+
+    CPU_ZERO(set);
+    while (*str && *str != '\n') {
+	first = last = strtol(str, &end, 10);
+	if (end == str || first < 0)
+	    return -1;
+	if (*end == '-') {
+	    str = end + 1;
+	    last = strtol(str, &end, 10);
+	    if (end == str || last < first)
+		return -1;
+	}
+	for ( ; first <= last && first < CPU_SETSIZE ; first++)
+	    CPU_SET(first, set);
+	str = end;
+	if (*str == ',')
+	    str++;
+    }
+    return 0;
+}
+
+/*
+ * finds the numa nodes with cpus from sysfs.  Without sysfs numa info
+ * the whole machine is treated as node 0
+ */
+static void read_numa_topology(void)
+{
+    char path[64];
+    char buf[4096];
+    FILE *f;
+    int node;
+
+    for (node = 0 ; node < MAX_NODES ; node++) {
+	snprintf(path, sizeof(path),
+	         "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f)
+	    continue;
+	if (fgets(buf, sizeof(buf), f) &&
+	    !parse_cpulist(buf, &node_cpus[num_nodes]) &&
+	    CPU_COUNT(&node_cpus[num_nodes]))
+	    node_ids[num_nodes++] = node;
+	fclose(f);
+    }
+    if (!num_nodes) {
+	sched_getaffinity(0, sizeof(node_cpus[0]), &node_cpus[0]);
+	node_ids[0] = 0;
+	num_nodes = 1;
+    }
+}
+
+static int cpu_to_node(int cpu)
+{
+    int i;
+
+    for (i = 0 ; i < num_nodes ; i++) {
+	if (CPU_ISSET(cpu, &node_cpus[i]))
+	    return node_ids[i];
+    }
+    return -1;
+}
+
+/*
+ * -N spreads the threads round robin over the numa nodes, -k puts thread
+ * i on the i'th cpu of the list (wrapping around)
+ */
+static int setup_pinning(struct thread_info *t, int num_threads)
+{
+    cpu_set_t list;
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int num_cpus = 0;
+    int i;
+
+    read_numa_topology();
+    if (pin_cpu_list) {
+	if (parse_cpulist(pin_cpu_list, &list) || !CPU_COUNT(&list)) {
+	    fprintf(stderr, "bad cpu list %s\n", pin_cpu_list);
+	    return -1;
+	}
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	for (i = 0 ; i < CPU_SETSIZE ; i++) {
+	    if (!CPU_ISSET(i, &list))
+		continue;
+	    if (!CPU_ISSET(i, &allowed)) {
+		fprintf(stderr, "cpu %d is not available\n", i);
+		return -1;
+	    }
+	    cpus[num_cpus++] = i;
+	}
+    }
+    for (i = 0 ; i < num_threads ; i++) {
+	t[i].pinned = 1;
+	CPU_ZERO(&t[i].cpus);
+	if (pin_cpu_list) {
+	    CPU_SET(cpus[i % num_cpus], &t[i].cpus);
+	    t[i].node = cpu_to_node(cpus[i % num_cpus]);
+	} else {
+	    t[i].cpus = node_cpus[i % num_nodes];
+	    t[i].node = node_ids[i % num_nodes];
+	}
+    }
+    return 0;
+}
+
+static size_t huge_page_size(void)
+{
+    char line[128];
+    size_t kb = 0;
+    FILE *f = fopen("/proc/meminfo", "r");
+
+    if (f) {
+	while (fgets(line, sizeof(line), f)) {
+	    if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+		break;
+	}
+	fclose(f);
+    }
+    return kb ? kb * 1024 : 2 * 1024 * 1024;
+}
+
+/*
+ * anonymous memory for io buffers, from hugetlbfs pages with -m hugetlb.
+ * When node is given the pages are preferred from that node.  bytes is
+ * rounded up to what was really mapped
+ */
+static char *alloc_buffer_ram(size_t *bytes, int node)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+    char *p;
+
+    if (use_shm == USE_HUGETLB) {
+	size_t huge = huge_page_size();
+#ifdef MAP_HUGETLB
+	flags |= MAP_HUGETLB;
+#endif
+	*bytes = (*bytes + huge - 1) / huge * huge;
+    }
+    p = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) {
+	perror(use_shm == USE_HUGETLB ? "mmap MAP_HUGETLB (check "
+	       "/proc/sys/vm/nr_hugepages)" : "mmap");
+	return NULL;
+    }
+    if (node >= 0) {
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+		1UL << (node % (8 * sizeof(unsigned long)));
+	/* not fatal, first touch from the pinned thread mostly does the same */
+	if (syscall(SYS_mbind, p, *bytes, MPOL_PREFERRED, mask,
+	            MAX_NODES + 1, 0))
+	    perror("mbind");
+    }
+    return p;
+}
+
+/*
+ * pins the calling worker and gives it io buffers on its own node.  The
+ * buffers are touched from here, after pinning, so even without mbind
+ * the pages come from the local node
+ */
+static int setup_arena(struct thread_info *t)
+{
+    if (sched_setaffinity(0, sizeof(t->cpus), &t->cpus)) {
+	perror("sched_setaffinity");
+	return -1;
+    }
+    t->arena_size = (size_t)t->num_global_ios * padded_reclen;
+    t->arena = alloc_buffer_ram(&t->arena_size, t->node);
+    if (!t->arena)
+	return -1;
+    assign_buffers(t, t->arena);
+    return 0;
+}
+
 /*
  * The buffers used for file data are allocated as a single big
  * malloc, and then each thread and operation takes a piece and uses
@@ -1039,6 +2430,8 @@ int setup_shared_mem(int num_threads, int num_files, int depth,
 	    perror("mmap");
 	    goto free_buffers;
 	}
+    } else if (use_shm == USE_HUGETLB) {
+	p = alloc_buffer_ram(&total_ram, -1);
     }
     if (!p) {
         fprintf(stderr, "unable to allocate buffers\n");
@@ -1056,6 +2449,36 @@ free_buffers:
     return -1;
 }
 
+/*
+ * the stage throughput of the pinned threads, broken down by the numa
+ * node their buffers are on
+ */
+static void node_throughput(char *this_stage, double runtime)
+{
+    int i;
+    int j;
+    int node;
+    double mb;
+
+    for (i = 0 ; i < num_threads ; i++) {
+	node = global_thread_info[i].node;
+	/* only report each node once, from its first thread */
+	for (j = 0 ; j < i ; j++) {
+	    if (global_thread_info[j].node == node)
+		break;
+	}
+	if (j < i)
+	    continue;
+	mb = 0;
+	for (j = i ; j < num_threads ; j++) {
+	    if (global_thread_info[j].node == node)
+		mb += global_thread_info[j].stage_mb_trans;
+	}
+	fprintf(stderr, "node %d %s throughput (%.2f MB/s) %.2f MB in %.2fs\n",
+	        node, this_stage, mb / runtime, mb, runtime);
+    }
+}
+
 /*
  * runs through all the thread_info structs and calculates a combined
  * throughput
@@ -1065,6 +2488,7 @@ void global_thread_throughput(struct thread_info *t, char *this_stage) {
     double runtime = time_since_now(&global_stage_start_time);
     double total_mb = 0;
     double min_trans = 0;
+    char str[64];
 
     for (i = 0 ; i < num_threads ; i++) {
         total_mb += global_thread_info[i].stage_mb_trans;
@@ -1079,6 +2503,18 @@ void global_thread_throughput(struct thread_info *t, char *this_stage) {
 	    fprintf(stderr, " min transfer %.2fMB", min_trans);
         fprintf(stderr, "\n");
     }
+    if (total_mb && t->pinned)
+	node_throughput(this_stage, runtime);
+    if (latency_stats) {
+	snprintf(str, sizeof(str), "%s latency", this_stage);
+	print_lat(str, &global_submit_latency);
+    }
+    if (completion_latency_stats) {
+	snprintf(str, sizeof(str), "%s completion latency", this_stage);
+	print_lat(str, &global_completion_latency);
+    }
+    memset(&global_submit_latency, 0, sizeof(global_submit_latency));
+    memset(&global_completion_latency, 0, sizeof(global_completion_latency));
 }
 
 
@@ -1100,9 +2536,33 @@ int worker(struct thread_info *t)
     int iteration = 0;
     int cnt;
 
+    if (t->pinned && setup_arena(t))
+        exit(1);
+
+#ifdef HAVE_IO_URING
+    if (io_engine == ENGINE_URING)
+        uring_setup(t);
+    else
+#endif
     aio_setup(&t->io_ctx, 512);
 
+    /*
+     * the default 50us timer slack would make every paced io late, and
+     * open loop latencies would mostly measure nanosleep
+     */
+    if (rate_iops)
+        prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
 restart:
+    /* plans are built before the barrier so they aren't timed */
+    oper = t->active_opers;
+    while (oper) {
+	oper_stage_start(oper);
+	oper = oper->next;
+	if (oper == t->active_opers)
+	    break;
+    }
+
     if (num_threads > 1) {
         pthread_mutex_lock(&stage_mutex);
 	threads_starting++;
@@ -1117,8 +2577,12 @@ restart:
     }
     if (t->active_opers) {
         this_stage = stage_name(t->active_opers->rw);
+	if (t == global_thread_info)
+	    __atomic_store_n(&current_stage_rw, t->active_opers->rw,
+	                     __ATOMIC_RELAXED);
 	gettimeofday(&stage_time, NULL);
 	t->stage_mb_trans = 0;
+	t->next_issue_ns = now_ns();
     }
 
     cnt = 0;
@@ -1134,12 +2598,6 @@ restart:
         }
 	cnt++;
     }
-    if (latency_stats)
-        print_latency(t);
-
-    if (completion_latency_stats)
-	print_completion_latency(t);
-
     /* then we wait for all the operations to finish */
     oper = t->finished_opers;
     do {
@@ -1149,6 +2607,25 @@ restart:
 	oper = oper->next;
     } while(oper != t->finished_opers);
 
+    /*
+     * every io of the stage has completed now, so the histograms are
+     * final.  Fold them into the stage totals before printing resets them
+     */
+    if (num_threads > 1) {
+	merge_latency(&global_submit_latency, &t->io_submit_latency);
+	merge_latency(&global_completion_latency, &t->io_completion_latency);
+    }
+    if (latency_stats)
+        print_latency(t);
+    else
+	memset(&t->io_submit_latency, 0, sizeof(t->io_submit_latency));
+
+    if (completion_latency_stats)
+	print_completion_latency(t);
+    else
+	memset(&t->io_completion_latency, 0,
+	       sizeof(t->io_completion_latency));
+
     /* then we do an fsync to get the timing for any future operations
      * right, and check to see if any of these need to get restarted
      */
@@ -1173,6 +2650,12 @@ restart:
 	fprintf(stderr, "thread %d %s totals (%.2f MB/s) %.2f MB in %.2fs\n", 
 	        t - global_thread_info, this_stage, t->stage_mb_trans/seconds, 
 		t->stage_mb_trans, seconds);
+	if (rate_iops) {
+	    fprintf(stderr, "thread %d %s iops %.0f target %.0f\n",
+	            (int)(t - global_thread_info), this_stage,
+		    t->stage_mb_trans * 1024 * 1024 / rec_len / seconds,
+		    rate_iops / num_threads);
+	}
     }
 
     if (num_threads > 1) {
@@ -1204,11 +2687,105 @@ restart:
     if (t->num_global_pending) {
         fprintf(stderr, "global num pending is %d\n", t->num_global_pending);
     }
+#ifdef HAVE_IO_URING
+    if (io_engine == ENGINE_URING)
+        uring_release(t);
+    else
+#endif
     io_queue_release(t->io_ctx);
+    if (t->arena)
+        munmap(t->arena, t->arena_size);
     
     return status;
 }
 
+/*
+ * the -T reporter thread.  Every interval it sums the live_stats of all
+ * the workers, takes the difference from the previous sample and prints
+ * throughput, iops and completion latency percentiles for just that
+ * interval as one json object per line
+ */
+void *reporter(void *arg)
+{
+    FILE *out = arg;
+    static struct io_latency lat;
+    static unsigned long long prev_hist[LAT_BUCKETS];
+    unsigned long long prev_ios = 0;
+    unsigned long long prev_bytes = 0;
+    unsigned long long start = now_ns();
+    unsigned long long prev_time = start;
+    unsigned long long now;
+    unsigned long long ios;
+    unsigned long long bytes;
+    unsigned long long sum;
+    struct timespec next;
+    double secs;
+    int stop;
+    int rw;
+    int i;
+    int b;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    do {
+	next.tv_nsec += (report_interval_ms % 1000) * 1000000L;
+	next.tv_sec += report_interval_ms / 1000 + next.tv_nsec / 1000000000L;
+	next.tv_nsec %= 1000000000L;
+
+	/* sleeps out the interval, unless main says the run is over */
+	pthread_mutex_lock(&reporter_lock);
+	while (!reporter_stop &&
+	       pthread_cond_timedwait(&reporter_cond, &reporter_lock,
+	                              &next) != ETIMEDOUT)
+	    ;
+	stop = reporter_stop;
+	pthread_mutex_unlock(&reporter_lock);
+
+	now = now_ns();
+	ios = 0;
+	bytes = 0;
+	for (i = 0 ; i < num_threads ; i++) {
+	    struct live_stats *live = &global_thread_info[i].live;
+	    ios += __atomic_load_n(&live->ios, __ATOMIC_RELAXED);
+	    bytes += __atomic_load_n(&live->bytes, __ATOMIC_RELAXED);
+	}
+	lat.total_io = 0;
+	for (b = 0 ; b < LAT_BUCKETS ; b++) {
+	    sum = 0;
+	    for (i = 0 ; i < num_threads ; i++)
+		sum += __atomic_load_n(&global_thread_info[i].live.hist[b],
+		                       __ATOMIC_RELAXED);
+	    lat.hist[b] = sum - prev_hist[b];
+	    lat.total_io += lat.hist[b];
+	    prev_hist[b] = sum;
+	}
+
+	secs = (now - prev_time) / 1e9;
+	rw = __atomic_load_n(&current_stage_rw, __ATOMIC_RELAXED);
+	fprintf(out, "{\"time_ms\": %.0f, \"stage\": \"%s\", "
+	        "\"ios\": %llu, \"iops\": %.0f, \"mb_per_sec\": %.2f, "
+		"\"lat_usec\": ", (now - start) / 1e6,
+		rw < 0 ? "none" : stage_name(rw), ios - prev_ios,
+		(ios - prev_ios) / secs,
+		(bytes - prev_bytes) / secs / (1024 * 1024));
+	if (lat.total_io) {
+	    for (i = 0 ; i < NUM_PERCENTILES ; i++) {
+		fprintf(out, "%s\"p%g\": %.1f", i ? ", " : "{",
+		        percentiles[i],
+			lat_percentile(&lat, percentiles[i]) / 1e3);
+	    }
+	    fprintf(out, "}}\n");
+	} else {
+	    fprintf(out, "null}\n");
+	}
+	fflush(out);
+
+	prev_ios = ios;
+	prev_bytes = bytes;
+	prev_time = now;
+    } while (!stop);
+    return NULL;
+}
+
 typedef void * (*start_routine)(void *);
 int run_workers(struct thread_info *t, int num_threads)
 {
@@ -1264,9 +2841,48 @@ off_t parse_size(char *size_arg, off_t mult) {
     return ret;
 }
 
+/* parses the -D argument, returns non-zero if it makes no sense */
+int parse_dist(char *arg) {
+    char *p;
+
+    if (!strcmp(arg, "uniform")) {
+        offset_dist = DIST_UNIFORM;
+	return 0;
+    }
+    if (!strncmp(arg, "zipf", 4)) {
+        offset_dist = DIST_ZIPF;
+	if (arg[4] == ':')
+	    zipf_theta = atof(arg + 5);
+	else if (arg[4])
+	    return -1;
+	return zipf_theta <= 0 || zipf_theta >= 1;
+    }
+    if (!strcmp(arg, "permute")) {
+        offset_dist = DIST_PERMUTE;
+	return 0;
+    }
+    if (!strncmp(arg, "hotspot", 7)) {
+        offset_dist = DIST_HOTSPOT;
+	p = arg + 7;
+	if (*p == ':') {
+	    hot_pct = strtod(p + 1, &p);
+	    if (*p == ':')
+		hot_io_pct = strtod(p + 1, &p);
+	}
+	if (*p)
+	    return -1;
+	return hot_pct <= 0 || hot_pct > 100 || hot_io_pct < 0 ||
+	       hot_io_pct > 100;
+    }
+    return -1;
+}
+
 void print_usage(void) {
     printf("usage: aio-stress [-s size] [-r size] [-a size] [-d num] [-b num]\n");
     printf("                  [-i num] [-t num] [-c num] [-C size] [-nxhOS ]\n");
+    printf("                  [-E engine] [-BfP] [-M pct] [-D dist] [-R iops]\n");
+    printf("                  [-X seed] [-p] [-N] [-k cpus] [-T ms] [-J file]\n");
+    printf("                  [-V]\n");
     printf("                  file1 [file2 ...]\n");
     printf("\t-a size in KB at which to align buffers\n");
     printf("\t-b max number of iocbs to give io_submit at once\n");
@@ -1280,17 +2896,46 @@ void print_usage(void) {
     printf("\t-O Use O_DIRECT (not available in 2.4 kernels),\n");
     printf("\t-S Use O_SYNC for writes\n");
     printf("\t-o add an operation to the list: write=0, read=1,\n"); 
-    printf("\t   random write=2, random read=3.\n");
+    printf("\t   random write=2, random read=3, random mixed=4.\n");
     printf("\t   repeat -o to specify multiple ops: -o 0 -o 1 etc.\n");
     printf("\t-m shm use ipc shared memory for io buffers instead of malloc\n");
     printf("\t-m shmfs mmap a file in /dev/shm for io buffers\n");
+    printf("\t-m hugetlb use MAP_HUGETLB pages for io buffers\n");
+    printf("\t-N spread threads over numa nodes, pinned, with buffers\n");
+    printf("\t   allocated per thread on its node\n");
+    printf("\t-k cpu list, pin thread n to the n'th cpu listed, eg 0-3,8\n");
+    printf("\t   buffers are allocated per thread as with -N\n");
     printf("\t-n no fsyncs between write stage and read stage\n");
     printf("\t-l print io_submit latencies after each stage\n");
-    printf("\t-L print io completion latencies after each stage\n");
+    printf("\t-L print io completion latencies after each stage,\n");
+    printf("\t   per thread, per file and for all threads together\n");
+    printf("\t-T print throughput, iops and completion latency every\n");
+    printf("\t   ms milliseconds as json lines\n");
+    printf("\t-J write the -T json lines to file, default is\n");
+    printf("\t   aio-stress-intervals.json\n");
     printf("\t-t number of threads to run\n");
     printf("\t-u unlink files after completion\n");
     printf("\t-v verification of bytes written\n");
+    printf("\t-V stamp every block written with a header (offset, write\n");
+    printf("\t   generation, crc32c) and check it on every read.  Catches\n");
+    printf("\t   torn, misplaced and lost writes\n");
     printf("\t-x turn off thread stonewalling\n");
+    printf("\t-M percent of reads in the random mixed stage, default 50\n");
+    printf("\t-D offset distribution for the random stages:\n");
+    printf("\t   uniform (default)\n");
+    printf("\t   zipf[:theta] skewed by theta < 1, default 0.99\n");
+    printf("\t   permute visits every record exactly once in a random order\n");
+    printf("\t   hotspot[:hot%%[:io%%]] io%% of the ios go to the first\n");
+    printf("\t     hot%% of the file, default 10:90\n");
+    printf("\t-X seed for the random stages, default 1\n");
+    printf("\t-p precompute each random stage's offsets before it starts\n");
+    printf("\t-R open loop mode, total target iops split over the threads.\n");
+    printf("\t   latencies are measured from the intended issue time\n");
+    printf("\t-E io engine, libaio (default) or uring\n");
+    printf("\t-B io_uring: register io buffers, uses READ/WRITE_FIXED\n");
+    printf("\t-f io_uring: register file descriptors\n");
+    printf("\t-P io_uring: kernel side submission polling (SQPOLL),\n");
+    printf("\t   kernels before 5.11 also need -f\n");
     printf("\t-h this message\n");
     printf("\n\t   the size options (-a -s and -r) allow modifiers -s 400{k,m,g}\n");
     printf("\t   translate to 400KB, 400MB and 400GB\n");
@@ -1311,11 +2956,12 @@ int main(int ac, char **av)
     int num_files = 0;
     int open_fds = 0;
     struct thread_info *t;
+    pthread_t reporter_tid;
 
     page_size_mask = getpagesize() - 1;
 
     while(1) {
-	c = getopt(ac, av, "a:b:c:C:m:s:r:d:i:I:o:t:lLnhOSxvu");
+	c = getopt(ac, av, "a:b:c:C:m:s:r:d:i:I:o:t:E:M:D:R:X:k:T:J:lLnhOSxvuBfPpNV");
 	if  (c < 0)
 	    break;
 
@@ -1363,6 +3009,9 @@ int main(int ac, char **av)
 	    } else if (!strcmp(optarg, "shmfs")) {
 	        fprintf(stderr, "using /dev/shm for buffers\n");
 		use_shm = USE_SHMFS;
+	    } else if (!strcmp(optarg, "hugetlb")) {
+	        fprintf(stderr, "using hugetlb pages for buffers\n");
+		use_shm = USE_HUGETLB;
 	    }
 	    break;
 	case 'o': 
@@ -1388,6 +3037,75 @@ int main(int ac, char **av)
 	case 'v':
 	    verify = 1;
 	    break;
+	case 'V':
+	    header_verify = 1;
+	    break;
+	case 'E':
+	    if (!strcmp(optarg, "libaio")) {
+	        io_engine = ENGINE_LIBAIO;
+	    } else if (!strcmp(optarg, "uring")) {
+#ifdef HAVE_IO_URING
+	        io_engine = ENGINE_URING;
+#else
+		fprintf(stderr, "io_uring support not compiled in\n");
+		exit(1);
+#endif
+	    } else {
+		print_usage();
+		exit(1);
+	    }
+	    break;
+	case 'M':
+	    read_pct = atoi(optarg);
+	    if (read_pct < 0 || read_pct > 100) {
+		fprintf(stderr, "-M takes a percentage\n");
+		exit(1);
+	    }
+	    break;
+	case 'D':
+	    if (parse_dist(optarg)) {
+		print_usage();
+		exit(1);
+	    }
+	    break;
+	case 'R':
+	    rate_iops = atof(optarg);
+	    if (rate_iops <= 0) {
+		fprintf(stderr, "-R takes a positive iops rate\n");
+		exit(1);
+	    }
+	    break;
+	case 'X':
+	    rng_seed_value = strtoull(optarg, NULL, 0);
+	    break;
+	case 'p':
+	    precompute_offsets = 1;
+	    break;
+	case 'N':
+	    pin_nodes = 1;
+	    break;
+	case 'k':
+	    pin_cpu_list = optarg;
+	    break;
+	case 'T':
+	    report_interval_ms = atoi(optarg);
+	    if (report_interval_ms <= 0) {
+		fprintf(stderr, "-T takes a positive interval in ms\n");
+		exit(1);
+	    }
+	    break;
+	case 'J':
+	    report_file = optarg;
+	    break;
+	case 'B':
+	    uring_fixed_bufs = 1;
+	    break;
+	case 'f':
+	    uring_fixed_files = 1;
+	    break;
+	case 'P':
+	    uring_sqpoll = 1;
+	    break;
 	case 'h':
 	default:
 	    print_usage();
@@ -1395,6 +3113,39 @@ int main(int ac, char **av)
 	}
     }
 
+    if (io_engine != ENGINE_URING &&
+        (uring_fixed_bufs || uring_fixed_files || uring_sqpoll)) {
+	fprintf(stderr, "-B, -f and -P need -E uring\n");
+	exit(1);
+    }
+
+    if (header_verify) {
+	if (verify) {
+	    fprintf(stderr, "-v and -V can't be used together\n");
+	    exit(1);
+	}
+	/*
+	 * every io has to start on a header block boundary or headers
+	 * would land at different places on each write
+	 */
+	while (header_block > 64 &&
+	       (rec_len % header_block ||
+	        (page_size_mask + 1) % header_block ||
+		context_offset % header_block))
+	    header_block >>= 1;
+	if (rec_len % header_block) {
+	    fprintf(stderr, "-V needs a record size that is a multiple of "
+	            "64 bytes\n");
+	    exit(1);
+	}
+	/*
+	 * contexts on the same file write overlapping ranges without
+	 * knowing about each other's generations
+	 */
+	if (num_contexts > 1)
+	    header_lost_writes = 0;
+    }
+
     /* 
      * make sure we don't try to submit more ios than we have allocated
      * memory for
@@ -1417,7 +3168,7 @@ int main(int ac, char **av)
 	        num_threads);
     }
 
-    t = malloc(num_threads * sizeof(*t));
+    t = calloc(num_threads, sizeof(*t));
     if (!t) {
         perror("malloc");
 	exit(1);
@@ -1459,6 +3210,27 @@ int main(int ac, char **av)
     fprintf(stderr, "file size %LuMB, record size %luKB, depth %d, ios per iteration %d\n", file_size / (1024 * 1024), rec_len / 1024, depth, io_iter);
     fprintf(stderr, "max io_submit %d, buffer alignment set to %luKB\n", 
             max_io_submit, (page_size_mask + 1)/1024);
+    if (io_engine == ENGINE_URING)
+	fprintf(stderr, "io engine uring, fixed buffers %s, fixed files %s, "
+	        "sqpoll %s\n", uring_fixed_bufs ? "on" : "off",
+		uring_fixed_files ? "on" : "off", uring_sqpoll ? "on" : "off");
+    if (offset_dist == DIST_ZIPF)
+	fprintf(stderr, "offset distribution zipf theta %.2f\n", zipf_theta);
+    else if (offset_dist == DIST_HOTSPOT)
+	fprintf(stderr, "offset distribution hotspot %.0f%% of ios to %.0f%% "
+	        "of the file\n", hot_io_pct, hot_pct);
+    else if (offset_dist == DIST_PERMUTE)
+	fprintf(stderr, "offset distribution permute\n");
+    if (header_verify)
+	fprintf(stderr, "block headers every %d bytes, crc32c %s%s\n",
+	        header_block, crc32c_setup(), header_lost_writes ? "" :
+		", lost write checks off with multiple contexts");
+    fprintf(stderr, "random seed %llu%s\n", rng_seed_value,
+            precompute_offsets ? ", offsets precomputed" : "");
+    if (stages & (1 << RMIX))
+	fprintf(stderr, "random mixed stage %d%% reads\n", read_pct);
+    if (rate_iops)
+	fprintf(stderr, "open loop, target %.0f iops\n", rate_iops);
     fprintf(stderr, "threads %d files %d contexts %d context offset %LuMB verification %s\n", 
             num_threads, num_files, num_contexts, 
 	    context_offset / (1024 * 1024), verify ? "on" : "off");
@@ -1479,11 +3251,28 @@ int main(int ac, char **av)
 		fprintf(stderr, "error in create_oper\n");
 		exit(-1);
 	    }
+	    oper->id = open_fds - 1;
 	    oper_list_add(oper, &t[thread_index].active_opers);
 	    t[thread_index].num_files++;
 	}
     }
-    if (setup_shared_mem(num_threads, num_files * num_contexts, 
+    for (i = 0 ; i < num_threads ; i++)
+	rng_seed(&t[i].rng, rng_seed_value + i);
+    if (pin_nodes || pin_cpu_list) {
+	if (use_shm == USE_SHM || use_shm == USE_SHMFS) {
+	    fprintf(stderr, "-m shm and -m shmfs can't be used with -N or -k\n");
+	    exit(1);
+	}
+	if (setup_pinning(t, num_threads))
+	    exit(1);
+	for (i = 0 ; i < num_threads ; i++) {
+	    fprintf(stderr, "thread %d pinned to %d cpus on node %d\n",
+	            i, CPU_COUNT(&t[i].cpus), t[i].node);
+	}
+    }
+    /* pinned threads allocate their own buffers, only verify_buf is shared */
+    if (setup_shared_mem(num_threads,
+                         t[0].pinned ? 0 : num_files * num_contexts, 
                          depth, rec_len, max_io_submit))
     {
         exit(1);
@@ -1491,6 +3280,30 @@ int main(int ac, char **av)
     for (i = 0 ; i < num_threads ; i++) {
 	if (setup_ious(&t[i], t[i].num_files, depth, rec_len, max_io_submit))
 		exit(1);
+	if (rate_iops) {
+	    t[i].issue_interval_ns = 1e9 * num_threads / rate_iops;
+	    if (!t[i].issue_interval_ns)
+		t[i].issue_interval_ns = 1;
+	}
+    }
+    if (report_interval_ms) {
+	pthread_condattr_t attr;
+	FILE *out;
+
+	/* kept apart from the stage report on stdout */
+	out = fopen(report_file, "w");
+	if (!out) {
+	    perror(report_file);
+	    exit(1);
+	}
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&reporter_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pthread_create(&reporter_tid, NULL, reporter, out)) {
+	    perror("pthread_create");
+	    exit(1);
+	}
     }
     if (num_threads > 1){
         printf("Running multi thread version num_threads:%d\n", num_threads);
@@ -1499,6 +3312,14 @@ int main(int ac, char **av)
         printf("Running single thread version \n");
 	status = worker(t);
     }
+    if (report_interval_ms) {
+	/* the reporter prints the final partial interval and exits */
+	pthread_mutex_lock(&reporter_lock);
+	reporter_stop = 1;
+	pthread_cond_signal(&reporter_cond);
+	pthread_mutex_unlock(&reporter_lock);
+	pthread_join(reporter_tid, NULL);
+    }
     if (unlink_files) {
 	for (i = optind ; i < ac ; i++) {
 	    printf("Cleaning up file %s \n", av[i]);
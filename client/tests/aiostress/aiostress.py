@@ -1,11 +1,11 @@
 # This requires aio headers to build.
 # Should work automagically out of deps now.
-import os
+import os, re
 from autotest_lib.client.bin import test, utils
 
 
 class aiostress(test.test):
-    version = 3
+    version = 5
 
     def initialize(self):
         self.job.require_gcc()
@@ -21,7 +21,7 @@ class aiostress(test.test):
         os.chdir(self.srcdir)
         utils.system('cp ' + self.bindir+'/aio-stress.c .')
         os.chdir(self.srcdir)
-        self.gcc_flags += ' -Wall -lpthread -laio'
+        self.gcc_flags += ' -Wall -lpthread -laio -lm'
         cmd = 'gcc ' + self.gcc_flags + ' aio-stress.c -o aio-stress'
         utils.system(cmd)
 
@@ -47,13 +47,15 @@ class aiostress(test.test):
                     if 'contexts' in line:
                         break
 
+        # Only "<name> (<value> MB/s) ..." lines carry results; anything
+        # else aio-stress prints along the way is informational.
         keyval = {}
         for line in report:
-            line = line.split(')')[0]
-            key, value = line.split('(')
-            key = key.strip().replace(' ', '_')
-            value = value.split()[0]
-            keyval[key] = value
+            match = re.match(r'(.+?) \((\S+) MB/s\)', line)
+            if not match:
+                continue
+            key = match.group(1).strip().replace(' ', '_')
+            keyval[key] = match.group(2)
 
         self.write_perf_keyval(keyval)
 
@@ -4,7 +4,7 @@ from autotest_lib.client.common_lib import utils
 
 
 class cyclictest(test.test):
-    version = 2
+    version = 5
     preserve_srcdir = True
 
     # git://git.kernel.org/pub/scm/linux/kernel/git/tglx/rt-tests.git
@@ -9,12 +9,14 @@
  *
  */
 
-#define VERSION_STRING "V 0.15"
+#define VERSION_STRING "V 0.18"
 
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,8 +25,9 @@
 
 #include <linux/unistd.h>
 
-#include <sys/prctl.h>
+#include <sched.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
@@ -54,6 +57,20 @@ extern int clock_nanosleep(clockid_t __clock_id, int __flags,
 
 #define KVARS			32
 #define KVARNAMELEN		32
+#define KVARVALLEN		64
+
+/* overflows past the histogram remembered per thread, the rest are counted */
+#define OFLOW_MAX		1024
+
+/* interrupt lines followed for outlier attribution */
+#define IRQ_LINES		512
+#define IRQ_NAMELEN		24
+
+/* how stale the counts an outlier is compared against may get */
+#define NOISE_WINDOW_US		10000
+
+/* SMIs since reset, Intel only, readable through /dev/cpu/N/msr */
+#define MSR_SMI_COUNT		0x34
 
 /* Struct to transfer parameters to the thread */
 struct thread_param {
@@ -66,6 +83,47 @@ struct thread_param {
 	struct thread_stat *stats;
 	int bufmsk;
 	unsigned long interval;
+	int histogram;
+	int index;
+	int cpu;			/* pinned here by --smp, else -1 */
+	int outlier;			/* attribute wakeups later than this */
+};
+
+/* A latency that didn't fit in the histogram */
+struct overflow {
+	unsigned long cycle;
+	long latency;
+};
+
+/* One line of /proc/interrupts, for the thread's own cpu */
+struct irq_count {
+	char name[IRQ_NAMELEN];
+	unsigned long long count;
+};
+
+/* What had happened on a cpu by some point: interrupts and SMIs */
+struct noise {
+	int cpu;
+	int nirqs;
+	struct irq_count irqs[IRQ_LINES];
+	unsigned long long smi;
+};
+
+enum cause {
+	CAUSE_NONE,
+	CAUSE_IRQ,
+	CAUSE_SMI,
+	CAUSES
+};
+
+static char *cause_names[] = { "unexplained", "irq", "smi" };
+
+/* A late wakeup and what was going on during it */
+struct outlier {
+	unsigned long cycle;
+	long latency;
+	enum cause cause;
+	char why[96];
 };
 
 /* Struct for statistics */
@@ -77,6 +135,13 @@ struct thread_stat {
 	long act;
 	double avg;
 	long *values;
+	unsigned long *hist;		/* one bucket per usec, -h */
+	unsigned long hist_overflow;
+	struct overflow *overflows;	/* the first OFLOW_MAX of them */
+	struct noise *noise;		/* before and after, -o */
+	struct outlier *outliers;	/* the first OFLOW_MAX of them */
+	unsigned long noutliers;
+	unsigned long causes[CAUSES];
 	pthread_t thread;
 	int threadstarted;
 	int tid;
@@ -85,53 +150,85 @@ struct thread_stat {
 static int shutdown;
 static int tracelimit = 0;
 static int ftrace = 0;
-static int oldtrace = 0;
+static int histogram = 0;
 
-/* Backup of kernel variables that we modify */
+/* Which thread hit the break threshold, and with what */
+static int break_thread = -1;
+static long break_value;
+
+/*
+ * The tracefs helpers are the same as in signaltest. Each test's src/ is
+ * shipped and built on its own, so they are copied rather than shared:
+ * a fix to one belongs in both.
+ */
+
+/* Backup of tracefs settings that we modify */
 static struct kvars {
 	char name[KVARNAMELEN];
-	int value;
+	char value[KVARVALLEN];
 } kv[KVARS];
 
-static char *procfileprefix = "/proc/sys/kernel/";
+static char *tracefs_paths[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+};
+
+static char *tracefs;
+static int marker_fd = -1;
+static int snapshot_fd = -1;
+static int tracing_on_fd = -1;
+static int trace_frozen;
 
-static int kernvar(int mode, char *name, int *value)
+static char *find_tracefs(void)
 {
-	int retval = 1;
-	int procfilepath;
-	char procfilename[128];
+	char path[128];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tracefs_paths); i++) {
+		snprintf(path, sizeof(path), "%s/trace_marker", tracefs_paths[i]);
+		if (!access(path, W_OK))
+			return tracefs_paths[i];
+	}
+	return NULL;
+}
+
+static int tracefs_open(char *name, int mode)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/%s", tracefs, name);
+	return open(path, mode);
+}
 
-	strncpy(procfilename, procfileprefix, sizeof(procfilename));
-	strncat(procfilename, name,
-		sizeof(procfilename) - sizeof(procfileprefix));
-	procfilepath = open(procfilename, mode);
-	if (procfilepath >= 0) {
-		char buffer[32];
+static int tracevar(int mode, char *name, char *value, size_t len)
+{
+	int retval = 1;
+	int fd = tracefs_open(name, mode);
 
+	if (fd >= 0) {
 		if (mode == O_RDONLY) {
-			if (read(procfilepath, buffer, sizeof(buffer)) > 0) {
-				char *endptr;
-				*value = strtol(buffer, &endptr, 0);
-				if (endptr != buffer)
-					retval = 0;
+			ssize_t got = read(fd, value, len - 1);
+
+			if (got > 0) {
+				value[got] = '\0';
+				value[strcspn(value, "\n")] = '\0';
+				retval = 0;
 			}
 		} else if (mode == O_WRONLY) {
-			snprintf(buffer, sizeof(buffer), "%d\n", *value);
-			if (write(procfilepath, buffer, strlen(buffer))
-			    == strlen(buffer))
+			if (write(fd, value, strlen(value)) == strlen(value))
 				retval = 0;
 		}
-		close(procfilepath);
+		close(fd);
 	}
 	return retval;
 }
 
-static void setkernvar(char *name, int value)
+static void settracevar(char *name, char *value)
 {
 	int i;
-	int oldvalue;
+	char oldvalue[KVARVALLEN];
 
-	if (kernvar(O_RDONLY, name, &oldvalue))
+	if (tracevar(O_RDONLY, name, oldvalue, sizeof(oldvalue)))
 		fprintf(stderr, "could not retrieve %s\n", name);
 	else {
 		for (i = 0; i < KVARS; i++) {
@@ -139,31 +236,253 @@ static void setkernvar(char *name, int value)
 				break;
 			if (kv[i].name[0] == '\0') {
 				strncpy(kv[i].name, name, sizeof(kv[i].name));
-				kv[i].value = oldvalue;
+				strncpy(kv[i].value, oldvalue, sizeof(kv[i].value));
 				break;
 			}
 		}
 		if (i == KVARS)
-			fprintf(stderr, "could not backup %s (%d)\n", name,
+			fprintf(stderr, "could not backup %s (%s)\n", name,
 				oldvalue);
 	}
-	if (kernvar(O_WRONLY, name, &value))
-		fprintf(stderr, "could not set %s to %d\n", name, value);
+	if (tracevar(O_WRONLY, name, value, 0))
+		fprintf(stderr, "could not set %s to %s\n", name, value);
 }
 
-static void restorekernvars(void)
+static void restoretracevars(void)
 {
 	int i;
 
 	for (i = 0; i < KVARS; i++) {
+		/* leave a trace stopped at the break for reading */
+		if (trace_frozen && !strcmp(kv[i].name, "tracing_on"))
+			continue;
 		if (kv[i].name[0] != '\0') {
-			if (kernvar(O_WRONLY, kv[i].name, &kv[i].value))
-				fprintf(stderr, "could not restore %s to %d\n",
+			if (tracevar(O_WRONLY, kv[i].name, kv[i].value, 0))
+				fprintf(stderr, "could not restore %s to %s\n",
 					kv[i].name, kv[i].value);
 		}
 	}
 }
 
+/*
+ * -b: with tracing on, a latency past the limit leaves a marker in the
+ * trace and swaps the buffer into the snapshot, so the path to the
+ * latency survives for reading from tracefs/snapshot afterwards. Kernels
+ * without snapshots just stop tracing there.
+ */
+static void setup_tracing(void)
+{
+	tracefs = find_tracefs();
+	if (!tracefs) {
+		fprintf(stderr, "tracefs not mounted, -b only stops the test\n");
+		return;
+	}
+	if (ftrace)
+		settracevar("current_tracer", "function");
+	settracevar("tracing_on", "1");
+
+	marker_fd = tracefs_open("trace_marker", O_WRONLY);
+	snapshot_fd = tracefs_open("snapshot", O_WRONLY);
+	if (snapshot_fd < 0) {
+		fprintf(stderr, "no tracefs snapshot, tracing stops at the break\n");
+		tracing_on_fd = tracefs_open("tracing_on", O_WRONLY);
+	}
+}
+
+static void tracemark(char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	if (marker_fd < 0)
+		return;
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (write(marker_fd, buf, len) != len)
+		fprintf(stderr, "could not write trace_marker\n");
+}
+
+/*
+ * Outlier attribution. Every NOISE_WINDOW_US or so, and after each
+ * outlier, a thread notes its cpu's column of /proc/interrupts and, where
+ * the msr driver lets us, MSR_SMI_COUNT. Parsing the whole file each cycle
+ * would cost more than the short intervals it is meant to explain. A
+ * wakeup later than the -o limit is blamed on whatever moved since: an
+ * SMI first, since it steals the cpu from under everything, then any
+ * interrupt other than the timer that delivered the wakeup itself.
+ */
+static char *wakeup_irqs[] = { "LOC", "arch_timer" };
+
+static int smi_available = 1;
+
+static int open_msr(int cpu)
+{
+	char path[64];
+	unsigned long long smi;
+	int fd;
+
+	/* an unpinned thread can't know which cpu's counter to read */
+	if (cpu < 0)
+		smi_available = 0;
+	if (!smi_available)
+		return -1;
+	snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0 && pread(fd, &smi, sizeof(smi), MSR_SMI_COUNT) != sizeof(smi)) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		smi_available = 0;
+	return fd;
+}
+
+/* reads the thread's column of /proc/interrupts into n */
+static void read_noise(int irq_fd, int msr_fd, int cpu, char **buf,
+		       size_t *size, struct noise *n)
+{
+	char *line, *next, *p, *end, want[16];
+	size_t len = 0;
+	ssize_t got;
+	int col = -1, i;
+
+	/* an unpinned thread reads whichever cpu it is on now */
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	n->cpu = cpu;
+	n->nirqs = 0;
+	lseek(irq_fd, 0, SEEK_SET);
+	while ((got = read(irq_fd, *buf + len, *size - len - 1)) > 0) {
+		len += got;
+		if (len == *size - 1) {
+			*size *= 2;
+			*buf = realloc(*buf, *size);
+			if (!*buf) {
+				fprintf(stderr, "out of memory for /proc/interrupts\n");
+				exit(1);
+			}
+		}
+	}
+	(*buf)[len] = '\0';
+
+	/* the header names the columns, offline cpus have none */
+	snprintf(want, sizeof(want), "CPU%d", cpu);
+	line = *buf;
+	next = strchr(line, '\n');
+	if (!next)
+		return;
+	*next++ = '\0';
+	for (p = strtok_r(line, " ", &end), i = 0; p; p = strtok_r(NULL, " ", &end), i++)
+		if (!strcmp(p, want))
+			col = i;
+	if (col < 0)
+		return;
+
+	for (line = next; line && *line && n->nirqs < IRQ_LINES; line = next) {
+		struct irq_count *irq = &n->irqs[n->nirqs];
+		unsigned long long v = 0;
+		char *label, *name;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		label = line + strspn(line, " ");
+		p = strchr(label, ':');
+		if (!p)
+			continue;
+		*p++ = '\0';
+		for (i = 0; i <= col; i++) {
+			v = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		if (i <= col)
+			continue;
+		/* numbered lines are best known by their last word, the device */
+		name = label;
+		if (*label >= '0' && *label <= '9') {
+			end = p + strlen(p);
+			while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+				*--end = '\0';
+			name = strrchr(p, ' ');
+			name = name ? name + 1 : label;
+		}
+		snprintf(irq->name, sizeof(irq->name), "%s", name);
+		irq->count = v;
+		n->nirqs++;
+	}
+
+	if (msr_fd >= 0 &&
+	    pread(msr_fd, &n->smi, sizeof(n->smi), MSR_SMI_COUNT) != sizeof(n->smi))
+		n->smi = 0;
+}
+
+static void attribute(struct thread_stat *stat, long diff)
+{
+	struct noise *before = &stat->noise[0], *after = &stat->noise[1];
+	struct outlier o;
+	char *p = o.why, *end = o.why + sizeof(o.why);
+	int moved = after->cpu != before->cpu;
+	int i, j, k;
+
+	o.cycle = stat->cycles;
+	o.latency = diff;
+	o.cause = CAUSE_NONE;
+	o.why[0] = '\0';
+
+	if (after->smi > before->smi) {
+		o.cause = CAUSE_SMI;
+		p += snprintf(p, end - p, " SMI %llu", after->smi - before->smi);
+	}
+	/* a thread that moved has two cpus' worth of counts, no use */
+	if (moved)
+		p += snprintf(p, end - p, " (moved from cpu %d to %d)",
+			      before->cpu, after->cpu);
+	/* the lines are in the same order both times, bar a hotplugged irq */
+	for (i = 0, j = 0; !moved && i < after->nirqs; i++) {
+		struct irq_count *a = &after->irqs[i];
+		unsigned long long was = 0;
+
+		for (k = j; k < before->nirqs; k++) {
+			if (!strcmp(before->irqs[k].name, a->name)) {
+				was = before->irqs[k].count;
+				j = k + 1;
+				break;
+			}
+		}
+		if (a->count == was)
+			continue;
+		for (k = 0; k < ARRAY_SIZE(wakeup_irqs); k++)
+			if (!strcmp(a->name, wakeup_irqs[k]))
+				break;
+		if (k < ARRAY_SIZE(wakeup_irqs))
+			continue;
+		if (o.cause == CAUSE_NONE)
+			o.cause = CAUSE_IRQ;
+		if (p < end)
+			p += snprintf(p, end - p, " %s %llu", a->name, a->count - was);
+	}
+
+	stat->causes[o.cause]++;
+	if (stat->noutliers < OFLOW_MAX)
+		stat->outliers[stat->noutliers] = o;
+	stat->noutliers++;
+}
+
+static void tracesnapshot(void)
+{
+	if (snapshot_fd >= 0) {
+		if (write(snapshot_fd, "1", 1) != 1)
+			fprintf(stderr, "could not take trace snapshot\n");
+	} else if (tracing_on_fd >= 0) {
+		if (write(tracing_on_fd, "0", 1) == 1)
+			trace_frozen = 1;
+	}
+}
+
 static inline void tsnorm(struct timespec *ts)
 {
 	while (ts->tv_nsec >= NSEC_PER_SEC) {
@@ -207,26 +526,37 @@ void *timerthread(void *param)
 	struct thread_stat *stat = par->stats;
 	int policy = par->prio ? SCHED_FIFO : SCHED_OTHER;
 	int stopped = 0;
+	int irq_fd = -1, msr_fd = -1;
+	size_t irq_size = 16384;
+	char *irq_buf = NULL;
+	unsigned long noise_every;
 
 	interval.tv_sec = par->interval / USEC_PER_SEC;
 	interval.tv_nsec = (par->interval % USEC_PER_SEC) * 1000;
+	noise_every = par->interval && par->interval < NOISE_WINDOW_US ?
+		NOISE_WINDOW_US / par->interval : 1;
+
+	stat->tid = gettid();
 
-	if (tracelimit) {
-		setkernvar("trace_all_cpus", 1);
-		setkernvar("trace_freerunning", 1);
-		setkernvar("trace_print_on_crash", 0);
-		setkernvar("trace_user_triggered", 1);
-		setkernvar("trace_user_trigger_irq", -1);
-		setkernvar("trace_verbose", 0);
-		setkernvar("preempt_thresh", 0);
-		setkernvar("wakeup_timing", 0);
-		setkernvar("preempt_max_latency", 0);
-		if (ftrace)
-			setkernvar("mcount_enabled", 1);
-		setkernvar("trace_enabled", 1);
+	if (par->cpu >= 0) {
+		cpu_set_t mask;
+
+		CPU_ZERO(&mask);
+		CPU_SET(par->cpu, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask))
+			fprintf(stderr, "could not pin thread %d to cpu %d\n",
+				par->index, par->cpu);
 	}
 
-	stat->tid = gettid();
+	if (par->outlier) {
+		irq_fd = open("/proc/interrupts", O_RDONLY);
+		irq_buf = malloc(irq_size);
+		if (irq_fd < 0 || !irq_buf) {
+			fprintf(stderr, "could not read /proc/interrupts\n");
+			par->outlier = 0;
+		}
+		msr_fd = open_msr(par->cpu);
+	}
 
 	sigemptyset(&sigset);
 	sigaddset(&sigset, par->signal);
@@ -269,12 +599,10 @@ void *timerthread(void *param)
 
 	stat->threadstarted++;
 
-	if (tracelimit) {
-		if (oldtrace)
-			gettimeofday(0,(struct timezone *)1);
-		else
-			prctl(0, 1);
-	}
+	if (par->outlier)
+		read_noise(irq_fd, msr_fd, par->cpu, &irq_buf, &irq_size,
+			   &stat->noise[0]);
+
 	while (!shutdown) {
 
 		long diff;
@@ -321,18 +649,44 @@ void *timerthread(void *param)
 
 		if (!stopped && tracelimit && (diff > tracelimit)) {
 			stopped++;
-			if (oldtrace)
-				gettimeofday(0,0);
-			else
-				prctl(0, 0);
+			tracemark("hit latency threshold (%ld > %d)\n",
+				  diff, tracelimit);
+			tracesnapshot();
+			break_thread = par->index;
+			break_value = diff;
 			shutdown++;
 		}
 		stat->act = diff;
 		stat->cycles++;
 
+		if (par->histogram) {
+			if (diff >= par->histogram) {
+				if (stat->hist_overflow < OFLOW_MAX) {
+					stat->overflows[stat->hist_overflow].cycle = stat->cycles;
+					stat->overflows[stat->hist_overflow].latency = diff;
+				}
+				stat->hist_overflow++;
+			} else {
+				stat->hist[diff < 0 ? 0 : diff]++;
+			}
+		}
+
 		if (par->bufmsk)
 			stat->values[stat->cycles & par->bufmsk] = diff;
 
+		/* outside the measured window, it only delays the next sleep */
+		if (par->outlier) {
+			if (diff > par->outlier) {
+				read_noise(irq_fd, msr_fd, par->cpu, &irq_buf,
+					   &irq_size, &stat->noise[1]);
+				attribute(stat, diff);
+				stat->noise[0] = stat->noise[1];
+			} else if (stat->cycles % noise_every == 0) {
+				read_noise(irq_fd, msr_fd, par->cpu, &irq_buf,
+					   &irq_size, &stat->noise[0]);
+			}
+		}
+
 		next.tv_sec += interval.tv_sec;
 		next.tv_nsec += interval.tv_nsec;
 		tsnorm(&next);
@@ -353,6 +707,12 @@ out:
 		setitimer (ITIMER_REAL,  &itimer, NULL);
 	}
 
+	if (irq_fd >= 0)
+		close(irq_fd);
+	if (msr_fd >= 0)
+		close(msr_fd);
+	free(irq_buf);
+
 	/* switch to normal */
 	schedp.sched_priority = 0;
 	sched_setscheduler(0, SCHED_OTHER, &schedp);
@@ -375,16 +735,29 @@ static void display_help(void)
 	       "                           1 = CLOCK_REALTIME\n"
 	       "-d DIST  --distance=DIST   distance of thread intervals in us default=500\n"
 	       "-f                         function trace (when -b is active)\n"
+	       "-h USEC  --histogram=USEC  dump a latency histogram to stdout after the run\n"
+	       "                           USEC is the max latency time to be tracked,\n"
+	       "                           in 1 us buckets\n"
 	       "-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	       "-L LIST  --load=LIST       run the test once under each load in LIST, any\n"
+	       "                           of idle,mem,cache,syscall,disk,ipc or all,\n"
+	       "                           with LOOPS loops each\n"
 	       "-n       --nanosleep       use clock_nanosleep\n"
+	       "-N NUM   --load-threads=NUM workers per load: default=number of cpus\n"
+	       "-o USEC  --outlier=USEC    tag wakeups later than USEC as irq, smi or\n"
+	       "                           unexplained from /proc/interrupts and\n"
+	       "                           MSR_SMI_COUNT, listed after the run\n"
 	       "-p PRIO  --prio=PRIO       priority of highest prio thread\n"
 	       "-q       --quiet           print only a summary on exit\n"
 	       "-r       --relative        use relative timer instead of absolute\n"
 	       "-s       --system          use sys_nanosleep and sys_setitimer\n"
+	       "-S       --smp             one thread pinned to each allowed cpu, all at\n"
+	       "                           the same priority, using clock_nanosleep\n"
 	       "-t NUM   --threads=NUM     number of threads: default=1\n"
 	       "-v       --verbose         output values on stdout for statistics\n"
-	       "                           format: n:c:v n=tasknum c=count v=value in us\n");
+	       "                           format: n:c:v n=tasknum c=count v=value in us\n"
+	       "-W DIR   --load-dir=DIR    where the disk load writes: default=.\n");
 	exit(0);
 }
 
@@ -399,6 +772,283 @@ static int verbose;
 static int quiet;
 static int interval = 1000;
 static int distance = 500;
+static int smp;
+static int outlier;
+static char *load_dir = ".";
+static int load_threads;
+
+/* set by a signal from outside, which ends the run rather than a phase */
+static int interrupted;
+static int stopping;
+
+/*
+ * -L: load generators run alongside the timer threads, one phase per
+ * load with -l loops each, so every load gets its own statistics. Each
+ * runs load_threads workers at SCHED_OTHER and stops when load_stop is set.
+ */
+#define LOAD_MEM_SIZE		(64 << 20)	/* per buffer, at most */
+#define LOAD_MEM_TOTAL		(1 << 30)	/* over all mem workers */
+#define LOAD_DISK_SIZE		(64 << 20)
+#define LOAD_CHUNK		(1 << 20)
+#define LOAD_MSGSIZE		100
+#define MAX_PHASES		16
+
+static volatile int load_stop;
+
+static void *load_mem(void *arg);
+static void *load_cache(void *arg);
+static void *load_syscall(void *arg);
+static void *load_disk(void *arg);
+static void *load_ipc(void *arg);
+
+struct load {
+	char *name;
+	void *(*worker)(void *);
+};
+
+static struct load loads[] = {
+	{ "idle", NULL },
+	{ "mem", load_mem },
+	{ "cache", load_cache },
+	{ "syscall", load_syscall },
+	{ "disk", load_disk },
+	{ "ipc", load_ipc },
+};
+
+static struct load *phases[MAX_PHASES];
+static int nphases;
+
+/* latency over all timer threads during one phase */
+struct phase_stat {
+	unsigned long cycles;
+	long min;
+	long max;
+	double sum;
+};
+
+static struct phase_stat phase_stats[MAX_PHASES];
+
+/*
+ * streams through buffers much bigger than any cache, smaller ones with
+ * many workers so a big machine doesn't need gigabytes for the load
+ */
+static void *load_mem(void *arg)
+{
+	size_t size = LOAD_MEM_TOTAL / 2 / load_threads, off;
+	char *src, *dst;
+
+	if (size > LOAD_MEM_SIZE)
+		size = LOAD_MEM_SIZE;
+	size &= ~(size_t)(LOAD_CHUNK - 1);
+	if (size < LOAD_CHUNK)
+		size = LOAD_CHUNK;
+	src = malloc(size);
+	dst = malloc(size);
+	if (!src || !dst) {
+		fprintf(stderr, "no memory for the mem load\n");
+		goto out;
+	}
+	memset(src, 1, size);
+	while (!load_stop)
+		for (off = 0; off < size && !load_stop; off += LOAD_CHUNK)
+			memcpy(dst + off, src + off, LOAD_CHUNK);
+out:
+	free(src);
+	free(dst);
+	return NULL;
+}
+
+/* dirties random lines of twice the last level cache */
+static void *load_cache(void *arg)
+{
+	long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	unsigned long x = 88172645463325252UL + (long)arg;
+	size_t lines, i;
+	char *buf;
+
+	if (llc <= 0)
+		llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (llc <= 0)
+		llc = 8 << 20;
+	lines = 2 * llc / 64;
+	buf = calloc(lines, 64);
+	if (!buf) {
+		fprintf(stderr, "no memory for the cache load\n");
+		return NULL;
+	}
+	while (!load_stop) {
+		for (i = 0; i < 4096; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			buf[(x % lines) * 64]++;
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+/* cheap system calls back to back, kernel entry and exit is the load */
+static void *load_syscall(void *arg)
+{
+	int fd = open("/dev/null", O_WRONLY);
+	char c = 0;
+
+	while (!load_stop) {
+		syscall(SYS_getppid);
+		if (fd >= 0 && write(fd, &c, 1) < 0)
+			break;
+	}
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/* rewrites a file in the load directory, syncing as it goes */
+static void *load_disk(void *arg)
+{
+	char path[256], *buf = malloc(LOAD_CHUNK);
+	off_t off = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/cyclictest-load-XXXXXX", load_dir);
+	fd = mkstemp(path);
+	if (fd < 0 || !buf) {
+		fprintf(stderr, "could not create a disk load file in %s\n",
+			load_dir);
+		free(buf);
+		return NULL;
+	}
+	unlink(path);
+	memset(buf, 0x5a, LOAD_CHUNK);
+	while (!load_stop) {
+		if (pwrite(fd, buf, LOAD_CHUNK, off) != LOAD_CHUNK) {
+			fprintf(stderr, "disk load write failed\n");
+			break;
+		}
+		off = (off + LOAD_CHUNK) % LOAD_DISK_SIZE;
+		if (off % (4 * LOAD_CHUNK) == 0)
+			fdatasync(fd);
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/* ping pipe read end and pong pipe write end */
+struct echo {
+	int in;
+	int out;
+};
+
+static void *ipc_echo(void *arg)
+{
+	struct echo *e = arg;
+	char msg[LOAD_MSGSIZE];
+	ssize_t got;
+
+	while ((got = read(e->in, msg, sizeof(msg))) > 0)
+		if (write(e->out, msg, got) != got)
+			break;
+	return NULL;
+}
+
+/*
+ * hackbench style: small messages bounced between a pair of threads over
+ * two pipes. Closing the ping pipe is what stops the echo thread.
+ */
+static void *load_ipc(void *arg)
+{
+	char msg[LOAD_MSGSIZE];
+	int ping[2], pong[2];
+	struct echo e;
+	pthread_t echo;
+	size_t done;
+	ssize_t got;
+
+	if (pipe(ping)) {
+		fprintf(stderr, "could not create the ipc load pipes\n");
+		return NULL;
+	}
+	if (pipe(pong)) {
+		fprintf(stderr, "could not create the ipc load pipes\n");
+		close(ping[0]);
+		close(ping[1]);
+		return NULL;
+	}
+	e.in = ping[0];
+	e.out = pong[1];
+	memset(msg, 0, sizeof(msg));
+	pthread_create(&echo, NULL, ipc_echo, &e);
+	while (!load_stop) {
+		if (write(ping[1], msg, sizeof(msg)) != sizeof(msg))
+			break;
+		for (done = 0; done < sizeof(msg); done += got) {
+			got = read(pong[0], msg + done, sizeof(msg) - done);
+			if (got <= 0)
+				goto out;
+		}
+	}
+out:
+	close(ping[1]);
+	pthread_join(echo, NULL);
+	close(ping[0]);
+	close(pong[0]);
+	close(pong[1]);
+	return NULL;
+}
+
+static pthread_t *start_load(struct load *load)
+{
+	pthread_t *workers;
+	long i;
+
+	if (!load->worker)
+		return NULL;
+	workers = calloc(load_threads, sizeof(pthread_t));
+	if (!workers) {
+		fprintf(stderr, "no memory for the %s load\n", load->name);
+		return NULL;
+	}
+	load_stop = 0;
+	for (i = 0; i < load_threads; i++)
+		pthread_create(&workers[i], NULL, load->worker, (void *)i);
+	return workers;
+}
+
+static void stop_load(pthread_t *workers)
+{
+	int i;
+
+	if (!workers)
+		return;
+	load_stop = 1;
+	for (i = 0; i < load_threads; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+}
+
+static int parse_loads(char *list)
+{
+	char *name, *save;
+	int i;
+
+	for (name = strtok_r(list, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < ARRAY_SIZE(loads); i++) {
+			if (strcmp(name, "all") && strcmp(name, loads[i].name))
+				continue;
+			if (nphases == MAX_PHASES)
+				return 1;
+			phases[nphases++] = &loads[i];
+			if (strcmp(name, "all"))
+				break;
+		}
+		if (i == ARRAY_SIZE(loads) && strcmp(name, "all"))
+			return 1;
+	}
+	return 0;
+}
 
 static int clocksources[] = {
 	CLOCK_MONOTONIC,
@@ -417,19 +1067,25 @@ static void process_options (int argc, char *argv[])
 			{"clock", required_argument, NULL, 'c'},
 			{"distance", required_argument, NULL, 'd'},
 			{"ftrace", no_argument, NULL, 'f'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"interval", required_argument, NULL, 'i'},
 			{"loops", required_argument, NULL, 'l'},
+			{"load", required_argument, NULL, 'L'},
+			{"load-threads", required_argument, NULL, 'N'},
+			{"load-dir", required_argument, NULL, 'W'},
 			{"nanosleep", no_argument, NULL, 'n'},
+			{"outlier", required_argument, NULL, 'o'},
 			{"priority", required_argument, NULL, 'p'},
 			{"quiet", no_argument, NULL, 'q'},
 			{"relative", no_argument, NULL, 'r'},
 			{"system", no_argument, NULL, 's'},
+			{"smp", no_argument, NULL, 'S'},
 			{"threads", required_argument, NULL, 't'},
 			{"verbose", no_argument, NULL, 'v'},
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "b:c:d:fi:l:np:qrst:v",
+		int c = getopt_long (argc, argv, "b:c:d:fh:i:l:L:nN:o:p:qrsSt:vW:",
 			long_options, &option_index);
 		if (c == -1)
 			break;
@@ -438,15 +1094,21 @@ static void process_options (int argc, char *argv[])
 		case 'c': clocksel = atoi(optarg); break;
 		case 'd': distance = atoi(optarg); break;
 		case 'f': ftrace = 1; break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'i': interval = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
+		case 'L': error |= parse_loads(optarg); break;
 		case 'n': use_nanosleep = MODE_CLOCK_NANOSLEEP; break;
+		case 'N': load_threads = atoi(optarg); break;
+		case 'o': outlier = atoi(optarg); break;
 		case 'p': priority = atoi(optarg); break;
 		case 'q': quiet = 1; break;
 		case 'r': timermode = TIMER_RELTIME; break;
 		case 's': use_system = MODE_SYS_OFFSET; break;
+		case 'S': smp = 1; break;
 		case 't': num_threads = atoi(optarg); break;
 		case 'v': verbose = 1; break;
+		case 'W': load_dir = optarg; break;
 		case '?': error = 1; break;
 		}
 	}
@@ -460,23 +1122,27 @@ static void process_options (int argc, char *argv[])
 	if (num_threads < 1)
 		error = 1;
 
-	if (error)
-		display_help ();
-}
+	if (histogram < 0 || outlier < 0)
+		error = 1;
 
-static void check_kernel(void)
-{
-	size_t len;
-	char ver[256];
-	int fd, maj, min, sub;
+	/* a phase ends after its loops, so they can't be endless */
+	if (nphases && max_cycles <= 0)
+		error = 1;
 
-	fd = open("/proc/version", O_RDONLY, 0666);
-	len = read(fd, ver, 255);
-	close(fd);
-	ver[len-1] = 0x0;
-	sscanf(ver, "Linux version %d.%d.%d", &maj, &min, &sub);
-	if (maj == 2 && min == 6 && sub < 18)
-		oldtrace = 1;
+	if (load_threads <= 0)
+		load_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (smp) {
+		cpu_set_t mask;
+
+		if (sched_getaffinity(0, sizeof(mask), &mask))
+			error = 1;
+		num_threads = CPU_COUNT(&mask);
+		use_nanosleep = MODE_CLOCK_NANOSLEEP;
+	}
+
+	if (error)
+		display_help ();
 }
 
 static int check_timer(void)
@@ -491,9 +1157,115 @@ static int check_timer(void)
 
 static void sighand(int sig)
 {
+	/* main stops the timer threads with SIGTERM between load phases */
+	if (!stopping)
+		interrupted = 1;
 	shutdown = 1;
 }
 
+/*
+ * The histogram format the rt-tests plotting scripts read: one row per
+ * usec with a column per thread, then the summary lines.
+ */
+static void print_hist(struct thread_param *par, int nthreads)
+{
+	int i, j;
+	unsigned long k;
+
+	printf("# Histogram\n");
+	for (i = 0; i < histogram; i++) {
+		printf("%06d ", i);
+		for (j = 0; j < nthreads; j++) {
+			printf("%06lu", par[j].stats->hist[i]);
+			if (j < nthreads - 1)
+				printf("\t");
+		}
+		printf("\n");
+	}
+	printf("# Total:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %09lu", par[j].stats->cycles);
+	printf("\n");
+	printf("# Min Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->min);
+	printf("\n");
+	printf("# Avg Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->cycles ?
+		       (long)(par[j].stats->avg / par[j].stats->cycles) : 0);
+	printf("\n");
+	printf("# Max Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->max);
+	printf("\n");
+	printf("# Histogram Overflows:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05lu", par[j].stats->hist_overflow);
+	printf("\n");
+	printf("# Histogram Overflow at cycle number:\n");
+	for (j = 0; j < nthreads; j++) {
+		struct thread_stat *stat = par[j].stats;
+
+		printf("# Thread %d:", j);
+		for (k = 0; k < stat->hist_overflow && k < OFLOW_MAX; k++)
+			printf(" %05lu (%ld)", stat->overflows[k].cycle,
+			       stat->overflows[k].latency);
+		if (stat->hist_overflow > OFLOW_MAX)
+			printf(" # %05lu others", stat->hist_overflow - OFLOW_MAX);
+		printf("\n");
+	}
+	if (break_thread >= 0) {
+		printf("# Break thread: %d\n", break_thread);
+		printf("# Break value: %ld\n", break_value);
+	}
+}
+
+static void print_outliers(struct thread_param *par, int nthreads)
+{
+	int i;
+	unsigned long k;
+
+	printf("# Outliers over %d us:\n", outlier);
+	for (i = 0; i < nthreads; i++) {
+		struct thread_stat *stat = par[i].stats;
+
+		printf("# Thread %d", i);
+		if (par[i].cpu >= 0)
+			printf(" (cpu %d)", par[i].cpu);
+		printf(": %lu irq, %lu smi, %lu unexplained\n",
+		       stat->causes[CAUSE_IRQ], stat->causes[CAUSE_SMI],
+		       stat->causes[CAUSE_NONE]);
+		for (k = 0; k < stat->noutliers && k < OFLOW_MAX; k++) {
+			struct outlier *o = &stat->outliers[k];
+
+			printf("#   cycle %lu latency %ld: %s%s\n", o->cycle,
+			       o->latency, cause_names[o->cause], o->why);
+		}
+		if (stat->noutliers > OFLOW_MAX)
+			printf("#   %lu others\n", stat->noutliers - OFLOW_MAX);
+	}
+	if (!smi_available)
+		printf("# SMIs not counted, needs -S and a readable MSR_SMI_COUNT\n");
+}
+
+static void print_load_summary(void)
+{
+	int i;
+
+	printf("# Load summary, all threads, %d load threads:\n", load_threads);
+	printf("# %-10s %12s %8s %8s %8s\n", "Load", "Cycles", "Min", "Avg", "Max");
+	for (i = 0; i < nphases; i++) {
+		struct phase_stat *ps = &phase_stats[i];
+
+		if (!ps->cycles)
+			continue;
+		printf("# %-10s %12lu %8ld %8ld %8ld\n", phases[i]->name,
+		       ps->cycles, ps->min, (long)(ps->sum / ps->cycles),
+		       ps->max);
+	}
+}
+
 static void print_stat(struct thread_param *par, int index, int verbose)
 {
 	struct thread_stat *stat = par->stats;
@@ -516,6 +1288,104 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 	}
 }
 
+/* one run of the timer threads, under one load with -L */
+static int run_phase(struct thread_param *par, struct thread_stat *stat,
+		     int phase)
+{
+	pthread_t *workers = NULL;
+	int i;
+
+	if (nphases) {
+		printf("# Load: %s\n", phases[phase]->name);
+		fflush(stdout);
+		workers = start_load(phases[phase]);
+	}
+
+	shutdown = 0;
+	stopping = 0;
+	for (i = 0; i < num_threads; i++) {
+		stat[i].cycles = 0;
+		stat[i].cyclesread = 0;
+		stat[i].min = 1000000;
+		stat[i].max = -1000000;
+		stat[i].act = 0;
+		stat[i].avg = 0.0;
+		if (histogram) {
+			memset(stat[i].hist, 0, histogram * sizeof(unsigned long));
+			stat[i].hist_overflow = 0;
+		}
+		stat[i].noutliers = 0;
+		memset(stat[i].causes, 0, sizeof(stat[i].causes));
+		pthread_create(&stat[i].thread, NULL, timerthread, &par[i]);
+		stat[i].threadstarted = 1;
+	}
+
+	while (!shutdown) {
+		char lavg[256];
+		int fd, len, allstopped = 0;
+
+		if (!verbose && !quiet) {
+			fd = open("/proc/loadavg", O_RDONLY, 0666);
+			len = read(fd, &lavg, 255);
+			close(fd);
+			lavg[len-1] = 0x0;
+			printf("%s          \n\n", lavg);
+		}
+
+		for (i = 0; i < num_threads; i++) {
+
+			print_stat(&par[i], i, verbose);
+			if(max_cycles && stat[i].cycles >= max_cycles)
+				allstopped++;
+		}
+		usleep(10000);
+		if (shutdown || allstopped)
+			break;
+		if (!verbose && !quiet)
+			printf("\033[%dA", num_threads + 2);
+	}
+
+	stopping = 1;
+	shutdown = 1;
+	usleep(50000);
+	if (quiet)
+		quiet = 2;
+	for (i = 0; i < num_threads; i++) {
+		if (stat[i].threadstarted > 0)
+			pthread_kill(stat[i].thread, SIGTERM);
+		if (stat[i].threadstarted) {
+			pthread_join(stat[i].thread, NULL);
+			stat[i].threadstarted = 0;
+			if (quiet)
+				print_stat(&par[i], i, 0);
+		}
+	}
+	stop_load(workers);
+
+	if (nphases) {
+		struct phase_stat *ps = &phase_stats[phase];
+
+		ps->min = 1000000;
+		ps->max = -1000000;
+		for (i = 0; i < num_threads; i++) {
+			ps->cycles += stat[i].cycles;
+			ps->sum += stat[i].avg;
+			if (stat[i].cycles && stat[i].min < ps->min)
+				ps->min = stat[i].min;
+			if (stat[i].cycles && stat[i].max > ps->max)
+				ps->max = stat[i].max;
+		}
+	}
+	if (histogram)
+		print_hist(par, num_threads);
+	if (outlier)
+		print_outliers(par, num_threads);
+	if (quiet)
+		quiet = 1;
+
+	return interrupted || break_thread >= 0;
+}
+
 int main(int argc, char **argv)
 {
 	sigset_t sigset;
@@ -523,7 +1393,8 @@ int main(int argc, char **argv)
 	int mode;
 	struct thread_param *par;
 	struct thread_stat *stat;
-	int i, ret = -1;
+	cpu_set_t cpus;
+	int i, phase, cpu = -1, ret = -1;
 
 	if (geteuid()) {
 		fprintf(stderr, "cyclictest: need to run as root!\n");
@@ -532,8 +1403,6 @@ int main(int argc, char **argv)
 
 	process_options(argc, argv);
 
-	check_kernel();
-
 	if (check_timer())
 		fprintf(stderr, "WARNING: High resolution timers not available\n");
 
@@ -546,6 +1415,9 @@ int main(int argc, char **argv)
 	signal(SIGINT, sighand);
 	signal(SIGTERM, sighand);
 
+	if (tracelimit)
+		setup_tracing();
+
 	par = calloc(num_threads, sizeof(struct thread_param));
 	if (!par)
 		goto out;
@@ -553,16 +1425,41 @@ int main(int argc, char **argv)
 	if (!stat)
 		goto outpar;
 
+	/* with --smp thread i runs on the i-th allowed cpu */
+	if (smp)
+		sched_getaffinity(0, sizeof(cpus), &cpus);
+
 	for (i = 0; i < num_threads; i++) {
+		par[i].cpu = -1;
+		if (smp) {
+			for (cpu++; !CPU_ISSET(cpu, &cpus); cpu++)
+				;
+			par[i].cpu = cpu;
+		}
+		if (outlier) {
+			stat[i].noise = calloc(2, sizeof(struct noise));
+			stat[i].outliers = calloc(OFLOW_MAX, sizeof(struct outlier));
+			if (!stat[i].noise || !stat[i].outliers)
+				goto outall;
+			par[i].outlier = outlier;
+		}
 		if (verbose) {
 			stat[i].values = calloc(VALBUF_SIZE, sizeof(long));
 			if (!stat[i].values)
 				goto outall;
 			par[i].bufmsk = VALBUF_SIZE - 1;
 		}
+		if (histogram) {
+			stat[i].hist = calloc(histogram, sizeof(unsigned long));
+			stat[i].overflows = calloc(OFLOW_MAX, sizeof(struct overflow));
+			if (!stat[i].hist || !stat[i].overflows)
+				goto outall;
+			par[i].histogram = histogram;
+		}
+		par[i].index = i;
 
 		par[i].prio = priority;
-		if (priority)
+		if (priority && !smp)
 			priority--;
 		par[i].clock = clocksources[clocksel];
 		par[i].mode = mode;
@@ -572,60 +1469,28 @@ int main(int argc, char **argv)
 		interval += distance;
 		par[i].max_cycles = max_cycles;
 		par[i].stats = &stat[i];
-		stat[i].min = 1000000;
-		stat[i].max = -1000000;
-		stat[i].avg = 0.0;
-		pthread_create(&stat[i].thread, NULL, timerthread, &par[i]);
-		stat[i].threadstarted = 1;
 	}
 
-	while (!shutdown) {
-		char lavg[256];
-		int fd, len, allstopped = 0;
-
-		if (!verbose && !quiet) {
-			fd = open("/proc/loadavg", O_RDONLY, 0666);
-			len = read(fd, &lavg, 255);
-			close(fd);
-			lavg[len-1] = 0x0;
-			printf("%s          \n\n", lavg);
-		}
-
-		for (i = 0; i < num_threads; i++) {
-
-			print_stat(&par[i], i, verbose);
-			if(max_cycles && stat[i].cycles >= max_cycles)
-				allstopped++;
-		}
-		usleep(10000);
-		if (shutdown || allstopped)
+	for (phase = 0; phase < (nphases ? nphases : 1); phase++)
+		if (run_phase(par, stat, phase))
 			break;
-		if (!verbose && !quiet)
-			printf("\033[%dA", num_threads + 2);
-	}
+	if (nphases)
+		print_load_summary();
 	ret = 0;
  outall:
-	shutdown = 1;
-	usleep(50000);
-	if (quiet)
-		quiet = 2;
 	for (i = 0; i < num_threads; i++) {
-		if (stat[i].threadstarted > 0)
-			pthread_kill(stat[i].thread, SIGTERM);
-		if (stat[i].threadstarted) {
-			pthread_join(stat[i].thread, NULL);
-			if (quiet)
-				print_stat(&par[i], i, 0);
-		}
-		if (stat[i].values)
-			free(stat[i].values);
+		free(stat[i].values);
+		free(stat[i].hist);
+		free(stat[i].overflows);
+		free(stat[i].noise);
+		free(stat[i].outliers);
 	}
 	free(stat);
  outpar:
 	free(par);
  out:
 	/* Be a nice program, cleanup */
-	restorekernvars();
+	restoretracevars();
 
 	exit(ret);
 }
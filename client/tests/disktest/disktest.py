@@ -15,7 +15,7 @@ class disktest(test.test):
 
     @author: Martin Bligh (mbligh@google.com)
     """
-    version = 2
+    version = 5
     preserve_srcdir = True
 
     def setup(self):
@@ -43,14 +43,15 @@ class disktest(test.test):
         """
         logging.info("Testing %d MB files on %s in %d MB memory, chunk %s",
                      self.chunk_mb, disk, self.memory_mb, chunk)
-        cmd = ("%s/disktest -m %d -f %s/testfile.%d -i -S" %
-               (self.srcdir, self.chunk_mb, disk, chunk))
+        cmd = ("%s/disktest -m %d -f %s/testfile.%d -q %d -i -S" %
+               (self.srcdir, self.chunk_mb, disk, chunk, self.queue_depth))
         logging.debug("Running '%s'", cmd)
         p = subprocess.Popen(cmd, shell=True)
         return(p.pid)
 
 
-    def run_once(self, disks=None, gigabytes=None, chunk_mb=None):
+    def run_once(self, disks=None, gigabytes=None, chunk_mb=None,
+                 queue_depth=1):
         """
         Runs one iteration of disktest.
 
@@ -59,6 +60,8 @@ class disktest(test.test):
         @param gigabytes: Disk space that will be used for the test to run.
         @param chunk_mb: Size of the portion of the disk used to run the test.
                 Cannot be larger than the total amount of free RAM.
+        @param queue_depth: Blocks each disktest task keeps in flight. Values
+                above 1 use io_uring where the kernel supports it.
         """
         os.chdir(self.srcdir)
         if chunk_mb is None:
@@ -74,6 +77,7 @@ class disktest(test.test):
             sys.stdout.flush()
 
         self.chunk_mb = chunk_mb
+        self.queue_depth = queue_depth
         self.memory_mb = utils.memtotal()/1024
         if self.memory_mb > chunk_mb:
             raise error.TestError("Too much RAM (%dMB) for this test to work" %
@@ -16,14 +16,24 @@
 #include <errno.h>
 #include <malloc.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
-struct pattern {
-	unsigned int sector;
-	unsigned int signature;
-};
+#include "pattern.h"
 
-#define SECTOR_SIZE 512
-#define PATTERN_PER_SECTOR  (SECTOR_SIZE / sizeof(struct pattern))
+/*
+ * The async engine talks to io_uring through the raw syscalls so the static
+ * build doesn't need liburing. IORING_FEAT_RW_CUR_POS came in the same
+ * release as IORING_OP_READ and IORING_OP_WRITE.
+ */
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
 
 char *filename = "testfile";
 volatile int stop = 0;
@@ -40,6 +50,56 @@ unsigned int blocks;
 unsigned int sectors_per_block;
 unsigned int signature = 0;
 unsigned int stop_on_error = 0;
+unsigned int queue_depth = 1;
+char *badmap_name = NULL;
+int resume = 0;
+
+/*
+ * time(NULL) shows up in profiles when every block is a syscall away from
+ * the next one, so random tasks only look at the clock every few blocks
+ */
+#define TIME_CHECK_BLOCKS 64
+
+/*
+ * Per task io statistics. Every task is its own process, so one set of
+ * globals is enough; latency is in nsec with power of two buckets.
+ */
+#define LAT_BUCKETS 48
+struct io_stats {
+	unsigned long long start;
+	unsigned long long ios;
+	unsigned long long lat_total;
+	unsigned long long lat_min;
+	unsigned long long lat_max;
+	unsigned long long hist[LAT_BUCKETS];
+} stats;
+
+/*
+ * The bad sector map is a sidecar file: a header page describing the run
+ * and how far a -v verify has got, then one bit per sector of the test
+ * area. It is mapped shared before the tasks fork so they all mark the same
+ * map, and a crash leaves it behind in the page cache.
+ */
+#define BADMAP_MAGIC "DTBADMAP"
+#define BADMAP_VERSION 1
+#define BADMAP_HEADER 4096
+#define CHECKPOINT_SECONDS 10
+
+struct badmap_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int signature;
+	unsigned int blocksize;
+	unsigned int start_block;
+	unsigned int blocks;
+	unsigned int next_block;	/* blocks before this are verified */
+	unsigned long long bad_sectors;
+};
+
+struct badmap_header *badmap;
+unsigned long *badmap_bits;
+size_t badmap_size;
+time_t next_checkpoint;
 
 void die(char *error)
 {
@@ -47,56 +107,212 @@ void die(char *error)
 	exit(1);
 }
 
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.lat_min = ~0ULL;
+	stats.start = now_ns();
+}
+
+void stats_record(unsigned long long start)
+{
+	unsigned long long lat = now_ns() - start;
+	int bucket = lat ? 64 - __builtin_clzll(lat) : 0;
+
+	if (bucket >= LAT_BUCKETS)
+		bucket = LAT_BUCKETS - 1;
+	stats.hist[bucket]++;
+	stats.ios++;
+	stats.lat_total += lat;
+	if (lat < stats.lat_min)
+		stats.lat_min = lat;
+	if (lat > stats.lat_max)
+		stats.lat_max = lat;
+}
+
+/* upper bound of the bucket holding the given percentile, in usec */
+double stats_percentile(double pct)
+{
+	unsigned long long seen = 0, want = stats.ios * pct / 100;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += stats.hist[i];
+		if (seen > want)
+			break;
+	}
+	if (i == LAT_BUCKETS || (1ULL << i) > stats.lat_max)
+		return stats.lat_max / 1000.0;
+	return (double)(1ULL << i) / 1000;
+}
+
+void stats_print(char *name)
+{
+	double secs = (now_ns() - stats.start) / 1e9;
+
+	if (!stats.ios)
+		return;
+	printf("%s: %llu blocks in %.2f s, %.2f MB/s, latency usec "
+	       "min %.1f avg %.1f p50 <%.1f p99 <%.1f max %.1f (pid %d)\n",
+	       name, stats.ios, secs,
+	       stats.ios * (double)blocksize / (1024 * 1024) / secs,
+	       stats.lat_min / 1000.0, stats.lat_total / 1000.0 / stats.ios,
+	       stats_percentile(50), stats_percentile(99),
+	       stats.lat_max / 1000.0, getpid());
+	fflush(stdout);
+}
+
 /*
- * Fill a block with it's own sector number
- * buf must be at least blocksize
+ * Maps the sidecar file. With resume it must describe the same file and
+ * area as this run, and the verify carries on from its checkpoint.
  */
-void write_block(int fd, unsigned int block, struct pattern *buffer)
+void badmap_open(void)
 {
-	unsigned int i, sec_offset, sector;
-	off_t offset;
-	struct pattern *sector_buffer;
+	size_t sectors = (size_t)blocks * sectors_per_block;
+	struct stat stat_buf;
+	int fd;
 
-	for (sec_offset = 0; sec_offset < sectors_per_block; sec_offset++) {
-		sector = (block * sectors_per_block) + sec_offset;
-		sector_buffer = &buffer[sec_offset * PATTERN_PER_SECTOR];
+	if (!badmap_name) {
+		badmap_name = malloc(strlen(filename) + 8);
+		if (!badmap_name)
+			die("out of memory");
+		sprintf(badmap_name, "%s.badmap", filename);
+	}
+	badmap_size = BADMAP_HEADER + (sectors + 63) / 64 * 8;
 
-		for (i = 0; i < PATTERN_PER_SECTOR; i++) {
-			sector_buffer[i].sector = sector;
-			sector_buffer[i].signature = signature;
+	/* a resume only reads an existing map, it never leaves an empty one */
+	fd = open(badmap_name, resume ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		die("open of bad sector map failed");
+	if (resume && (fstat(fd, &stat_buf) != 0 || stat_buf.st_size != badmap_size)) {
+		fprintf(stderr, "%s does not match %s, can't resume\n",
+			badmap_name, filename);
+		exit(1);
+	}
+	if (ftruncate(fd, badmap_size) != 0)
+		die("ftruncate of bad sector map failed");
+	badmap = mmap(NULL, badmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (badmap == MAP_FAILED)
+		die("mmap of bad sector map failed");
+	close(fd);
+	badmap_bits = (unsigned long *)((char *)badmap + BADMAP_HEADER);
+
+	if (resume) {
+		if (memcmp(badmap->magic, BADMAP_MAGIC, 8) ||
+		    badmap->version != BADMAP_VERSION ||
+		    badmap->signature != signature ||
+		    badmap->blocksize != blocksize ||
+		    badmap->start_block != start_block ||
+		    badmap->blocks != blocks ||
+		    badmap->next_block < start_block ||
+		    badmap->next_block > start_block + blocks) {
+			fprintf(stderr, "%s does not match %s, can't resume\n",
+				badmap_name, filename);
+			exit(1);
 		}
+		return;
 	}
+	memcpy(badmap->magic, BADMAP_MAGIC, 8);
+	badmap->version = BADMAP_VERSION;
+	badmap->signature = signature;
+	badmap->blocksize = blocksize;
+	badmap->start_block = start_block;
+	badmap->blocks = blocks;
+	badmap->next_block = start_block;
+}
 
+/* shared between all the tasks, so the bits are set atomically */
+void mark_bad(unsigned int sector)
+{
+	size_t bit = sector - (size_t)start_block * sectors_per_block;
+	unsigned long mask = 1UL << (bit % (8 * sizeof(long)));
+	unsigned long old;
+
+	if (!badmap)
+		return;
+	old = __atomic_fetch_or(&badmap_bits[bit / (8 * sizeof(long))], mask,
+				__ATOMIC_RELAXED);
+	if (!(old & mask))
+		__atomic_fetch_add(&badmap->bad_sectors, 1, __ATOMIC_RELAXED);
+}
+
+/* records that every block before block has been verified by -v */
+void checkpoint(unsigned int block, int force)
+{
+	if (!badmap || !verify_only || (!force && time(NULL) < next_checkpoint))
+		return;
+	badmap->next_block = block;
+	msync(badmap, badmap_size, MS_SYNC);
+	next_checkpoint = time(NULL) + CHECKPOINT_SECONDS;
+}
+
+/* keeps the map if it found anything, otherwise there is nothing to keep */
+void badmap_close(void)
+{
+	if (!badmap)
+		return;
+	if (badmap->bad_sectors) {
+		msync(badmap, badmap_size, MS_SYNC);
+		printf("%llu bad sectors recorded in %s\n",
+		       badmap->bad_sectors, badmap_name);
+	} else {
+		unlink(badmap_name);
+	}
+	munmap(badmap, badmap_size);
+	badmap = NULL;
+}
+
+/*
+ * Fill a block with it's own sector number
+ * buf must be at least blocksize
+ */
+void fill_block(unsigned int block, struct pattern *buffer)
+{
+	pattern_fill(buffer, block * sectors_per_block, sectors_per_block,
+		     signature);
+}
+
+void write_block(int fd, unsigned int block, struct pattern *buffer)
+{
+	unsigned long long start;
+	off_t offset;
+
+	fill_block(block, buffer);
 	offset = block; offset *= blocksize;   // careful of overflow
+	start = now_ns();
 	lseek(fd, offset, SEEK_SET);
 	if (write(fd, buffer, blocksize) != blocksize) {
 		fprintf(stderr, "Write failed : file %s : block %d\n", filename, block);
 		exit(1);
 	}
+	stats_record(start);
 }
 
 /*
  * Verify a block contains the correct signature and sector numbers for
  * each sector within that block. We check every copy within the sector
- * and count how many were wrong.
+ * and count how many were wrong. Good blocks go through the vector compare,
+ * the copy by copy walk only starts at the first bad sector.
  * 
  * buf must be at least blocksize
  */
-int verify_block(int fd, unsigned int block, struct pattern *buffer, char *err)
+int check_block(unsigned int block, struct pattern *buffer, char *err)
 {
 	unsigned int sec_offset, sector;
-	off_t offset;
 	int i, errors = 0;
 	struct pattern *sector_buffer;
 
-	offset = block; offset *= blocksize;   // careful of overflow
-	lseek(fd, offset, SEEK_SET);
-	if (read(fd, buffer, blocksize) != blocksize) {
-		fprintf(stderr, "read failed: block %d (errno: %d) filename %s %s\n", block, errno, filename, err);
-		exit(1);
-	}
-
-	for (sec_offset = 0; sec_offset < sectors_per_block; sec_offset++) {
+	sec_offset = pattern_check(buffer, block * sectors_per_block,
+				   sectors_per_block, signature);
+	for (; sec_offset < sectors_per_block; sec_offset++) {
 		unsigned int read_sector = 0, read_signature = 0;
 		unsigned int sector_errors = 0, signature_errors = 0;
 
@@ -127,10 +343,296 @@ int verify_block(int fd, unsigned int block, struct pattern *buffer, char *err)
 				sector, read_signature, signature, 
 				signature_errors, PATTERN_PER_SECTOR, 
 				filename, err);
+		if (sector_errors || signature_errors)
+			mark_bad(sector);
+	}
+	return errors;
+}
 
+int verify_block(int fd, unsigned int block, struct pattern *buffer, char *err)
+{
+	unsigned long long start;
+	off_t offset;
+
+	offset = block; offset *= blocksize;   // careful of overflow
+	start = now_ns();
+	lseek(fd, offset, SEEK_SET);
+	if (read(fd, buffer, blocksize) != blocksize) {
+		fprintf(stderr, "read failed: block %d (errno: %d) filename %s %s\n", block, errno, filename, err);
+		exit(1);
+	}
+	stats_record(start);
+	return check_block(block, buffer, err);
+}
+
+int time_up(time_t end_time)
+{
+	static unsigned int count;
+
+	if (count++ % TIME_CHECK_BLOCKS)
+		return 0;
+	return time(NULL) >= end_time;
+}
+
+#ifdef HAVE_IO_URING
+/*
+ * One ring per task, sized to the queue depth. The completion ring is
+ * twice that, so it can't overflow while every slot is in flight.
+ */
+struct ring {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+/* each queue slot owns a buffer and remembers which block it holds */
+struct slot {
+	unsigned int block;
+	int busy;
+	unsigned long long start;
+	struct pattern *buffer;
+};
+
+int ring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+	       unsigned int flags)
+{
+	int ret = syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			  flags, NULL, 0);
+	return ret < 0 ? -errno : ret;
+}
+
+void ring_release(struct ring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/* returns 0, or -errno if the kernel can't give us a usable ring */
+int ring_setup(struct ring *ring, unsigned int entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+		return -errno;
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(ring->fd);
+		return -ENOSYS;
+	}
+
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+		die("mmap of io_uring sq ring failed");
+	ring->cq_ring = ring->sq_ring;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+			die("mmap of io_uring cq ring failed");
+	}
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		die("mmap of io_uring sqes failed");
+
+	sq = ring->sq_ring;
+	ring->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	cq = ring->cq_ring;
+	ring->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+/* queues one block, the kernel sees it on the next ring_enter */
+void ring_queue(struct ring *ring, int fd, int writing, struct slot *slot)
+{
+	unsigned int tail = *ring->sq_tail;
+	unsigned int idx = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = writing ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)slot->buffer;
+	sqe->len = blocksize;
+	sqe->off = slot->block; sqe->off *= blocksize;
+	sqe->user_data = (unsigned long)slot;
+	slot->busy = 1;
+	slot->start = now_ns();
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Keeps queue_depth blocks in flight on fd until the time is up, then
+ * drains. Linear passes always finish, same as the synchronous loops, so
+ * an end_time of 0 means exactly one pass, starting at block first. Blocks
+ * are filled before they are written and checked after they are read.
+ * Returns the number of bad blocks, stopping early on the first one with -S.
+ */
+unsigned int run_queue(int fd, int writing, int random_access,
+		       time_t end_time, unsigned int first, char *err)
+{
+	unsigned int align = (blocksize > 4096) ? blocksize : 4096;
+	unsigned int next = first, nr_free = 0, inflight = 0;
+	unsigned int pending, head, tail, i, errors = 0, reaped = 0;
+	struct slot *slots, **free_slots;
+	struct ring ring;
+	int ret, done = 0, wrapped = 0;
+
+	/* a resumed map can already be verified to the end */
+	if (first >= start_block + blocks)
+		return 0;
+	if ((ret = ring_setup(&ring, queue_depth)) < 0) {
+		fprintf(stderr, "io_uring_setup failed: %s\n", strerror(-ret));
+		exit(1);
 	}
+	slots = calloc(queue_depth, sizeof(*slots));
+	free_slots = calloc(queue_depth, sizeof(*free_slots));
+	if (!slots || !free_slots)
+		die("out of memory");
+	for (nr_free = 0; nr_free < queue_depth; nr_free++) {
+		slots[nr_free].buffer = memalign(align, blocksize);
+		if (!slots[nr_free].buffer)
+			die("out of memory");
+		free_slots[nr_free] = &slots[nr_free];
+	}
+
+	while (!done || inflight) {
+		pending = 0;
+		while (!done && nr_free) {
+			struct slot *slot = free_slots[--nr_free];
+
+			if (random_access) {
+				slot->block = start_block + (unsigned int)(random() % blocks);
+			} else {
+				slot->block = next++;
+				if (next == start_block + blocks) {
+					next = start_block;
+					wrapped = 1;
+					done = time(NULL) >= end_time;
+				}
+			}
+			if (writing)
+				fill_block(slot->block, slot->buffer);
+			ring_queue(&ring, fd, writing, slot);
+			pending++;
+			if (random_access && time_up(end_time))
+				done = 1;
+		}
+
+		/* submit the whole batch and wait for the first completion */
+		while (pending) {
+			ret = ring_enter(ring.fd, pending, 1, IORING_ENTER_GETEVENTS);
+			if (ret < 0 && ret != -EINTR) {
+				fprintf(stderr, "io_uring_enter failed: %s filename %s\n",
+					strerror(-ret), filename);
+				exit(1);
+			}
+			if (ret > 0) {
+				pending -= ret;
+				inflight += ret;
+			}
+		}
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			ret = ring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS);
+			if (ret < 0 && ret != -EINTR) {
+				fprintf(stderr, "io_uring_enter failed: %s filename %s\n",
+					strerror(-ret), filename);
+				exit(1);
+			}
+			continue;
+		}
+
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+			struct slot *slot = (struct slot *)(unsigned long)cqe->user_data;
+
+			if (cqe->res != blocksize) {
+				if (writing)
+					fprintf(stderr, "Write failed : file %s : block %d\n",
+						filename, slot->block);
+				else
+					fprintf(stderr, "read failed: block %d (errno: %d) filename %s %s\n",
+						slot->block, cqe->res < 0 ? -cqe->res : 0,
+						filename, err);
+				exit(1);
+			}
+			if (!writing && check_block(slot->block, slot->buffer, err)) {
+				errors++;
+				if (stop_on_error)
+					done = 1;
+			}
+			stats_record(slot->start);
+			slot->busy = 0;
+			free_slots[nr_free++] = slot;
+			inflight--;
+			reaped++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+		/*
+		 * a single linear verify pass is done up to its oldest io. next
+		 * wraps back to the start while the queue drains, so once it has
+		 * the pass is only bounded by the blocks still in flight.
+		 */
+		if (!writing && !end_time && reaped >= TIME_CHECK_BLOCKS) {
+			unsigned int done_to = wrapped ? start_block + blocks : next;
+
+			reaped = 0;
+			if (time(NULL) < next_checkpoint)
+				continue;
+			for (i = 0; i < queue_depth; i++)
+				if (slots[i].busy && slots[i].block < done_to)
+					done_to = slots[i].block;
+			checkpoint(done_to, 0);
+		}
+	}
+
+	for (nr_free = 0; nr_free < queue_depth; nr_free++)
+		free(slots[nr_free].buffer);
+	free(slots);
+	free(free_slots);
+	ring_release(&ring);
 	return errors;
 }
+#else
+unsigned int run_queue(int fd, int writing, int random_access,
+		       time_t end_time, unsigned int first, char *err)
+{
+	die("built without io_uring support");
+	return 0;
+}
+#endif
 
 void write_file(unsigned int end_time, int random_access)
 {
@@ -147,11 +649,18 @@ void write_file(unsigned int end_time, int random_access)
 		return;
 
 	fd = open(filename, O_RDWR, 0666);
+	if (random_access)
+		srandom(time(NULL) - getpid());
+	stats_reset();
+	if (queue_depth > 1) {
+		run_queue(fd, 1, random_access, end_time, start_block, NULL);
+		stats_print(random_access ? "write,random" : "write,linear");
+		exit(0);
+	}
 	buffer = malloc(blocksize);
 
 	if (random_access) {
-		srandom(time(NULL) - getpid());
-		while(time(NULL) < end_time) {
+		while(!time_up(end_time)) {
 			block = start_block + (unsigned int)(random() % blocks);
 			write_block(fd, block, buffer);
 		}
@@ -160,6 +669,7 @@ void write_file(unsigned int end_time, int random_access)
 			for (block = start_block; block < start_block + blocks; block++)
 				write_block(fd, block, buffer);
 	}
+	stats_print(random_access ? "write,random" : "write,linear");
 	free(buffer);
 	exit(0);
 }
@@ -195,18 +705,31 @@ void verify_file(unsigned int end_time, int random_access, int direct)
 	if (random_access) {
 		strcpy(err, ",random");
 		srandom(time(NULL) - getpid());
-		while(time(NULL) < end_time) {
+	} else {
+		strcpy(err, ",linear");
+	}
+	stats_reset();
+	if (queue_depth > 1) {
+		free(buffer);
+		error = run_queue(fd, 0, random_access, end_time, start_block,
+				  err_msg) != 0;
+		stats_print(err_msg);
+		exit(error);
+	}
+
+	if (random_access) {
+		while(!time_up(end_time)) {
 			block = start_block + (unsigned int)(random() % blocks);
 			if (verify_block(fd, block, buffer, err_msg))
 				error = 1;
 		}
 	} else {
-		strcpy(err, ",linear");
 		while(time(NULL) < end_time)
 			for (block = start_block; block < start_block + blocks; block++)
 				if (verify_block(fd, block, buffer, err_msg))
 					error = 1;
 	}
+	stats_print(err_msg);
 	free(buffer);
 	exit(error);
 }
@@ -221,22 +744,33 @@ void usage(void)
 	printf("    [-b blocksize]	 blocksize           (4096)\n");
 	printf("    [-l linear tasks]    linear access tasks (4)\n");
 	printf("    [-r random tasks]    random access tasks (4)\n");
+	printf("    [-q depth]           ios in flight per task (1)\n");
 	printf("    [-v]                 verify pre-existing file\n");
 	printf("    [-i]                 only do init phase\n");
 	printf("    [-S]                 stop immediately on error\n");
+	printf("    [-E mapfile]         bad sector map      (filename.badmap)\n");
+	printf("    [-R]                 resume a -v verify from its map\n");
 	printf("\n");
 }
 
-unsigned int double_verify(int fd, void *buffer, char *err)
+/*
+ * One linear verify pass from block first. The -v verify checkpoints its
+ * progress into the bad sector map as it goes.
+ */
+unsigned int double_verify(int fd, void *buffer, unsigned int first, char *err)
 {
 	unsigned int block, errors = 0;
 
-	for (block = start_block; block < start_block + blocks; block++) {
+	if (queue_depth > 1)
+		return run_queue(fd, 0, 0, 0, first, err);
+	for (block = first; block < start_block + blocks; block++) {
 		if (verify_block(fd, block, buffer, err)) {
 			if (stop_on_error)
 				return 1;
 			errors++;
 		}
+		if (!(block % TIME_CHECK_BLOCKS))
+			checkpoint(block, 0);
 	}
 	return errors;
 }
@@ -249,7 +783,7 @@ int main(int argc, char *argv[])
 	void *init_buffer;
 
 	/* Parse all input options */
-	while ((opt = getopt(argc, argv, "vf:s:m:M:b:l:r:iS")) != -1) {
+	while ((opt = getopt(argc, argv, "vf:s:m:M:b:l:r:q:iSE:R")) != -1) {
 		switch (opt) {
 			case 'v':
 				verify_only = 1;
@@ -275,12 +809,23 @@ int main(int argc, char *argv[])
 			case 'r':
 				random_tasks = atoi(optarg);
 				break;
+			case 'q':
+				queue_depth = atoi(optarg);
+				if (queue_depth < 1)
+					queue_depth = 1;
+				break;
 			case 'i':
 				init_only = 1;
 				break;
 			case 'S':
 				stop_on_error = 1;
 				break;
+			case 'E':
+				badmap_name = optarg;
+				break;
+			case 'R':
+				resume = 1;
+				break;
 			default:
 				usage();
 				exit(1);
@@ -294,6 +839,26 @@ int main(int argc, char *argv[])
 	start_block = skip_mb * (1024 * 1024 / blocksize);
 	sectors_per_block = blocksize / SECTOR_SIZE;
 	init_buffer = malloc(blocksize);
+	if (resume && !verify_only)
+		die("-R only resumes a -v verify");
+
+	if (queue_depth > 1) {
+#ifdef HAVE_IO_URING
+		struct ring ring;
+		int ret = ring_setup(&ring, queue_depth);
+
+		if (ret == 0) {
+			ring_release(&ring);
+		} else {
+			printf("io_uring unavailable (%s), using synchronous io\n",
+			       strerror(-ret));
+			queue_depth = 1;
+		}
+#else
+		printf("built without io_uring, using synchronous io\n");
+		queue_depth = 1;
+#endif
+	}
 
 	if (verify_only) {
 		struct stat stat_buf;
@@ -316,10 +881,22 @@ int main(int argc, char *argv[])
 
 		printf("Checking %d megabytes using signature %08x\n", 
 							megabytes, signature);
-		if (double_verify(fd, init_buffer, "init1"))
-			exit(1);
-		else
-			exit(0);
+		badmap_open();
+		block = start_block;
+		if (resume) {
+			block = badmap->next_block;
+			printf("Resuming at block %d, %llu bad sectors so far\n",
+			       block, badmap->bad_sectors);
+		}
+		next_checkpoint = time(NULL) + CHECKPOINT_SECONDS;
+		stats_reset();
+		retcode = double_verify(fd, init_buffer, block, "init1") != 0;
+		stats_print("verify");
+		if (!retcode || !stop_on_error)
+			checkpoint(start_block + blocks, 1);
+		retcode |= badmap->bad_sectors != 0;
+		badmap_close();
+		exit(retcode);
 	}
 
 	signature = (getpid() << 16) + ((unsigned int) time(NULL) & 0xffff);
@@ -332,24 +909,35 @@ int main(int argc, char *argv[])
 	start_time = time(NULL);
 
 	printf("Ininitializing block %d to %d in file %s (signature %08x)\n", start_block, start_block+blocks, filename, signature);
+	badmap_open();
 	/* Initialise all file data to correct blocks */
-	for (block = start_block; block < start_block+blocks; block++)
-		write_block(fd, block, init_buffer);
+	stats_reset();
+	if (queue_depth > 1)
+		run_queue(fd, 1, 0, 0, start_block, NULL);
+	else
+		for (block = start_block; block < start_block+blocks; block++)
+			write_block(fd, block, init_buffer);
 	if(fsync(fd) != 0)
 		die("fsync failed");
-	if (double_verify(fd, init_buffer, "init1")) {
+	stats_print("init write");
+	stats_reset();
+	if (double_verify(fd, init_buffer, start_block, "init1")) {
 		if (!stop_on_error) {
 			printf("First verify failed. Repeating for posterity\n");
-			double_verify(fd, init_buffer, "init2");
+			double_verify(fd, init_buffer, start_block, "init2");
 		}
+		badmap_close();
 		exit(1);
 	}
+	stats_print("init verify");
 
 	printf("Wrote %d MB to %s (%d seconds)\n", megabytes, filename, (int) (time(NULL) - start_time));
 
 	free(init_buffer);
-	if (init_only)
+	if (init_only) {
+		badmap_close();
 		exit(0);
+	}
 	
 	end_time = time(NULL) + seconds;
 
@@ -374,5 +962,6 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 	}
+	badmap_close();
 	return 0;
 }
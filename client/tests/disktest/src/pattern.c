@@ -0,0 +1,265 @@
+// Released under the GPL v2.
+//
+// Vector fill and compare for the disktest sector pattern. A sector is 64
+// {sector, signature} pairs, so a 16 byte register holds two of them and
+// the register for the next sector is this one plus {1, 0, 1, 0}.
+
+#include <string.h>
+
+#include "pattern.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_PATH 1
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_PATH 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_PATH 1
+#endif
+
+void pattern_fill_scalar(void *buf, unsigned int first_sector,
+			 unsigned int sectors, unsigned int signature)
+{
+	struct pattern *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++)
+		for (i = 0; i < PATTERN_PER_SECTOR; i++, p++) {
+			p->sector = first_sector + s;
+			p->signature = signature;
+		}
+}
+
+unsigned int pattern_check_scalar(const void *buf, unsigned int first_sector,
+				  unsigned int sectors, unsigned int signature)
+{
+	const struct pattern *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++)
+		for (i = 0; i < PATTERN_PER_SECTOR; i++, p++)
+			if (p->sector != first_sector + s ||
+			    p->signature != signature)
+				return s;
+	return sectors;
+}
+
+#ifdef HAVE_SSE2_PATH
+static void fill_sse2(void *buf, unsigned int first_sector,
+		      unsigned int sectors, unsigned int signature)
+{
+	__m128i v = _mm_set_epi32(signature, first_sector, signature, first_sector);
+	__m128i step = _mm_set_epi32(0, 1, 0, 1);
+	char *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE; i += 64) {
+			_mm_storeu_si128((__m128i *)(p + i), v);
+			_mm_storeu_si128((__m128i *)(p + i + 16), v);
+			_mm_storeu_si128((__m128i *)(p + i + 32), v);
+			_mm_storeu_si128((__m128i *)(p + i + 48), v);
+		}
+		p += SECTOR_SIZE;
+		v = _mm_add_epi32(v, step);
+	}
+}
+
+/* ors together the differences of every sector, the caller finds which */
+static int diff_sse2(const void *buf, unsigned int first_sector,
+		     unsigned int sectors, unsigned int signature)
+{
+	__m128i v = _mm_set_epi32(signature, first_sector, signature, first_sector);
+	__m128i step = _mm_set_epi32(0, 1, 0, 1);
+	__m128i acc = _mm_setzero_si128();
+	const char *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE; i += 64) {
+			acc = _mm_or_si128(acc, _mm_xor_si128(v,
+				_mm_loadu_si128((const __m128i *)(p + i))));
+			acc = _mm_or_si128(acc, _mm_xor_si128(v,
+				_mm_loadu_si128((const __m128i *)(p + i + 16))));
+			acc = _mm_or_si128(acc, _mm_xor_si128(v,
+				_mm_loadu_si128((const __m128i *)(p + i + 32))));
+			acc = _mm_or_si128(acc, _mm_xor_si128(v,
+				_mm_loadu_si128((const __m128i *)(p + i + 48))));
+		}
+		p += SECTOR_SIZE;
+		v = _mm_add_epi32(v, step);
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xffff;
+}
+#endif
+
+#ifdef HAVE_AVX2_PATH
+__attribute__((target("avx2")))
+static void fill_avx2(void *buf, unsigned int first_sector,
+		      unsigned int sectors, unsigned int signature)
+{
+	__m256i v = _mm256_set_epi32(signature, first_sector, signature, first_sector,
+				     signature, first_sector, signature, first_sector);
+	__m256i step = _mm256_set_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+	char *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE; i += 128) {
+			_mm256_storeu_si256((__m256i *)(p + i), v);
+			_mm256_storeu_si256((__m256i *)(p + i + 32), v);
+			_mm256_storeu_si256((__m256i *)(p + i + 64), v);
+			_mm256_storeu_si256((__m256i *)(p + i + 96), v);
+		}
+		p += SECTOR_SIZE;
+		v = _mm256_add_epi32(v, step);
+	}
+}
+
+__attribute__((target("avx2")))
+static int diff_avx2(const void *buf, unsigned int first_sector,
+		     unsigned int sectors, unsigned int signature)
+{
+	__m256i v = _mm256_set_epi32(signature, first_sector, signature, first_sector,
+				     signature, first_sector, signature, first_sector);
+	__m256i step = _mm256_set_epi32(0, 1, 0, 1, 0, 1, 0, 1);
+	__m256i acc = _mm256_setzero_si256();
+	const char *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE; i += 128) {
+			acc = _mm256_or_si256(acc, _mm256_xor_si256(v,
+				_mm256_loadu_si256((const __m256i *)(p + i))));
+			acc = _mm256_or_si256(acc, _mm256_xor_si256(v,
+				_mm256_loadu_si256((const __m256i *)(p + i + 32))));
+			acc = _mm256_or_si256(acc, _mm256_xor_si256(v,
+				_mm256_loadu_si256((const __m256i *)(p + i + 64))));
+			acc = _mm256_or_si256(acc, _mm256_xor_si256(v,
+				_mm256_loadu_si256((const __m256i *)(p + i + 96))));
+		}
+		p += SECTOR_SIZE;
+		v = _mm256_add_epi32(v, step);
+	}
+	return !_mm256_testz_si256(acc, acc);
+}
+#endif
+
+#ifdef HAVE_NEON_PATH
+static void fill_neon(void *buf, unsigned int first_sector,
+		      unsigned int sectors, unsigned int signature)
+{
+	const uint32_t init[4] = { first_sector, signature, first_sector, signature };
+	const uint32_t inc[4] = { 1, 0, 1, 0 };
+	uint32x4_t v = vld1q_u32(init), step = vld1q_u32(inc);
+	uint32_t *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE / 4; i += 16) {
+			vst1q_u32(p + i, v);
+			vst1q_u32(p + i + 4, v);
+			vst1q_u32(p + i + 8, v);
+			vst1q_u32(p + i + 12, v);
+		}
+		p += SECTOR_SIZE / 4;
+		v = vaddq_u32(v, step);
+	}
+}
+
+static int diff_neon(const void *buf, unsigned int first_sector,
+		     unsigned int sectors, unsigned int signature)
+{
+	const uint32_t init[4] = { first_sector, signature, first_sector, signature };
+	const uint32_t inc[4] = { 1, 0, 1, 0 };
+	uint32x4_t v = vld1q_u32(init), step = vld1q_u32(inc);
+	uint32x4_t acc = vdupq_n_u32(0);
+	const uint32_t *p = buf;
+	unsigned int s, i;
+
+	for (s = 0; s < sectors; s++) {
+		for (i = 0; i < SECTOR_SIZE / 4; i += 16) {
+			acc = vorrq_u32(acc, veorq_u32(v, vld1q_u32(p + i)));
+			acc = vorrq_u32(acc, veorq_u32(v, vld1q_u32(p + i + 4)));
+			acc = vorrq_u32(acc, veorq_u32(v, vld1q_u32(p + i + 8)));
+			acc = vorrq_u32(acc, veorq_u32(v, vld1q_u32(p + i + 12)));
+		}
+		p += SECTOR_SIZE / 4;
+		v = vaddq_u32(v, step);
+	}
+	return (vgetq_lane_u32(acc, 0) | vgetq_lane_u32(acc, 1) |
+		vgetq_lane_u32(acc, 2) | vgetq_lane_u32(acc, 3)) != 0;
+}
+#endif
+
+typedef void (*fill_fn)(void *, unsigned int, unsigned int, unsigned int);
+typedef int (*diff_fn)(const void *, unsigned int, unsigned int, unsigned int);
+
+static fill_fn fill_impl;
+static diff_fn diff_impl;
+static const char *impl_name;
+
+static void pattern_select(void)
+{
+	impl_name = "scalar";
+#ifdef HAVE_NEON_PATH
+	fill_impl = fill_neon;
+	diff_impl = diff_neon;
+	impl_name = "neon";
+#endif
+#ifdef HAVE_SSE2_PATH
+	fill_impl = fill_sse2;
+	diff_impl = diff_sse2;
+	impl_name = "sse2";
+#endif
+#ifdef HAVE_AVX2_PATH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		fill_impl = fill_avx2;
+		diff_impl = diff_avx2;
+		impl_name = "avx2";
+	}
+#endif
+}
+
+const char *pattern_impl(void)
+{
+	if (!impl_name)
+		pattern_select();
+	return impl_name;
+}
+
+void pattern_fill(void *buf, unsigned int first_sector, unsigned int sectors,
+		  unsigned int signature)
+{
+	if (!impl_name)
+		pattern_select();
+	if (fill_impl)
+		fill_impl(buf, first_sector, sectors, signature);
+	else
+		pattern_fill_scalar(buf, first_sector, sectors, signature);
+}
+
+unsigned int pattern_check(const void *buf, unsigned int first_sector,
+			   unsigned int sectors, unsigned int signature)
+{
+	unsigned int s;
+
+	if (!impl_name)
+		pattern_select();
+	if (!diff_impl)
+		return pattern_check_scalar(buf, first_sector, sectors, signature);
+	if (!diff_impl(buf, first_sector, sectors, signature))
+		return sectors;
+
+	/* slow path, something is wrong so go looking one sector at a time */
+	for (s = 0; s < sectors; s++)
+		if (diff_impl((const char *)buf + s * SECTOR_SIZE,
+			      first_sector + s, 1, signature))
+			return s;
+	return sectors;
+}
@@ -0,0 +1,42 @@
+// Released under the GPL v2.
+//
+// Sector pattern kernels for disktest. Every 512 byte sector is filled with
+// copies of its own sector number and the run's signature; these write and
+// check that pattern many sectors at a time.
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+struct pattern {
+	unsigned int sector;
+	unsigned int signature;
+};
+
+#define SECTOR_SIZE 512
+#define PATTERN_PER_SECTOR  (SECTOR_SIZE / sizeof(struct pattern))
+
+/*
+ * Fill sectors sectors of buf, numbering them from first_sector.
+ * Uses AVX2, SSE2 or NEON when the cpu has them.
+ */
+void pattern_fill(void *buf, unsigned int first_sector, unsigned int sectors,
+		  unsigned int signature);
+
+/*
+ * Returns the index of the first sector in buf that doesn't match the
+ * pattern, or sectors if they all do. The vector paths only look for the
+ * bad sector once the whole buffer has been found wanting.
+ */
+unsigned int pattern_check(const void *buf, unsigned int first_sector,
+			   unsigned int sectors, unsigned int signature);
+
+/* plain C versions, kept as the reference the vector code is tested against */
+void pattern_fill_scalar(void *buf, unsigned int first_sector,
+			 unsigned int sectors, unsigned int signature);
+unsigned int pattern_check_scalar(const void *buf, unsigned int first_sector,
+				  unsigned int sectors, unsigned int signature);
+
+/* name of the implementation pattern_fill and pattern_check use */
+const char *pattern_impl(void);
+
+#endif
@@ -0,0 +1,122 @@
+// Released under the GPL v2.
+//
+// Micro-benchmark for pattern.c: times the vector fill and check against
+// the scalar references on one core and checks that they agree, including
+// where they find a corrupted sector.
+//
+// Usage: patternbench [megabytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "pattern.h"
+
+#define BUFFER_SECTORS 2048		/* 1MB, stays in L2 on most parts */
+#define DEFAULT_MEGABYTES 4096
+#define SIGNATURE 0x5a5a1234
+
+double now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Each pass numbers the buffer from a different sector so the work can't
+ * be hoisted out of the loop.
+ */
+double bench_fill(void (*fill)(void *, unsigned int, unsigned int, unsigned int),
+		  void *buf, unsigned int passes)
+{
+	double start = now_seconds();
+	unsigned int i;
+
+	for (i = 0; i < passes; i++)
+		fill(buf, i * BUFFER_SECTORS, BUFFER_SECTORS, SIGNATURE);
+	return (double)passes * BUFFER_SECTORS * SECTOR_SIZE /
+	       (now_seconds() - start) / 1e9;
+}
+
+double bench_check(unsigned int (*check)(const void *, unsigned int,
+					 unsigned int, unsigned int),
+		   void *buf, unsigned int passes)
+{
+	double start = now_seconds();
+	unsigned int i, bad = 0;
+
+	for (i = 0; i < passes; i++)
+		bad += check(buf, 0, BUFFER_SECTORS, SIGNATURE) != BUFFER_SECTORS;
+	if (bad) {
+		fprintf(stderr, "Error: clean buffer failed to verify\n");
+		exit(1);
+	}
+	return (double)passes * BUFFER_SECTORS * SECTOR_SIZE /
+	       (now_seconds() - start) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int megabytes = DEFAULT_MEGABYTES, passes, corrupt;
+	char *simd, *scalar;
+
+	if (argc > 2 || (argc == 2 && (megabytes = atoi(argv[1])) == 0)) {
+		fprintf(stderr, "Usage: patternbench [megabytes]\n");
+		return 1;
+	}
+	/* each pass covers the 1MB buffer once */
+	passes = megabytes;
+
+	simd = memalign(4096, BUFFER_SECTORS * SECTOR_SIZE);
+	scalar = memalign(4096, BUFFER_SECTORS * SECTOR_SIZE);
+	if (!simd || !scalar) {
+		fprintf(stderr, "Error: out of memory\n");
+		return 1;
+	}
+
+	/* Correctness first, same bytes out and the same bad sector found */
+	pattern_fill(simd, 12345, BUFFER_SECTORS, SIGNATURE);
+	pattern_fill_scalar(scalar, 12345, BUFFER_SECTORS, SIGNATURE);
+	if (memcmp(simd, scalar, BUFFER_SECTORS * SECTOR_SIZE)) {
+		fprintf(stderr, "Error: %s fill differs from scalar\n",
+			pattern_impl());
+		return 1;
+	}
+	srandom(15);
+	for (corrupt = 0; corrupt < 1000; corrupt++) {
+		unsigned int byte = random() % (BUFFER_SECTORS * SECTOR_SIZE);
+		unsigned int found;
+
+		scalar[byte] ^= 1 << (random() % 8);
+		found = pattern_check(scalar, 12345, BUFFER_SECTORS, SIGNATURE);
+		if (found != byte / SECTOR_SIZE ||
+		    found != pattern_check_scalar(scalar, 12345,
+						  BUFFER_SECTORS, SIGNATURE)) {
+			fprintf(stderr, "Error: byte %u corrupted, %s check "
+				"found sector %u\n", byte, pattern_impl(), found);
+			return 1;
+		}
+		memcpy(scalar, simd, BUFFER_SECTORS * SECTOR_SIZE);
+	}
+	pattern_fill_scalar(scalar, 0, BUFFER_SECTORS, SIGNATURE);
+	pattern_fill(simd, 0, BUFFER_SECTORS, SIGNATURE);
+
+	printf("impl = %s\n", pattern_impl());
+	printf("fill_scalar_gbps = %.2f\n",
+	       bench_fill(pattern_fill_scalar, scalar, passes));
+	printf("fill_simd_gbps = %.2f\n", bench_fill(pattern_fill, simd, passes));
+	pattern_fill(simd, 0, BUFFER_SECTORS, SIGNATURE);
+	pattern_fill(scalar, 0, BUFFER_SECTORS, SIGNATURE);
+	printf("verify_scalar_gbps = %.2f\n",
+	       bench_check(pattern_check_scalar, scalar, passes));
+	printf("verify_simd_gbps = %.2f\n",
+	       bench_check(pattern_check, simd, passes));
+
+	free(simd);
+	free(scalar);
+	return 0;
+}
@@ -11,7 +11,7 @@ class hackbench(test.test):
     @author: Nikhil Rao (ncrao@google.com)
     @see: http://people.redhat.com/~mingo/cfs-scheduler/tools/hackbench.c
     """
-    version = 1
+    version = 4
     preserve_srcdir = True
 
 
@@ -29,15 +29,38 @@ class hackbench(test.test):
         self.results = None
 
 
-    def run_once(self, num_groups=90):
+    def run_once(self, num_groups=90, transport=None, latency=False,
+                 schedstat=False, placement=None, size=None, sweep=False):
         """
         Run hackbench, store the output in raw output files per iteration and
         also in the results list attribute.
 
         @param num_groups: Number of children processes hackbench will spawn.
+        @param transport: IPC transport (socket, pipe, futex, eventfd, uring
+                or splice), socket if not given.
+        @param latency: Report per-message latency percentiles.
+        @param schedstat: Report run and runqueue wait time per task.
+        @param placement: Pin tasks by cpu topology (core, smt, llc, socket
+                or random), left to the scheduler if not given.
+        @param size: Message size in bytes, 100 if not given.
+        @param sweep: Instead of one run, sweep 1, 2, 4 ... num_groups
+                groups over several message sizes and record the curve.
         """
         hackbench_bin = os.path.join(self.srcdir, 'hackbench')
-        cmd = '%s %s' % (hackbench_bin, num_groups)
+        cmd = hackbench_bin
+        if transport:
+            cmd += ' -transport %s' % transport
+        if latency:
+            cmd += ' -latency'
+        if schedstat:
+            cmd += ' -schedstat'
+        if placement:
+            cmd += ' -placement %s' % placement
+        if size:
+            cmd += ' -size %d' % size
+        if sweep:
+            cmd += ' -sweep'
+        cmd = '%s %s' % (cmd, num_groups)
         raw_output = utils.system_output(cmd, retain_output=True)
         self.results = raw_output
 
@@ -50,7 +73,25 @@ class hackbench(test.test):
         Pick up the results attribute and write it in the performance keyval.
         """
         lines = self.results.split('\n')
+        keyval = {}
         for line in lines:
             if line.startswith('Time:'):
-                time_val = line.split()[1]
-                self.write_perf_keyval({'time': time_val})
+                keyval['time'] = line.split()[1]
+            elif line.startswith('Latency (usec):'):
+                fields = line.split()
+                for name in ('p50', 'p99', 'p99.9', 'max'):
+                    value = fields[fields.index(name) + 1]
+                    keyval['latency_%s_usec' % name.replace('.', '_')] = value
+            elif line.startswith('Schedstat '):
+                side = line.split()[1]
+                fields = line.replace(',', '').split()
+                keyval['%s_run_ms' % side] = fields[fields.index('run') + 1]
+                keyval['%s_wait_ms' % side] = fields[fields.index('wait') + 1]
+            elif line and line.split()[0].isdigit():
+                # sweep row: groups tasks size time msgs/sec scaling
+                fields = line.split()
+                prefix = 'sweep_%sgroups_%sbytes' % (fields[0], fields[2])
+                keyval['%s_time' % prefix] = fields[3]
+                keyval['%s_msgs_per_sec' % prefix] = fields[4]
+                keyval['%s_scaling' % prefix] = fields[5]
+        self.write_perf_keyval(keyval)
@@ -3,7 +3,9 @@
  * This is the latest version of hackbench.c, that tests scheduler and
  * unix-socket (or pipe) performance.
  *
- * Usage: hackbench [-pipe] <num groups> [process|thread] [loops]
+ * Usage: hackbench [-pipe] [-transport name] [-latency] [-schedstat]
+ *                  [-placement policy] [-size bytes] [-sweep]
+ *                  <num groups> [process|thread] [loops]
  *
  * Build it with:
  *   gcc -g -Wall -O2 -o hackbench hackbench.c -lpthread
@@ -78,21 +80,46 @@ Thank Ingo for his great comments!
 #endif
 
 /* Test groups of 20 processes spraying to 20 receivers */
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
 #include <limits.h>
+#include <sched.h>
+#include <signal.h>
 
-#define DATASIZE 100
+/*
+ * io_uring is driven through the raw syscalls so hackbench still builds
+ * with nothing but libc and libpthread
+ */
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+/* message size, -size sets it; a message never spans a page */
+#define MAX_DATASIZE 4096
+static unsigned int datasize = 100;
 static unsigned int loops = 100;
+static unsigned int num_fds = 20;
 /*
  * 0 means thread mode and others mean process (default)
  */
@@ -100,8 +127,45 @@ static unsigned int process_mode = 1;
 
 static int use_pipes = 0;
 
+/* slots in each shared-memory ring, a power of two */
+#define RING_SLOTS 8
+
+/* the io_uring receiver reads up to this many messages at a time */
+#define RECV_BATCH 16
+
+/*
+ * One single-producer single-consumer ring for every sender/receiver pair
+ * in a group, so the group topology is the same as with sockets.
+ */
+struct ring {
+	unsigned int head __attribute__((aligned(64)));
+	unsigned int tail __attribute__((aligned(64)));
+	char slots[] __attribute__((aligned(64)));	/* RING_SLOTS * datasize */
+};
+
+/*
+ * Where a receiver waits for data and a sender waits for space. Only the
+ * owner ever sleeps on a bell, so a ring wakes at most one task.
+ */
+struct bell {
+	int seq;
+	int waiters;
+	int efd;
+} __attribute__((aligned(64)));
+
+/* lives in shared memory, so process mode children see the same rings */
+struct ring_group {
+	unsigned int num_fds;
+	size_t ring_size;
+	struct bell *rx_bells;
+	struct bell *tx_bells;
+	char *rings;			/* [sender * num_fds + receiver] */
+};
+
 struct sender_context {
 	unsigned int num_fds;
+	unsigned int id;
+	struct ring_group *rings;
 	int ready_out;
 	int wakefd;
 	int out_fds[0];
@@ -109,24 +173,366 @@ struct sender_context {
 
 struct receiver_context {
 	unsigned int num_packets;
+	unsigned int id;
+	struct ring_group *rings;
+	struct latency *lat;
 	int in_fds[2];
 	int ready_out;
 	int wakefd;
 };
 
+struct transport {
+	const char *name;
+	void *(*sender)(struct sender_context *ctx);
+	void *(*receiver)(struct receiver_context *ctx);
+	int rings;			/* shared-memory rings, not an fdpair */
+	int eventfd;			/* bells are eventfds, not futexes */
+};
+
+static struct transport *transport;
+
+/*
+ * -latency: senders stamp every message with CLOCK_MONOTONIC and each
+ * receiver keeps a log-linear histogram of the one-way delay in nsec.
+ * The histograms are in shared memory so process mode children can hand
+ * them back to be merged.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_MAX_BITS 40
+#define LAT_BUCKETS ((LAT_MAX_BITS - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+struct latency {
+	unsigned long long count;
+	unsigned long long max;
+	unsigned long long hist[LAT_BUCKETS];
+};
+
+/* -schedstat: time on cpu and waiting on a runqueue, summed per side */
+struct sched_totals {
+	unsigned long long run_ns;
+	unsigned long long wait_ns;
+	unsigned long long slices;
+	unsigned long long tasks;
+};
+
+/* wraps a sender or receiver so its schedstat can be sampled around it */
+struct worker {
+	void *(*func)(void *);
+	void *ctx;
+	int receiver;
+};
+
+static int measure_latency;
+static int measure_sched;
+static struct sched_totals *sched_totals;	/* senders, then receivers */
+
+/*
+ * -placement pins every task according to the sysfs cpu topology:
+ *   core	a whole group on one cpu
+ *   smt	a group's senders on one hardware thread, receivers on a sibling
+ *   llc	a group spread over the cpus sharing one last level cache
+ *   socket	a group's senders on one package, its receivers on the next
+ *   random	every task on a cpu of its own choosing
+ * Groups are dealt out round robin over the domains the policy uses.
+ */
+enum placement {
+	PLACE_NONE,
+	PLACE_CORE,
+	PLACE_SMT,
+	PLACE_LLC,
+	PLACE_SOCKET,
+	PLACE_RANDOM,
+};
+
+static const char *placement_names[] = {
+	"none", "core", "smt", "llc", "socket", "random",
+};
+
+static enum placement placement;
+
+struct topo_cpu {
+	int cpu;
+	int key;		/* which domain of the placement it is in */
+};
+
+struct domain {
+	unsigned int first;	/* into topo[] */
+	unsigned int count;
+};
+
+/* allowed cpus sorted by domain */
+static struct topo_cpu *topo;
+static unsigned int topo_cpus;
+static struct domain *domains;
+static unsigned int nr_domains;
+
+/* -sweep message sizes, 100 is what hackbench has always sent */
+static const unsigned int sweep_sizes[] = { 100, 512, 1024, 4096 };
+
+/* process mode workers forked by this process, empty in the workers */
+static pid_t *children;
+static unsigned int nr_children;
+
+/* don't leave the rest of a run blocked on a parent that has gone */
+static void kill_workers(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_children; i++)
+		kill(children[i], SIGKILL);
+	for (i = 0; i < nr_children; i++)
+		waitpid(children[i], NULL, 0);
+	nr_children = 0;
+}
 
 static void barf(const char *msg)
 {
 	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	kill_workers();
 	exit(1);
 }
 
 static void print_usage_exit()
 {
-	printf("Usage: hackbench [-pipe] <num groups> [process|thread] [loops]\n");
+	printf("Usage: hackbench [-pipe] [-transport socket|pipe|futex|eventfd|uring|splice]\n"
+	       "                 [-latency] [-schedstat]\n"
+	       "                 [-placement core|smt|llc|socket|random]\n"
+	       "                 [-size bytes] [-sweep] <num groups> [process|thread] [loops]\n");
 	exit(1);
 }
 
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* puts the send time at the front of a message */
+static void stamp(char *data)
+{
+	unsigned long long now;
+
+	if (!measure_latency)
+		return;
+	now = now_ns();
+	memcpy(data, &now, sizeof(now));
+}
+
+/* exact below 2^LAT_SUB_BITS nsec, then 2^LAT_SUB_BITS buckets per power of two */
+static unsigned int lat_bucket(unsigned long long v)
+{
+	unsigned int shift;
+
+	if (v < (1ULL << LAT_SUB_BITS))
+		return v;
+	if (v >= (1ULL << LAT_MAX_BITS))
+		v = (1ULL << LAT_MAX_BITS) - 1;
+	shift = 63 - __builtin_clzll(v) - LAT_SUB_BITS;
+	return ((shift + 1) << LAT_SUB_BITS) + (v >> shift) - (1 << LAT_SUB_BITS);
+}
+
+/* middle of a bucket */
+static unsigned long long lat_bucket_value(unsigned int b)
+{
+	unsigned int shift;
+
+	if (b < (1 << LAT_SUB_BITS))
+		return b;
+	shift = (b >> LAT_SUB_BITS) - 1;
+	return (((b & ((1 << LAT_SUB_BITS) - 1)) + (1ULL << LAT_SUB_BITS)) << shift) +
+	       ((1ULL << shift) >> 1);
+}
+
+/* one message arrived, only the receiver touches its histogram */
+static void record(struct receiver_context *ctx, const char *data)
+{
+	unsigned long long sent, now, lat;
+
+	if (!ctx->lat)
+		return;
+	now = now_ns();
+	memcpy(&sent, data, sizeof(sent));
+	lat = now > sent ? now - sent : 0;
+	ctx->lat->hist[lat_bucket(lat)]++;
+	ctx->lat->count++;
+	if (lat > ctx->lat->max)
+		ctx->lat->max = lat;
+}
+
+static double lat_percentile(struct latency *l, double pct)
+{
+	unsigned long long want = l->count * pct / 100, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += l->hist[b];
+		if (seen > want)
+			break;
+	}
+	if (b == LAT_BUCKETS || lat_bucket_value(b) > l->max)
+		return l->max / 1000.0;
+	return lat_bucket_value(b) / 1000.0;
+}
+
+/* cpu time, runqueue wait and timeslices of the calling task */
+static int read_schedstat(unsigned long long v[3])
+{
+	const char *path = process_mode ? "/proc/self/schedstat" :
+					  "/proc/thread-self/schedstat";
+	FILE *f = fopen(path, "r");
+	int ret;
+
+	if (!f)
+		return 0;
+	ret = fscanf(f, "%llu %llu %llu", &v[0], &v[1], &v[2]) == 3;
+	fclose(f);
+	return ret;
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct sched_totals *t = &sched_totals[w->receiver];
+	unsigned long long before[3], after[3];
+	int have = read_schedstat(before);
+
+	w->func(w->ctx);
+	if (have && read_schedstat(after)) {
+		__atomic_add_fetch(&t->run_ns, after[0] - before[0], __ATOMIC_RELAXED);
+		__atomic_add_fetch(&t->wait_ns, after[1] - before[1], __ATOMIC_RELAXED);
+		__atomic_add_fetch(&t->slices, after[2] - before[2], __ATOMIC_RELAXED);
+		__atomic_add_fetch(&t->tasks, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int read_topology(int cpu, const char *file, int *val)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	ret = fscanf(f, "%d", val) == 1;
+	fclose(f);
+	return ret;
+}
+
+/* the lowest cpu sharing the highest level cache, which names that cache */
+static int llc_id(int cpu)
+{
+	char file[64];
+	int i, level, first, best = -1, id = 0;
+
+	for (i = 0; ; i++) {
+		snprintf(file, sizeof(file), "cache/index%d/level", i);
+		if (!read_topology(cpu, file, &level))
+			break;
+		snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", i);
+		if (level >= best && read_topology(cpu, file, &first)) {
+			best = level;
+			id = first;
+		}
+	}
+	return id;
+}
+
+static int topo_key(int cpu)
+{
+	int core = 0, package = 0;
+
+	read_topology(cpu, "topology/physical_package_id", &package);
+	switch (placement) {
+	case PLACE_SMT:
+		read_topology(cpu, "topology/core_id", &core);
+		return package << 16 | core;
+	case PLACE_LLC:
+		return llc_id(cpu);
+	case PLACE_SOCKET:
+		return package;
+	default:
+		return cpu;
+	}
+}
+
+static int topo_cmp(const void *a, const void *b)
+{
+	const struct topo_cpu *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->cpu - y->cpu;
+}
+
+static void topology_init(void)
+{
+	cpu_set_t set;
+	unsigned int i, j;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		barf("sched_getaffinity");
+	topo = malloc(CPU_COUNT(&set) * sizeof(*topo));
+	domains = malloc(CPU_COUNT(&set) * sizeof(*domains));
+	if (!topo || !domains)
+		barf("malloc()");
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		topo[topo_cpus].cpu = cpu;
+		topo[topo_cpus].key = topo_key(cpu);
+		topo_cpus++;
+	}
+	qsort(topo, topo_cpus, sizeof(*topo), topo_cmp);
+
+	for (i = 0; i < topo_cpus; i = j) {
+		for (j = i; j < topo_cpus && topo[j].key == topo[i].key; j++)
+			;
+		/* a core without siblings is no use for smt */
+		if (placement == PLACE_SMT && j - i < 2)
+			continue;
+		domains[nr_domains].first = i;
+		domains[nr_domains].count = j - i;
+		nr_domains++;
+	}
+	if (!nr_domains || (placement == PLACE_SOCKET && nr_domains < 2)) {
+		fprintf(stderr, "Not enough %s domains for -placement %s\n",
+			placement_names[placement], placement_names[placement]);
+		exit(1);
+	}
+}
+
+/* index is the task's place among the group's senders or receivers */
+static int pick_cpu(unsigned int grp, int receiver, unsigned int index)
+{
+	struct domain *d;
+
+	if (placement == PLACE_NONE)
+		return -1;
+	d = &domains[grp % nr_domains];
+	switch (placement) {
+	case PLACE_NONE:
+		return -1;
+	case PLACE_CORE:
+		return topo[d->first].cpu;
+	case PLACE_SMT:
+		return topo[d->first + receiver].cpu;
+	case PLACE_LLC:
+		return topo[d->first + (2 * index + receiver) % d->count].cpu;
+	case PLACE_SOCKET:
+		d = &domains[(grp + receiver) % nr_domains];
+		return topo[d->first + index % d->count].cpu;
+	case PLACE_RANDOM:
+		return topo[rand() % topo_cpus].cpu;
+	}
+	return -1;
+}
+
 static void fdpair(int fds[2])
 {
 	if (use_pipes) {
@@ -157,7 +563,7 @@ static void ready(int ready_out, int wakefd)
 /* Sender sprays loops messages down each file descriptor */
 static void *sender(struct sender_context *ctx)
 {
-	char data[DATASIZE];
+	char data[MAX_DATASIZE];
 	unsigned int i, j;
 
 	ready(ctx->ready_out, ctx->wakefd);
@@ -167,12 +573,13 @@ static void *sender(struct sender_context *ctx)
 		for (j = 0; j < ctx->num_fds; j++) {
 			int ret, done = 0;
 
+			stamp(data);
 again:
-			ret = write(ctx->out_fds[j], data + done, sizeof(data)-done);
+			ret = write(ctx->out_fds[j], data + done, datasize-done);
 			if (ret < 0)
 				barf("SENDER: write");
 			done += ret;
-			if (done < sizeof(data))
+			if (done < datasize)
 				goto again;
 		}
 	}
@@ -194,37 +601,557 @@ static void *receiver(struct receiver_context* ctx)
 
 	/* Receive them all */
 	for (i = 0; i < ctx->num_packets; i++) {
-		char data[DATASIZE];
+		char data[MAX_DATASIZE];
 		int ret, done = 0;
 
 again:
-		ret = read(ctx->in_fds[0], data + done, DATASIZE - done);
+		ret = read(ctx->in_fds[0], data + done, datasize - done);
 		if (ret < 0)
 			barf("SERVER: read");
 		done += ret;
-		if (done < DATASIZE)
+		if (done < datasize)
 			goto again;
+		record(ctx, data);
+	}
+
+	return NULL;
+}
+
+/*
+ * Bells. A waiter snapshots seq and announces itself before its last look
+ * at the ring, and a ringer publishes before it looks for waiters, so a
+ * wakeup can't slip between the check and the sleep.
+ */
+static int bell_prepare(struct bell *b)
+{
+	int seq = __atomic_load_n(&b->seq, __ATOMIC_SEQ_CST);
+
+	__atomic_add_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+	return seq;
+}
+
+static void bell_cancel(struct bell *b)
+{
+	__atomic_sub_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+static void bell_sleep(struct bell *b, int seq)
+{
+	int op = FUTEX_WAIT | (process_mode ? 0 : FUTEX_PRIVATE_FLAG);
+	uint64_t count;
+
+	if (transport->eventfd) {
+		if (read(b->efd, &count, sizeof(count)) != sizeof(count))
+			barf("eventfd read");
+	} else if (syscall(SYS_futex, &b->seq, op, seq, NULL, NULL, 0) < 0 &&
+		   errno != EAGAIN && errno != EINTR) {
+		barf("futex wait");
+	}
+	bell_cancel(b);
+}
+
+static void bell_ring(struct bell *b)
+{
+	int op = FUTEX_WAKE | (process_mode ? 0 : FUTEX_PRIVATE_FLAG);
+	uint64_t one = 1;
+
+	if (!__atomic_load_n(&b->waiters, __ATOMIC_SEQ_CST))
+		return;
+	if (transport->eventfd) {
+		if (write(b->efd, &one, sizeof(one)) != sizeof(one))
+			barf("eventfd write");
+	} else {
+		__atomic_add_fetch(&b->seq, 1, __ATOMIC_SEQ_CST);
+		if (syscall(SYS_futex, &b->seq, op, 1, NULL, NULL, 0) < 0)
+			barf("futex wake");
+	}
+}
+
+static int ring_full(struct ring *ring)
+{
+	return ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+	       RING_SLOTS;
+}
+
+static int ring_empty(struct ring *ring)
+{
+	return ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static struct ring *ring_at(struct ring_group *g, unsigned int from,
+			    unsigned int to)
+{
+	return (struct ring *)(g->rings + (from * g->num_fds + to) * g->ring_size);
+}
+
+static void ring_send(struct ring_group *g, unsigned int from, unsigned int to,
+		      const char *data)
+{
+	struct ring *ring = ring_at(g, from, to);
+	struct bell *bell = &g->tx_bells[from];
+
+	while (ring_full(ring)) {
+		int seq = bell_prepare(bell);
+
+		if (!ring_full(ring)) {
+			bell_cancel(bell);
+			break;
+		}
+		bell_sleep(bell, seq);
+	}
+	memcpy(ring->slots + ring->tail % RING_SLOTS * datasize, data, datasize);
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+	bell_ring(&g->rx_bells[to]);
+}
+
+/* takes one message from the first non-empty ring at or after *from */
+static int ring_recv(struct ring_group *g, unsigned int to, unsigned int *from,
+		     char *data)
+{
+	unsigned int i, s;
+
+	for (i = 0; i < g->num_fds; i++) {
+		struct ring *ring;
+
+		s = (*from + i) % g->num_fds;
+		ring = ring_at(g, s, to);
+		if (ring_empty(ring))
+			continue;
+		memcpy(data, ring->slots + ring->head % RING_SLOTS * datasize, datasize);
+		__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+		bell_ring(&g->tx_bells[s]);
+		*from = s + 1;
+		return 1;
+	}
+	return 0;
+}
+
+static void *ring_sender(struct sender_context *ctx)
+{
+	char data[MAX_DATASIZE];
+	unsigned int i, j;
+
+	memset(data, 0, sizeof(data));
+	ready(ctx->ready_out, ctx->wakefd);
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			stamp(data);
+			ring_send(ctx->rings, ctx->id, j, data);
+		}
+	}
+
+	return NULL;
+}
+
+static void *ring_receiver(struct receiver_context *ctx)
+{
+	struct ring_group *g = ctx->rings;
+	struct bell *bell = &g->rx_bells[ctx->id];
+	unsigned int i, from = 0;
+	char data[MAX_DATASIZE];
+
+	ready(ctx->ready_out, ctx->wakefd);
+
+	for (i = 0; i < ctx->num_packets; i++) {
+		while (!ring_recv(g, ctx->id, &from, data)) {
+			int seq = bell_prepare(bell);
+
+			if (ring_recv(g, ctx->id, &from, data)) {
+				bell_cancel(bell);
+				break;
+			}
+			bell_sleep(bell, seq);
+		}
+		record(ctx, data);
+	}
+
+	return NULL;
+}
+
+static struct ring_group *ring_group_create(unsigned int num_fds)
+{
+	size_t bells = 2 * num_fds * sizeof(struct bell);
+	size_t ring_size = (sizeof(struct ring) + RING_SLOTS * datasize + 63) & ~63UL;
+	size_t size = sizeof(struct ring_group) + 64 + bells +
+		      num_fds * num_fds * ring_size;
+	struct ring_group *g;
+	unsigned int i;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		barf("mmap rings");
+	g = (struct ring_group *)p;
+	g->num_fds = num_fds;
+	g->ring_size = ring_size;
+	p += (sizeof(*g) + 63) & ~63UL;
+	g->rx_bells = (struct bell *)p;
+	g->tx_bells = g->rx_bells + num_fds;
+	g->rings = p + bells;
+
+	if (transport->eventfd)
+		for (i = 0; i < 2 * num_fds; i++)
+			if ((g->rx_bells[i].efd = eventfd(0, 0)) < 0)
+				barf("eventfd");
+	return g;
+}
+
+/*
+ * Pipes take a reference on vmspliced pages rather than copying them, so
+ * a buffer can't be reused until the reader has had it. A sender cycles
+ * through one more buffer per receiver than a pipe has slots. Buffers
+ * never straddle a page: that takes two pipe slots, and with many senders
+ * on one pipe the halves of different messages could interleave.
+ */
+static void *splice_sender(struct sender_context *ctx)
+{
+	unsigned int i, j, pool_size, per_page, next = 0;
+	int slots;
+	char *pool;
+
+	slots = fcntl(ctx->out_fds[0], F_GETPIPE_SZ);
+	if (slots < 0)
+		barf("F_GETPIPE_SZ");
+	pool_size = (slots / getpagesize() + 1) * ctx->num_fds;
+	per_page = getpagesize() / datasize;
+	pool = mmap(NULL, (pool_size + per_page - 1) / per_page * getpagesize(),
+		    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pool == MAP_FAILED)
+		barf("mmap()");
+
+	ready(ctx->ready_out, ctx->wakefd);
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			struct iovec iov;
+			int ret;
+
+			iov.iov_base = pool + next / per_page * getpagesize() +
+				       next % per_page * datasize;
+			iov.iov_len = datasize;
+			next = (next + 1) % pool_size;
+			stamp(iov.iov_base);
+			while (iov.iov_len) {
+				ret = vmsplice(ctx->out_fds[j], &iov, 1, 0);
+				if (ret < 0)
+					barf("SENDER: vmsplice");
+				iov.iov_base = (char *)iov.iov_base + ret;
+				iov.iov_len -= ret;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* vmsplice from the read side of a pipe copies out, like readv */
+static void *splice_receiver(struct receiver_context *ctx)
+{
+	unsigned int i;
+
+	if (process_mode)
+		close(ctx->in_fds[1]);
+
+	ready(ctx->ready_out, ctx->wakefd);
+
+	for (i = 0; i < ctx->num_packets; i++) {
+		char data[MAX_DATASIZE];
+		struct iovec iov = { data, datasize };
+		int ret;
+
+		while (iov.iov_len) {
+			ret = vmsplice(ctx->in_fds[0], &iov, 1, 0);
+			if (ret < 0)
+				barf("SERVER: vmsplice");
+			iov.iov_base = (char *)iov.iov_base + ret;
+			iov.iov_len -= ret;
+		}
+		record(ctx, data);
+	}
+
+	return NULL;
+}
+
+#ifdef HAVE_IO_URING
+struct uring {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/* returns 0 or why io_uring can't be used, before anything is forked */
+static int uring_probe(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, 1, &p);
+	if (fd < 0)
+		return errno;
+	close(fd);
+	return 0;
+}
+
+static void uring_setup(struct uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	size_t sq_size, cq_size;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0)
+		barf("io_uring_setup");
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+	sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		barf("mmap sq ring");
+	cq = sq;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			barf("mmap cq ring");
+	}
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		barf("mmap sqes");
+
+	u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+static void uring_queue(struct uring *u, int opcode, int fd, void *buf,
+			unsigned int len, unsigned long long user_data)
+{
+	unsigned int tail = *u->sq_tail;
+	unsigned int idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = -1;			/* current position, sockets and pipes */
+	sqe->user_data = user_data;
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* submits everything queued and waits for min_complete completions */
+static void uring_enter(struct uring *u, unsigned int to_submit,
+			unsigned int min_complete)
+{
+	int ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, u->fd, to_submit,
+			      min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret > 0)
+			to_submit -= ret;
+	} while ((ret < 0 && errno == EINTR) || (ret > 0 && to_submit));
+	if (ret < 0)
+		barf("io_uring_enter");
+}
+
+static int uring_reap(struct uring *u, unsigned long long *user_data)
+{
+	unsigned int head = *u->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return -EAGAIN - 4096;
+	cqe = &u->cqes[head & *u->cq_mask];
+	*user_data = cqe->user_data;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return cqe->res;
+}
+
+/*
+ * Each round's message to every receiver goes down in one submission;
+ * short writes are resubmitted for what is left.
+ */
+static void *uring_sender(struct sender_context *ctx)
+{
+	unsigned int i, j, pending;
+	unsigned int *done = calloc(ctx->num_fds, sizeof(unsigned int));
+	unsigned long long id;
+	char data[MAX_DATASIZE];
+	struct uring u;
+	int ret;
+
+	if (!done)
+		barf("malloc()");
+	memset(data, 0, sizeof(data));
+	uring_setup(&u, ctx->num_fds);
+	ready(ctx->ready_out, ctx->wakefd);
+
+	for (i = 0; i < loops; i++) {
+		stamp(data);
+		for (j = 0; j < ctx->num_fds; j++) {
+			done[j] = 0;
+			uring_queue(&u, IORING_OP_WRITE, ctx->out_fds[j], data,
+				    datasize, j);
+		}
+		uring_enter(&u, ctx->num_fds, 0);
+		pending = ctx->num_fds;
+		while (pending) {
+			while ((ret = uring_reap(&u, &id)) == -EAGAIN - 4096)
+				uring_enter(&u, 0, 1);
+			if (ret < 0) {
+				errno = -ret;
+				barf("SENDER: io_uring write");
+			}
+			done[id] += ret;
+			if (done[id] < datasize) {
+				uring_queue(&u, IORING_OP_WRITE,
+					    ctx->out_fds[id], data + done[id],
+					    datasize - done[id], id);
+				uring_enter(&u, 1, 0);
+			} else {
+				pending--;
+			}
+		}
 	}
 
+	free(done);
 	return NULL;
 }
 
-pthread_t create_worker(void *ctx, void *(*func)(void *))
+/*
+ * receives in batches, counting bytes until every message is in. With
+ * -latency the stream is cut back into messages to find the stamps.
+ */
+static void *uring_receiver(struct receiver_context *ctx)
+{
+	unsigned long long total = 0, want;
+	unsigned long long id;
+	unsigned int batch = datasize * RECV_BATCH;
+	char *data = malloc(batch + datasize);
+	char *msg = data + batch;
+	unsigned int have = 0;
+	struct uring u;
+	int ret;
+
+	if (!data)
+		barf("malloc()");
+	if (process_mode)
+		close(ctx->in_fds[1]);
+
+	uring_setup(&u, 1);
+	ready(ctx->ready_out, ctx->wakefd);
+
+	want = (unsigned long long)ctx->num_packets * datasize;
+	while (total < want) {
+		unsigned long long left = want - total;
+
+		uring_queue(&u, IORING_OP_READ, ctx->in_fds[0], data,
+			    left < batch ? left : batch, 0);
+		uring_enter(&u, 1, 1);
+		ret = uring_reap(&u, &id);
+		if (ret < 0) {
+			errno = -ret;
+			barf("SERVER: io_uring read");
+		}
+		total += ret;
+		if (ctx->lat) {
+			char *p = data;
+
+			while (ret) {
+				unsigned int n = datasize - have;
+
+				if (n > ret)
+					n = ret;
+				memcpy(msg + have, p, n);
+				have += n;
+				p += n;
+				ret -= n;
+				if (have == datasize) {
+					record(ctx, msg);
+					have = 0;
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+static struct transport transports[] = {
+	{ "socket", sender, receiver, 0, 0 },
+	{ "pipe", sender, receiver, 0, 0 },
+	{ "futex", ring_sender, ring_receiver, 1, 0 },
+	{ "eventfd", ring_sender, ring_receiver, 1, 1 },
+#ifdef HAVE_IO_URING
+	{ "uring", uring_sender, uring_receiver, 0, 0 },
+#endif
+	{ "splice", splice_sender, splice_receiver, 0, 0 },
+};
+
+pthread_t create_worker(void *ctx, void *(*func)(void *), int cpu)
 {
 	pthread_attr_t attr;
 	pthread_t childid;
+	cpu_set_t set;
+	pid_t pid;
 	int err;
 
+	CPU_ZERO(&set);
+	if (cpu >= 0)
+		CPU_SET(cpu, &set);
+
+	if (measure_sched) {
+		struct worker *w = malloc(sizeof(*w));
+
+		if (!w)
+			barf("malloc()");
+		w->func = func;
+		w->ctx = ctx;
+		w->receiver = func == (void *)transport->receiver;
+		ctx = w;
+		func = run_worker;
+	}
+
 	if (process_mode) {
 		/* process mode */
 		/* Fork the receiver. */
-		switch (fork()) {
+		switch ((pid = fork())) {
 			case -1: barf("fork()");
 			case 0:
+				nr_children = 0;
+				if (cpu >= 0 && sched_setaffinity(0, sizeof(set), &set))
+					barf("sched_setaffinity");
 				(*func) (ctx);
 				exit(0);
 		}
 
+		children[nr_children++] = pid;
 		return (pthread_t) 0;
 	}
 
@@ -232,9 +1159,11 @@ pthread_t create_worker(void *ctx, void *(*func)(void *))
 		barf("pthread_attr_init:");
 
 #ifndef __ia64__
-	if (pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN) != 0)
+	if (pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + MAX_DATASIZE) != 0)
 		barf("pthread_attr_setstacksize");
 #endif
+	if (cpu >= 0 && pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0)
+		barf("pthread_attr_setaffinity_np");
 
 	if ((err=pthread_create(&childid, &attr, func, ctx)) != 0) {
 		fprintf(stderr, "pthread_create failed: %s (%d)\n", strerror(err), err);
@@ -245,13 +1174,20 @@ pthread_t create_worker(void *ctx, void *(*func)(void *))
 
 void reap_worker(pthread_t id)
 {
+	unsigned int i;
 	int status;
+	pid_t pid;
 
 	if (process_mode) {
 		/* process mode */
-		wait(&status);
-		if (!WIFEXITED(status))
+		pid = wait(&status);
+		for (i = 0; i < nr_children; i++)
+			if (children[i] == pid)
+				children[i] = children[--nr_children];
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			kill_workers();
 			exit(1);
+		}
 	} else {
 		void *status;
 
@@ -261,16 +1197,23 @@ void reap_worker(pthread_t id)
 
 /* One group of senders and receivers */
 static unsigned int group(pthread_t *pth,
-		unsigned int num_fds,
+		unsigned int grp,
 		int ready_out,
-		int wakefd)
+		int wakefd,
+		struct latency *lat)
 {
 	unsigned int i;
-	struct sender_context* snd_ctx = malloc (sizeof(struct sender_context)
-			+num_fds*sizeof(int));
+	struct ring_group *rings = NULL;
+	size_t snd_size = sizeof(struct sender_context) + num_fds*sizeof(int);
+	struct sender_context* snd_ctx = malloc (snd_size);
+
+	if (!snd_ctx)
+		barf("malloc()");
+	if (transport->rings)
+		rings = ring_group_create(num_fds);
 
 	for (i = 0; i < num_fds; i++) {
-		int fds[2];
+		int fds[2] = { -1, -1 };
 		struct receiver_context* ctx = malloc (sizeof(*ctx));
 
 		if (!ctx)
@@ -278,90 +1221,110 @@ static unsigned int group(pthread_t *pth,
 
 
 		/* Create the pipe between client and server */
-		fdpair(fds);
+		if (!transport->rings)
+			fdpair(fds);
 
 		ctx->num_packets = num_fds*loops;
+		ctx->id = i;
+		ctx->rings = rings;
+		ctx->lat = lat ? &lat[i] : NULL;
 		ctx->in_fds[0] = fds[0];
 		ctx->in_fds[1] = fds[1];
 		ctx->ready_out = ready_out;
 		ctx->wakefd = wakefd;
 
-		pth[i] = create_worker(ctx, (void *)(void *)receiver);
+		pth[i] = create_worker(ctx, (void *)(void *)transport->receiver,
+				       pick_cpu(grp, 1, i));
 
 		snd_ctx->out_fds[i] = fds[1];
-		if (process_mode)
+		if (process_mode && !transport->rings)
 			close(fds[0]);
 	}
 
-	/* Now we have all the fds, fork the senders */
+	/*
+	 * Now we have all the fds, fork the senders. Each gets its own
+	 * context since the rings need to know which sender is which.
+	 */
+	snd_ctx->ready_out = ready_out;
+	snd_ctx->wakefd = wakefd;
+	snd_ctx->num_fds = num_fds;
+	snd_ctx->rings = rings;
 	for (i = 0; i < num_fds; i++) {
-		snd_ctx->ready_out = ready_out;
-		snd_ctx->wakefd = wakefd;
-		snd_ctx->num_fds = num_fds;
+		struct sender_context *ctx = malloc (snd_size);
 
-		pth[num_fds+i] = create_worker(snd_ctx, (void *)(void *)sender);
+		if (!ctx)
+			barf("malloc()");
+		memcpy(ctx, snd_ctx, snd_size);
+		ctx->id = i;
+
+		pth[num_fds+i] = create_worker(ctx, (void *)(void *)transport->sender,
+					       pick_cpu(grp, 0, i));
 	}
 
 	/* Close the fds we have left */
-	if (process_mode)
+	if (process_mode && !transport->rings)
 		for (i = 0; i < num_fds; i++)
 			close(snd_ctx->out_fds[i]);
+	else if (process_mode && transport->eventfd)
+		for (i = 0; i < 2 * num_fds; i++)
+			close(rings->rx_bells[i].efd);
 
 	/* Return number of children to reap */
 	return num_fds * 2;
 }
 
-int main(int argc, char *argv[])
+/* one timed run, prints the results unless quiet and returns seconds taken */
+static double run(unsigned int num_groups, int quiet)
 {
-	unsigned int i, num_groups = 10, total_children;
+	unsigned int i, total_children;
 	struct timeval start, stop, diff;
-	unsigned int num_fds = 20;
 	int readyfds[2], wakefds[2];
 	char dummy;
 	pthread_t *pth_tab;
-
-	if (argv[1] && strcmp(argv[1], "-pipe") == 0) {
-		use_pipes = 1;
-		argc--;
-		argv++;
-	}
-
-	if (argc >= 2 && (num_groups = atoi(argv[1])) == 0)
-		print_usage_exit();
-
-	printf("Running with %d*40 (== %d) tasks.\n",
-		num_groups, num_groups*40);
-
-	fflush(NULL);
-
-	if (argc > 2) {
-		if ( !strcmp(argv[2], "process") )
-			process_mode = 1;
-		else if ( !strcmp(argv[2], "thread") )
-			process_mode = 0;
-		else
-			print_usage_exit();
-	}
-
-	if (argc > 3)
-		loops = atoi(argv[3]);
+	struct latency *lat = NULL;
 
 	pth_tab = malloc(num_fds * 2 * num_groups * sizeof(pthread_t));
 
 	if (!pth_tab)
 		barf("main:malloc()");
+	if (process_mode) {
+		children = malloc(num_fds * 2 * num_groups * sizeof(pid_t));
+		if (!children)
+			barf("main:malloc()");
+	}
 
 	fdpair(readyfds);
 	fdpair(wakefds);
 
+	if (measure_latency) {
+		lat = mmap(NULL, num_groups * num_fds * sizeof(*lat),
+			   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (lat == MAP_FAILED)
+			barf("mmap latency");
+	}
+	if (measure_sched)
+		memset(sched_totals, 0, 2 * sizeof(*sched_totals));
+
 	total_children = 0;
 	for (i = 0; i < num_groups; i++)
-		total_children += group(pth_tab+total_children, num_fds, readyfds[1], wakefds[0]);
+		total_children += group(pth_tab+total_children, i, readyfds[1], wakefds[0],
+					lat ? lat + i * num_fds : NULL);
+	/* so a worker that dies before it is ready ends the wait below */
+	if (process_mode)
+		close(readyfds[1]);
 
 	/* Wait for everyone to be ready */
-	for (i = 0; i < total_children; i++)
-		if (read(readyfds[0], &dummy, 1) != 1)
+	for (i = 0; i < total_children; i++) {
+		ssize_t ret = read(readyfds[0], &dummy, 1);
+
+		if (ret == 0) {
+			fprintf(stderr, "a worker exited before it was ready\n");
+			kill_workers();
+			exit(1);
+		}
+		if (ret != 1)
 			barf("Reading for readyfds");
+	}
 
 	gettimeofday(&start, NULL);
 
@@ -372,13 +1335,214 @@ int main(int argc, char *argv[])
 	/* Reap them all */
 	for (i = 0; i < total_children; i++)
 		reap_worker(pth_tab[i]);
+	nr_children = 0;
+	free(children);
+	children = NULL;
 
 	gettimeofday(&stop, NULL);
 
 	/* Print time... */
 	timersub(&stop, &start, &diff);
-	printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
-	exit(0);
+	if (!quiet)
+		printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
+
+	if (lat) {
+		struct latency all;
+		unsigned int b;
+
+		memset(&all, 0, sizeof(all));
+		for (i = 0; i < num_groups * num_fds; i++) {
+			for (b = 0; b < LAT_BUCKETS; b++)
+				all.hist[b] += lat[i].hist[b];
+			all.count += lat[i].count;
+			if (lat[i].max > all.max)
+				all.max = lat[i].max;
+		}
+		printf("Latency (usec): p50 %.1f p99 %.1f p99.9 %.1f max %.1f (%llu messages)\n",
+		       lat_percentile(&all, 50), lat_percentile(&all, 99),
+		       lat_percentile(&all, 99.9), all.max / 1000.0, all.count);
+	}
+	if (measure_sched) {
+		const char *side[2] = { "senders", "receivers" };
+
+		for (i = 0; i < 2; i++) {
+			struct sched_totals *t = &sched_totals[i];
+
+			if (!t->tasks)
+				continue;
+			printf("Schedstat %s (per task): run %.3f ms, runqueue wait %.3f ms, %llu timeslices\n",
+			       side[i], t->run_ns / 1e6 / t->tasks,
+			       t->wait_ns / 1e6 / t->tasks, t->slices / t->tasks);
+		}
+	}
+	return diff.tv_sec + diff.tv_usec / 1e6;
 }
 
+/*
+ * Runs every message size at 1, 2, 4 ... num_groups groups, each point in
+ * a child of its own so the rings and fds of one can't skew the next, and
+ * prints throughput against the single group run of the same size.
+ */
+static void sweep(unsigned int num_groups)
+{
+	unsigned int s, groups;
+
+	printf("Sweep: %s transport, %s mode, placement %s, %u loops\n",
+	       transport->name, process_mode ? "process" : "thread",
+	       placement_names[placement], loops);
+	printf("%8s %8s %8s %10s %12s %8s\n",
+	       "groups", "tasks", "size", "time", "msgs/sec", "scaling");
+	for (s = 0; s < sizeof(sweep_sizes) / sizeof(sweep_sizes[0]); s++) {
+		double base = 0;
+
+		for (groups = 1; groups <= num_groups;
+		     groups = groups < num_groups && groups * 2 > num_groups ?
+			      num_groups : groups * 2) {
+			double secs, rate;
+			int fds[2], status;
+
+			if (pipe(fds) < 0)
+				barf("pipe");
+			fflush(NULL);
+			switch (fork()) {
+			case -1:
+				barf("fork()");
+			case 0:
+				datasize = sweep_sizes[s];
+				secs = run(groups, 1);
+				if (write(fds[1], &secs, sizeof(secs)) != sizeof(secs))
+					barf("write sweep result");
+				exit(0);
+			}
+			close(fds[1]);
+			if (read(fds[0], &secs, sizeof(secs)) != sizeof(secs))
+				exit(1);
+			close(fds[0]);
+			wait(&status);
+
+			rate = (double)groups * num_fds * num_fds * loops / secs;
+			if (!base)
+				base = rate;
+			printf("%8u %8u %8u %10.3f %12.0f %8.2f\n",
+			       groups, groups * num_fds * 2, sweep_sizes[s],
+			       secs, rate, rate / base);
+			fflush(NULL);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, num_groups = 10;
+	int do_sweep = 0;
+
+	transport = &transports[0];
+	while (argv[1] && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-pipe") == 0) {
+			use_pipes = 1;
+			if (transport == &transports[0])
+				transport = &transports[1];
+		} else if (strcmp(argv[1], "-transport") == 0 && argv[2]) {
+			for (i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+				if (strcmp(argv[2], transports[i].name) == 0)
+					break;
+			if (i == sizeof(transports) / sizeof(transports[0]))
+				print_usage_exit();
+			transport = &transports[i];
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-latency") == 0) {
+			measure_latency = 1;
+		} else if (strcmp(argv[1], "-schedstat") == 0) {
+			measure_sched = 1;
+		} else if (strcmp(argv[1], "-placement") == 0 && argv[2]) {
+			for (i = 1; i < sizeof(placement_names) / sizeof(placement_names[0]); i++)
+				if (strcmp(argv[2], placement_names[i]) == 0)
+					break;
+			if (i == sizeof(placement_names) / sizeof(placement_names[0]))
+				print_usage_exit();
+			placement = i;
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-size") == 0 && argv[2]) {
+			datasize = atoi(argv[2]);
+			/* room for a latency stamp, and no more than a page */
+			if (datasize < sizeof(unsigned long long) ||
+			    datasize > MAX_DATASIZE || datasize > getpagesize())
+				print_usage_exit();
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-sweep") == 0) {
+			do_sweep = 1;
+		} else {
+			print_usage_exit();
+		}
+		argc--;
+		argv++;
+	}
+#ifdef HAVE_IO_URING
+	if (transport->sender == uring_sender && (i = uring_probe())) {
+		fprintf(stderr, "io_uring unavailable: %s\n", strerror(i));
+		exit(1);
+	}
+#endif
+	/* splice needs pipes, and -transport pipe is -pipe spelt out */
+	if (transport == &transports[1] ||
+	    transport->sender == splice_sender)
+		use_pipes = 1;
+
+	if (argc >= 2 && (num_groups = atoi(argv[1])) == 0)
+		print_usage_exit();
+
+	if (argc > 2) {
+		if ( !strcmp(argv[2], "process") )
+			process_mode = 1;
+		else if ( !strcmp(argv[2], "thread") )
+			process_mode = 0;
+		else
+			print_usage_exit();
+	}
+
+	if (argc > 3)
+		loops = atoi(argv[3]);
+
+	if (placement != PLACE_NONE) {
+		topology_init();
+		srand(getpid());
+	}
+	if (measure_sched) {
+		unsigned long long v[3];
+
+		if (!read_schedstat(v)) {
+			printf("No schedstat on this kernel, -schedstat ignored\n");
+			measure_sched = 0;
+		}
+		sched_totals = mmap(NULL, 2 * sizeof(*sched_totals),
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (sched_totals == MAP_FAILED)
+			barf("mmap schedstat");
+	}
+
+	if (do_sweep) {
+		sweep(num_groups);
+		exit(0);
+	}
 
+	printf("Running with %d*40 (== %d) tasks.\n",
+		num_groups, num_groups*40);
+	if (transport != &transports[0] && transport != &transports[1])
+		printf("Transport: %s%s\n", transport->name,
+		       transport->rings ? "" : use_pipes ? " over pipes" :
+						      " over sockets");
+	if (placement != PLACE_NONE)
+		printf("Placement: %s over %u domains\n",
+		       placement_names[placement], nr_domains);
+	if (datasize != 100)
+		printf("Message size: %u\n", datasize);
+
+	fflush(NULL);
+
+	run(num_groups, 0);
+	exit(0);
+}
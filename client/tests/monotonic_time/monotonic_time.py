@@ -3,7 +3,7 @@ from autotest_lib.client.bin import test, utils
 from autotest_lib.client.common_lib import error
 
 class monotonic_time(test.test):
-    version = 1
+    version = 3
 
     preserve_srcdir = True
 
@@ -16,19 +16,36 @@ class monotonic_time(test.test):
         self.job.require_gcc()
 
 
-    def run_once(self, test_type = None, duration = 300, threshold = None):
-        if not test_type:
+    def run_once(self, test_type = None, duration = 300, threshold = None,
+                 mode = None, bench = False):
+        if not test_type and not bench:
             raise error.TestError('missing test type')
 
         cmd = self.srcdir + '/time_test'
         cmd += ' --duration ' + str(duration)
         if threshold:
             cmd += ' --threshold ' + str(threshold)
-        cmd += ' ' + test_type
+        if mode:
+            cmd += ' --mode ' + mode
+        if bench:
+            cmd += ' --bench'
+        if test_type:
+            cmd += ' ' + test_type
 
         self.results = utils.run(cmd, ignore_status=True)
         logging.info('Time test command exit status: %s',
                      self.results.exit_status)
+        keyvals = {}
+        for line in self.results.stdout.splitlines():
+            match = re.match(r'total: (\d+) samples/sec', line)
+            if match:
+                keyvals['samples_per_sec'] = int(match.group(1))
+            match = re.match(r'bench: (\S+)\s+([\d.]+) ns/read', line)
+            if match:
+                keyvals['%s_ns_per_read' % match.group(1)] = \
+                    float(match.group(2))
+        if keyvals:
+            self.write_perf_keyval(keyvals)
         if self.results.exit_status != 0:
             for line in self.results.stdout.splitlines():
                 if line.startswith('ERROR:'):
@@ -0,0 +1,49 @@
+/*
+ * Per-cpu timestamp slots for the seqlock test mode.
+ *
+ * Each slot has exactly one writer, the thread bound to that cpu, so
+ * updates need no lock: the sequence count is odd while the value is
+ * being changed and readers retry until they see the same even count on
+ * both sides of their read. That keeps 64 bit values intact on 32 bit
+ * cpus without readers ever writing to another cpu's cache line.
+ */
+
+#ifndef SEQLOCK_H_
+#define	SEQLOCK_H_
+
+#include <stdint.h>
+
+typedef struct seqslot {
+	volatile unsigned int	seq;	/* odd while value is updated	*/
+	volatile uint64_t	value;
+} __attribute__((aligned(64))) seqslot_t;
+
+static inline void seq_write(seqslot_t *slot, uint64_t value)
+{
+	unsigned int seq = slot->seq;
+
+	slot->seq = seq + 1;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->value = value;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->seq = seq + 2;
+}
+
+/*
+ * Returns 0 if the slot has never been written.
+ */
+static inline int seq_read(seqslot_t *slot, uint64_t *value)
+{
+	unsigned int seq;
+
+	do {
+		seq = slot->seq;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		*value = slot->value;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != slot->seq);
+
+	return seq != 0;
+}
+
+#endif	/* SEQLOCK_H_ */
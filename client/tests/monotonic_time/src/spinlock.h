@@ -11,6 +11,13 @@
 
 typedef unsigned long spinlock_t;
 
+#if defined(__x86_64__) || defined(__i386__)
+
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__("rep; nop" ::: "memory");
+}
+
 static inline void spin_lock(spinlock_t *lock)
 {
 	__asm__ __volatile__(
@@ -25,4 +32,28 @@ static inline void spin_unlock(spinlock_t *lock)
 	__asm__ __volatile__("movl $0,%0; rep; nop" : "=g"(*lock) :: "memory");
 }
 
+#else
+
+static inline void cpu_relax(void)
+{
+#if defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		cpu_relax();
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#endif
+
 #endif	/* SPINLOCK_H_ */
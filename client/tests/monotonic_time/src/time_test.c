@@ -22,6 +22,7 @@
 #include <time.h>
 
 #include "cpuset.h"
+#include "seqlock.h"
 #include "spinlock.h"
 #include "threads.h"
 #include "logging.h"
@@ -31,13 +32,32 @@ char	*program	= "";
 long	duration	= 0;
 long	threshold	= 0;
 int	verbose		= 0;
+int	mode		= 0;
+int	bench		= 0;
 
-const char optstring[] = "c:d:ht:v";
+/*
+ * How the threads share their samples:
+ *   lock     - one global last value under a spinlock
+ *   cas      - one global last value, advanced with compare-and-exchange
+ *   seqlock  - every cpu publishes to its own slot and checks the others'
+ */
+enum {
+	MODE_LOCK,
+	MODE_CAS,
+	MODE_SEQLOCK,
+	NMODES
+};
+
+const char *mode_names[NMODES] = { "lock", "cas", "seqlock" };
+
+const char optstring[] = "bc:d:hm:t:v";
 
 struct option options[] = {
+	{ "bench",	no_argument,		0, 	'b'	},
 	{ "cpus",	required_argument,	0, 	'c'	},
 	{ "duration",	required_argument,	0,	'd'	},
 	{ "help",	no_argument,		0, 	'h'	},
+	{ "mode",	required_argument,	0, 	'm'	},
 	{ "threshold",	required_argument,	0, 	't'	},
 	{ "verbose",	no_argument,		0, 	'v'	},
 	{ 0,	0,	0,	0 }
@@ -46,20 +66,36 @@ struct option options[] = {
 
 void usage(void)
 {
-	printf("usage: %s [-hv] [-c <cpu_set>] [-d duration] [-t threshold] "
-		"tsc|gtod|clock", program);
+	printf("usage: %s [-bhv] [-c <cpu_set>] [-d duration] [-m mode] "
+		"[-t threshold] [test]\n", program);
 }
 
 
 const char help_text[] =
 "check time sources for monotonicity across multiple CPUs\n"
+"  -b,--bench       measure the cost of a read of every time source\n"
+"                   first, the test name is optional with -b\n"
 "  -c,--cpus        set of cpus to test (default: all)\n"
 "  -d,--duration    test duration in seconds (default: infinite)\n"
+"  -m,--mode        how cpus compare samples: lock, cas or seqlock\n"
+"                   (default: lock)\n"
 "  -t,--threshold   error threshold (default: 0)\n"
 "  -v,--verbose     verbose output\n"
-"  tsc              test the TSC\n"
+#if defined(__x86_64__) || defined(__i386__)
+"  tsc              test the TSC (x86)\n"
+"  tsc_lfence       test the TSC, read after an lfence (x86)\n"
+"  tsc_mfence       test the TSC, read after an mfence (x86)\n"
+"  tscp             test the TSC, read with rdtscp (x86)\n"
+#endif
+#if defined(__aarch64__)
+"  cntvct           test the virtual counter, cntvct_el0 (arm64)\n"
+"  cntvct_isb       test cntvct_el0, read after an isb (arm64)\n"
+#endif
 "  gtod             test gettimeofday()\n"
-"  clock            test CLOCK_MONOTONIC\n";
+"  clock            test CLOCK_MONOTONIC\n"
+"  clock_raw        test CLOCK_MONOTONIC_RAW\n"
+"  clock_coarse     test CLOCK_MONOTONIC_COARSE\n"
+"  boottime         test CLOCK_BOOTTIME\n";
 
 
 void help(void)
@@ -86,10 +122,10 @@ static inline uint64_t rdtsc(void)
 	__asm__ __volatile__("rdtsc" : "=A" (tsc));
 	return tsc;
 }
-#else
-#error "rdtsc() not implemented for this architecture"
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
 
 static inline uint64_t rdtsc_mfence(void)
 {
@@ -105,6 +141,52 @@ static inline uint64_t rdtsc_lfence(void)
 }
 
 
+/*
+ * rdtscp waits for all earlier instructions to execute before reading
+ * the TSC, and also returns TSC_AUX, which linux sets to the cpu number
+ */
+static inline uint64_t rdtscp(void)
+{
+	uint32_t	tsc_lo, tsc_hi, aux;
+	__asm__ __volatile__("rdtscp" : "=a" (tsc_lo), "=d" (tsc_hi), "=c" (aux));
+	return ((uint64_t)tsc_hi << 32) | tsc_lo;
+}
+
+
+static int have_rdtscp(void)
+{
+	unsigned int	eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (edx >> 27) & 1;
+}
+#endif
+
+
+/*
+ * get the arm64 virtual counter, which ticks at the fixed frequency
+ * in cntfrq_el0 on every cpu. A plain mrs may be executed early, like
+ * rdtsc; the isb version waits for the instructions before it.
+ */
+#if defined(__aarch64__)
+static inline uint64_t rdcntvct(void)
+{
+	uint64_t	cnt;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (cnt));
+	return cnt;
+}
+
+
+static inline uint64_t rdcntvct_isb(void)
+{
+	uint64_t	cnt;
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (cnt) :: "memory");
+	return cnt;
+}
+#endif
+
+
 /*
  * get result from gettimeofday() as a 64 bit value
  * with microsecond resolution
@@ -131,15 +213,66 @@ static inline uint64_t rdclock(void)
 }
 
 
+/*
+ * the other clock ids, all with nanosecond resolution. glibc reads
+ * them through the vDSO where the kernel has one for them, which is
+ * what the benchmark shows.
+ */
+static inline uint64_t rdclock_raw(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static inline uint64_t rdclock_coarse(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static inline uint64_t rdboottime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * per cpu counters, each on its own cache line so that
+ * counting samples doesn't slow down the other cpus
+ */
+typedef struct cpu_info {
+	int		cpu;		/* cpu the thread is bound to	*/
+	int		peer;		/* next slot to check (seqlock)	*/
+	uint64_t	loops;		/* # of test loop iterations	*/
+	long		warps;		/* # of backward time jumps	*/
+	int64_t		worst;		/* worst backward time jump	*/
+} __attribute__((aligned(64))) cpu_info_t;
+
+struct cpu_info	cpu_info[CPU_SETSIZE];
+seqslot_t	slots[CPU_SETSIZE];
+int		nslots;
+
 /*
  * test data
  */
 typedef struct test_info {
 	const char	*name;		/* test name			*/
-	void		(*func)(struct test_info *);	/* the test	*/
+	void		(*func[NMODES])(struct test_info *,
+					struct cpu_info *); /* the test	*/
+	uint64_t	(*bench)(long);	/* time source read loop	*/
+	int		(*available)(void); /* NULL if always there	*/
 	spinlock_t	lock;
 	uint64_t	last;		/* last time value		*/
-	long		loops;		/* # of test loop iterations	*/
+	int		nthreads;	/* # of threads started		*/
 	long		warps;		/* # of backward time jumps	*/
 	int64_t		worst;		/* worst backward time jump	*/
 	uint64_t	start;		/* test start time		*/
@@ -147,15 +280,49 @@ typedef struct test_info {
 } test_info_t;
 
 
-void show_warps(struct test_info *test)
+void show_warps(struct test_info *test, int64_t worst)
 {
-	INFO("new %s-warp maximum: %9"PRId64, test->name, test->worst);
+	INFO("new %s-warp maximum: %9"PRId64, test->name, worst);
 }
 
 
+/*
+ * record a backward time jump, without a lock so that
+ * the lock free modes stay that way
+ */
+void warp(struct test_info *test, struct cpu_info *cpu, int64_t delta)
+{
+	int64_t	worst;
+
+	++cpu->warps;
+	if (delta < cpu->worst)
+		cpu->worst = delta;
+
+	worst = __atomic_load_n(&test->worst, __ATOMIC_RELAXED);
+	while (delta < worst) {
+		if (__atomic_compare_exchange_n(&test->worst, &worst, delta, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			show_warps(test, delta);
+			break;
+		}
+	}
+}
+
+
+/*
+ * The cas mode reads the last value before the clock, so a later
+ * clock value that is smaller is a warp. If another cpu has moved
+ * last on by the time we try to, its value was read after ours and
+ * there is nothing left to do.
+ *
+ * The seqlock mode compares the clock against the value each of the
+ * other cpus published last, one cpu per sample in turn. No cache
+ * line is written by more than one cpu.
+ */
 #define	DEFINE_TEST(_name)				\
 							\
-void _name##_test(struct test_info *test)		\
+void _name##_test(struct test_info *test,		\
+		  struct cpu_info *cpu)			\
 {							\
 	uint64_t t0, t1;				\
 	int64_t delta;					\
@@ -164,65 +331,233 @@ void _name##_test(struct test_info *test)		\
 	t1 = rd##_name();				\
 	t0 = test->last;				\
 	test->last = rd##_name();			\
-	test->loops++;					\
 	spin_unlock(&test->lock);			\
+	cpu->loops++;					\
 							\
 	delta = t1 - t0;				\
-	if (delta < 0 && delta < -threshold) {		\
-		spin_lock(&test->lock);			\
-		++test->warps;				\
-		if (delta < test->worst) {		\
-			test->worst = delta;		\
-			show_warps(test);		\
-		}					\
-		spin_unlock(&test->lock);		\
-	}						\
+	if (delta < 0 && delta < -threshold)		\
+		warp(test, cpu, delta);			\
 	if (!((unsigned long)t0 & 31))			\
-		asm volatile ("rep; nop");		\
+		cpu_relax();				\
+}							\
+							\
+void _name##_test_cas(struct test_info *test,		\
+		      struct cpu_info *cpu)		\
+{							\
+	uint64_t t0, t1, last;				\
+	int64_t delta;					\
+							\
+	t0 = __atomic_load_n(&test->last, __ATOMIC_SEQ_CST); \
+	t1 = rd##_name();				\
+	last = t0;					\
+	while (t1 > last &&				\
+	       !__atomic_compare_exchange_n(&test->last,	\
+			&last, t1, 0, __ATOMIC_SEQ_CST,	\
+			__ATOMIC_SEQ_CST))		\
+		;					\
+	cpu->loops++;					\
+							\
+	delta = t1 - t0;				\
+	if (delta < 0 && delta < -threshold)		\
+		warp(test, cpu, delta);			\
+	if (!((unsigned long)t0 & 31))			\
+		cpu_relax();				\
+}							\
+							\
+void _name##_test_seqlock(struct test_info *test,	\
+			  struct cpu_info *cpu)		\
+{							\
+	seqslot_t *self = &slots[cpu - cpu_info];	\
+	uint64_t t0, t1;				\
+	int64_t delta;					\
+	int valid;					\
+							\
+	valid = seq_read(&slots[cpu->peer], &t0);	\
+	t1 = rd##_name();				\
+	seq_write(self, t1);				\
+	cpu->loops++;					\
+	if (++cpu->peer == nslots)			\
+		cpu->peer = 0;				\
+							\
+	delta = t1 - t0;				\
+	if (valid && delta < 0 && delta < -threshold)	\
+		warp(test, cpu, delta);			\
+	if (!((unsigned long)t1 & 31))			\
+		cpu_relax();				\
+}							\
+							\
+uint64_t _name##_bench(long reads)			\
+{							\
+	uint64_t sum = 0;				\
+							\
+	while (reads-- > 0)				\
+		sum += rd##_name();			\
+	return sum;					\
 }							\
 							\
 struct test_info _name##_test_info = {			\
 	.name = #_name,					\
-	.func = _name##_test,				\
+	.func = {					\
+		_name##_test,				\
+		_name##_test_cas,			\
+		_name##_test_seqlock,			\
+	},						\
+	.bench = _name##_bench,				\
 }
 
+#if defined(__x86_64__) || defined(__i386__)
 DEFINE_TEST(tsc);
 DEFINE_TEST(tsc_lfence);
 DEFINE_TEST(tsc_mfence);
+DEFINE_TEST(tscp);
+#endif
+#if defined(__aarch64__)
+DEFINE_TEST(cntvct);
+DEFINE_TEST(cntvct_isb);
+#endif
 DEFINE_TEST(gtod);
 DEFINE_TEST(clock);
+DEFINE_TEST(clock_raw);
+DEFINE_TEST(clock_coarse);
+DEFINE_TEST(boottime);
 
 struct test_info *tests[] = {
+#if defined(__x86_64__) || defined(__i386__)
 	&tsc_test_info,
 	&tsc_lfence_test_info,
 	&tsc_mfence_test_info,
+	&tscp_test_info,
+#endif
+#if defined(__aarch64__)
+	&cntvct_test_info,
+	&cntvct_isb_test_info,
+#endif
 	&gtod_test_info,
 	&clock_test_info,
+	&clock_raw_test_info,
+	&clock_coarse_test_info,
+	&boottime_test_info,
 	NULL
 };
 
 
+int available(struct test_info *test)
+{
+	return !test->available || test->available();
+}
+
+
+/*
+ * time a tight loop of reads of each time source on this cpu, so
+ * that the cost can be weighed against what the warp test finds
+ */
+#define	BENCH_READS	100000
+#define	BENCH_TIME	200000		/* microseconds per source */
+
+void run_bench(void)
+{
+	struct test_info	*test;
+	volatile uint64_t	sink;
+	int			i;
+
+	for (i = 0; (test = tests[i]) != NULL; i++) {
+		uint64_t	start, elapsed;
+		long		reads = 0;
+
+		if (!available(test)) {
+			printf("bench: %-14s not available\n", test->name);
+			continue;
+		}
+		sink = test->bench(BENCH_READS);	/* warm up */
+		start = rdclock();
+		do {
+			sink = test->bench(BENCH_READS);
+			reads += BENCH_READS;
+			elapsed = rdclock() - start;
+		} while (elapsed < BENCH_TIME * 1000);
+
+		printf("bench: %-14s %8.1f ns/read\n", test->name,
+			(double)elapsed / reads);
+	}
+	(void)sink;
+}
+
+
+/*
+ * add up the per cpu counters
+ */
+uint64_t total_loops(void)
+{
+	uint64_t	loops = 0;
+	int		i;
+
+	for (i = 0; i < nslots; i++)
+		loops += cpu_info[i].loops;
+	return loops;
+}
+
+
+long total_warps(void)
+{
+	long		warps = 0;
+	int		i;
+
+	for (i = 0; i < nslots; i++)
+		warps += cpu_info[i].warps;
+	return warps;
+}
+
+
 void show_progress(struct test_info *test)
 {
 	static int	count;
 	const char	progress[] = "\\|/-";
 	uint64_t	elapsed = rdgtod() - test->start;
+	uint64_t	loops = total_loops();
 
         printf(" | %.2f us, %s-warps:%ld %c\r",
-                        (double)elapsed/(double)test->loops,
+                        loops ? (double)elapsed/(double)loops : 0.0,
 			test->name,
-                        test->warps,
+                        total_warps(),
 			progress[++count & 3]);
 	fflush(stdout);
 }
 
 
+/*
+ * per cpu sample rates, so that a cpu starved by the others or
+ * by the time source itself stands out
+ */
+void show_rates(struct test_info *test, uint64_t elapsed)
+{
+	double	secs = elapsed / 1000000.0;
+	int	i;
+
+	for (i = 0; i < nslots; i++) {
+		struct cpu_info *cpu = &cpu_info[i];
+
+		printf("cpu %3d: %12"PRIu64" samples %12.0f samples/sec "
+			"%6ld %s-warps worst %"PRId64"\n",
+			cpu->cpu, cpu->loops, cpu->loops / secs,
+			cpu->warps, test->name, cpu->worst);
+	}
+	printf("total: %.0f samples/sec on %d cpus, %s mode\n",
+		total_loops() / secs, nslots, mode_names[mode]);
+}
+
+
 void *test_loop(void *arg)
 {
 	struct test_info *test = arg;
-	
+	struct cpu_info *cpu;
+	void (*func)(struct test_info *, struct cpu_info *) = test->func[mode];
+
+	cpu = &cpu_info[__atomic_fetch_add(&test->nthreads, 1,
+					   __ATOMIC_RELAXED)];
+	cpu->cpu = sched_getcpu();
+
 	while (! test->done)
-		(*test->func)(test);
+		(*func)(test, cpu);
 
 	return NULL;
 }
@@ -254,6 +589,7 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
  	 * create the threads
  	 */
 	ncpus = count_cpus(cpus);
+	nslots = ncpus;
 	nthreads = create_per_cpu_threads(cpus, test_loop, test);
 	if (nthreads != ncpus) {
 		ERROR(0, "failed to create threads: expected %d, got %d",
@@ -266,10 +602,11 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
 	}
 
 	if (duration) {
-		INFO("running %s test on %d cpus for %ld seconds",
-			 test->name, ncpus, duration);
+		INFO("running %s test on %d cpus for %ld seconds (%s mode)",
+			 test->name, ncpus, duration, mode_names[mode]);
 	} else {
-		INFO("running %s test on %d cpus", test->name, ncpus);
+		INFO("running %s test on %d cpus (%s mode)",
+			 test->name, ncpus, mode_names[mode]);
 	}
 
 	/*
@@ -290,6 +627,9 @@ int run_test(cpu_set_t *cpus, long duration, struct test_info *test)
 
 	join_threads();
 
+	show_rates(test, rdgtod() - test->start);
+
+	test->warps = total_warps();
 	errs = (test->warps != 0);
 
 	if (!errs)
@@ -332,6 +672,9 @@ main(int argc, char *argv[])
 	errs = 0;
 	while ((c = getopt_long(argc, argv, optstring, options, NULL)) != EOF) {
 		switch (c) {
+			case 'b':
+				bench = 1;
+				break;
 			case 'c':
 				if (parse_cpu_set(optarg, &cpus) != 0)
 					++errs;
@@ -342,6 +685,15 @@ main(int argc, char *argv[])
 			case 'h':
 				help();
 				exit(0);
+			case 'm':
+				for (mode = 0; mode < NMODES; mode++)
+					if (strcmp(optarg, mode_names[mode]) == 0)
+						break;
+				if (mode == NMODES) {
+					ERROR(0, "unknown mode '%s'", optarg);
+					++errs;
+				}
+				break;
 			case 't':
 				threshold = strtol(optarg, NULL, 0);
 				break;
@@ -355,21 +707,33 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (errs || optind != argc-1) {
+#if defined(__x86_64__) || defined(__i386__)
+	tscp_test_info.available = have_rdtscp;
+#endif
+
+	if (errs || optind < argc-1 || (optind == argc && !bench)) {
 		usage();
 		exit(1);
 	}
 
-	testname = argv[optind];
-	for (i = 0; (test = tests[i]) != NULL; i++) {
-		if (strcmp(testname, test->name) == 0)
-			break;
-	}
+	test = NULL;
+	if (optind == argc-1) {
+		testname = argv[optind];
+		for (i = 0; (test = tests[i]) != NULL; i++) {
+			if (strcmp(testname, test->name) == 0)
+				break;
+		}
 
-	if (!test) {
-		ERROR(0, "unknown test '%s'\n", testname);
-		usage();
-		exit(1);
+		if (!test) {
+			ERROR(0, "unknown test '%s'\n", testname);
+			usage();
+			exit(1);
+		}
+
+		if (!available(test)) {
+			ERROR(0, "%s is not supported on this cpu", testname);
+			exit(1);
+		}
 	}
 
 	/*
@@ -384,5 +748,10 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (bench)
+		run_bench();
+	if (!test)
+		return 0;
+
 	return run_test(&cpus, duration, test);
 }
@@ -4,7 +4,7 @@ from autotest_lib.client.common_lib import utils
 
 
 class signaltest(test.test):
-    version = 1
+    version = 2
     preserve_srcdir = True
 
     def initialize(self):
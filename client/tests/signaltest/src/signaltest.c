@@ -9,12 +9,15 @@
  *
  */
 
-#define VERSION_STRING "V 0.3"
+#define VERSION_STRING "V 0.4"
+
+#define _GNU_SOURCE
 
 #include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,8 +26,9 @@
 
 #include <linux/unistd.h>
 
-#include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
@@ -39,17 +43,55 @@
 /* Must be power of 2 ! */
 #define VALBUF_SIZE		16384
 
+#define KVARS			32
+#define KVARNAMELEN		32
+#define KVARVALLEN		64
+
+/* Histogram overflows we remember the cycle of */
+#define OFLOW_MAX		1024
+
+/* Buckets kept for the -m summary percentiles when -h isn't given */
+#define HIST_DEFAULT		1000
+
+/*
+ * How a thread passes the signal on to the next one in the ring. All
+ * but signalfd are waited for with sigwaitinfo(); signalfd is sent with
+ * pthread_kill and read from a per thread signalfd. sigqueue goes through
+ * rt_tgsigqueueinfo, the thread directed form of rt_sigqueueinfo, since
+ * a process directed signal could be taken by any thread in the ring.
+ */
+enum mechanism {
+	MECH_PTHREAD_KILL,
+	MECH_TGKILL,
+	MECH_SIGNALFD,
+	MECH_SIGQUEUE,
+	MECHS
+};
+
+static char *mech_names[] = { "pthread_kill", "tgkill", "signalfd", "sigqueue" };
+
 /* Struct to transfer parameters to the thread */
 struct thread_param {
 	int id;
 	int prio;
 	int signal;
+	int mechanism;
 	unsigned long max_cycles;
 	struct thread_stat *stats;
 	int bufmsk;
+	int histogram;
+};
+
+struct overflow {
+	unsigned long cycle;
+	long latency;
 };
 
-/* Struct for statistics */
+/*
+ * Struct for statistics. min/max/avg are for the whole round trip, as
+ * seen by this thread; the hop_ values and the histogram are for the
+ * single hop from the previous thread's send to this thread's wakeup.
+ */
 struct thread_stat {
 	unsigned long cycles;
 	unsigned long cyclesread;
@@ -58,16 +100,185 @@ struct thread_stat {
 	long act;
 	double avg;
 	long *values;
+	unsigned long hops;
+	long hop_min;
+	long hop_max;
+	double hop_avg;
+	unsigned long *hist;
+	unsigned long hist_overflow;
+	struct overflow *overflows;
+	struct timespec sent;
 	pthread_t thread;
 	pthread_t tothread;
+	struct thread_stat *tostat;
+	int totid;
 	int threadstarted;
 	int tid;
 };
 
 static int shutdown;
+static int interrupted;
 static int tracelimit = 0;
 static int ftrace = 0;
-static int oldtrace = 0;
+static pid_t pid;
+
+/*
+ * The tracefs helpers are the same as in cyclictest. Each test's src/ is
+ * shipped and built on its own, so they are copied rather than shared:
+ * a fix to one belongs in both.
+ */
+
+/* Backup of tracefs settings that we modify */
+static struct kvars {
+	char name[KVARNAMELEN];
+	char value[KVARVALLEN];
+} kv[KVARS];
+
+static char *tracefs_paths[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+};
+
+static char *tracefs;
+static int marker_fd = -1;
+static int snapshot_fd = -1;
+static int tracing_on_fd = -1;
+static int trace_frozen;
+
+static char *find_tracefs(void)
+{
+	char path[128];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tracefs_paths); i++) {
+		snprintf(path, sizeof(path), "%s/trace_marker", tracefs_paths[i]);
+		if (!access(path, W_OK))
+			return tracefs_paths[i];
+	}
+	return NULL;
+}
+
+static int tracefs_open(char *name, int mode)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s/%s", tracefs, name);
+	return open(path, mode);
+}
+
+static int tracevar(int mode, char *name, char *value, size_t len)
+{
+	int retval = 1;
+	int fd = tracefs_open(name, mode);
+
+	if (fd >= 0) {
+		if (mode == O_RDONLY) {
+			ssize_t got = read(fd, value, len - 1);
+
+			if (got > 0) {
+				value[got] = '\0';
+				value[strcspn(value, "\n")] = '\0';
+				retval = 0;
+			}
+		} else if (mode == O_WRONLY) {
+			if (write(fd, value, strlen(value)) == strlen(value))
+				retval = 0;
+		}
+		close(fd);
+	}
+	return retval;
+}
+
+static void settracevar(char *name, char *value)
+{
+	int i;
+	char oldvalue[KVARVALLEN];
+
+	if (tracevar(O_RDONLY, name, oldvalue, sizeof(oldvalue)))
+		fprintf(stderr, "could not retrieve %s\n", name);
+	else {
+		for (i = 0; i < KVARS; i++) {
+			if (!strcmp(kv[i].name, name))
+				break;
+			if (kv[i].name[0] == '\0') {
+				strncpy(kv[i].name, name, sizeof(kv[i].name));
+				strncpy(kv[i].value, oldvalue, sizeof(kv[i].value));
+				break;
+			}
+		}
+		if (i == KVARS)
+			fprintf(stderr, "could not backup %s (%s)\n", name,
+				oldvalue);
+	}
+	if (tracevar(O_WRONLY, name, value, 0))
+		fprintf(stderr, "could not set %s to %s\n", name, value);
+}
+
+static void restoretracevars(void)
+{
+	int i;
+
+	for (i = 0; i < KVARS; i++) {
+		/* leave a trace stopped at the break for reading */
+		if (trace_frozen && !strcmp(kv[i].name, "tracing_on"))
+			continue;
+		if (kv[i].name[0] != '\0') {
+			if (tracevar(O_WRONLY, kv[i].name, kv[i].value, 0))
+				fprintf(stderr, "could not restore %s to %s\n",
+					kv[i].name, kv[i].value);
+		}
+	}
+}
+
+/*
+ * -b: set up once from main with plain tracefs writes. A round trip past
+ * the limit leaves a marker in the trace and takes a snapshot, or stops
+ * tracing where the kernel has no snapshot buffer.
+ */
+static void setup_tracing(void)
+{
+	tracefs = find_tracefs();
+	if (!tracefs) {
+		fprintf(stderr, "tracefs not mounted, -b only stops the test\n");
+		return;
+	}
+	if (ftrace)
+		settracevar("current_tracer", "function");
+	settracevar("tracing_on", "1");
+
+	marker_fd = tracefs_open("trace_marker", O_WRONLY);
+	snapshot_fd = tracefs_open("snapshot", O_WRONLY);
+	if (snapshot_fd < 0) {
+		fprintf(stderr, "no tracefs snapshot, tracing stops at the break\n");
+		tracing_on_fd = tracefs_open("tracing_on", O_WRONLY);
+	}
+}
+
+static void tracemark(char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	int len;
+
+	if (marker_fd < 0)
+		return;
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (write(marker_fd, buf, len) != len)
+		fprintf(stderr, "could not write trace_marker\n");
+}
+
+static void tracesnapshot(void)
+{
+	if (snapshot_fd >= 0) {
+		if (write(snapshot_fd, "1", 1) != 1)
+			fprintf(stderr, "could not take trace snapshot\n");
+	} else if (tracing_on_fd >= 0) {
+		if (write(tracing_on_fd, "0", 1) == 1)
+			trace_frozen = 1;
+	}
+}
 
 static inline void tsnorm(struct timespec *ts)
 {
@@ -85,6 +296,62 @@ static inline long calcdiff(struct timespec t1, struct timespec t2)
 	return diff;
 }
 
+static void send_signal(struct thread_param *par, struct thread_stat *stat)
+{
+	siginfo_t info;
+
+	switch (par->mechanism) {
+	case MECH_TGKILL:
+		syscall(SYS_tgkill, pid, stat->totid, par->signal);
+		break;
+	case MECH_SIGQUEUE:
+		memset(&info, 0, sizeof(info));
+		info.si_signo = par->signal;
+		info.si_code = SI_QUEUE;
+		info.si_pid = pid;
+		info.si_uid = getuid();
+		info.si_value.sival_int = stat->cycles;
+		syscall(SYS_rt_tgsigqueueinfo, pid, stat->totid, par->signal,
+			&info);
+		break;
+	default:
+		pthread_kill(stat->tothread, par->signal);
+		break;
+	}
+}
+
+static int wait_signal(sigset_t *sigset, int sfd)
+{
+	struct signalfd_siginfo si;
+
+	if (sfd >= 0)
+		return read(sfd, &si, sizeof(si)) == sizeof(si) ? 0 : -1;
+	return sigwaitinfo(sigset, NULL) < 0 ? -1 : 0;
+}
+
+static void record_hop(struct thread_param *par, long diff)
+{
+	struct thread_stat *stat = par->stats;
+
+	if (diff < stat->hop_min)
+		stat->hop_min = diff;
+	if (diff > stat->hop_max)
+		stat->hop_max = diff;
+	stat->hop_avg += (double) diff;
+	stat->hops++;
+
+	if (!par->histogram)
+		return;
+	if (diff >= par->histogram) {
+		if (stat->hist_overflow < OFLOW_MAX) {
+			stat->overflows[stat->hist_overflow].cycle = stat->hops;
+			stat->overflows[stat->hist_overflow].latency = diff;
+		}
+		stat->hist_overflow++;
+	} else
+		stat->hist[diff]++;
+}
+
 /*
  * signal thread
  *
@@ -99,22 +366,7 @@ void *signalthread(void *param)
 	int policy = par->prio ? SCHED_FIFO : SCHED_OTHER;
 	int stopped = 0;
 	int first = 1;
-
-	if (tracelimit) {
-		system("echo 1 > /proc/sys/kernel/trace_all_cpus");
-		system("echo 1 > /proc/sys/kernel/trace_freerunning");
-		system("echo 0 > /proc/sys/kernel/trace_print_at_crash");
-		system("echo 1 > /proc/sys/kernel/trace_user_triggered");
-		system("echo -1 > /proc/sys/kernel/trace_user_trigger_irq");
-		system("echo 0 > /proc/sys/kernel/trace_verbose");
-		system("echo 0 > /proc/sys/kernel/preempt_thresh");
-		system("echo 0 > /proc/sys/kernel/wakeup_timing");
-		system("echo 0 > /proc/sys/kernel/preempt_max_latency");
-		if (ftrace)
-			system("echo 1 > /proc/sys/kernel/mcount_enabled");
-
-		system("echo 1 > /proc/sys/kernel/trace_enabled");
-	}
+	int sfd = -1;
 
 	stat->tid = gettid();
 
@@ -122,31 +374,40 @@ void *signalthread(void *param)
 	sigaddset(&sigset, par->signal);
 	sigprocmask(SIG_BLOCK, &sigset, NULL);
 
+	if (par->mechanism == MECH_SIGNALFD) {
+		sfd = signalfd(-1, &sigset, 0);
+		if (sfd < 0) {
+			fprintf(stderr, "could not create signalfd\n");
+			shutdown = 1;
+			goto out;
+		}
+	}
+
 	memset(&schedp, 0, sizeof(schedp));
 	schedp.sched_priority = par->prio;
 	sched_setscheduler(0, policy, &schedp);
 
 	stat->threadstarted++;
 
-	if (tracelimit) {
-		if (oldtrace)
-			gettimeofday(0,(struct timezone *)1);
-		else
-			prctl(0, 1);
-	}
-
 	clock_gettime(CLOCK_MONOTONIC, &before);
 
 	while (!shutdown) {
 		struct timespec now;
 		long diff;
-		int sigs;
 
-		if (sigwait(&sigset, &sigs) < 0)
+		if (wait_signal(&sigset, sfd) < 0)
 			goto out;
 
 		clock_gettime(CLOCK_MONOTONIC, &after);
 
+		/* main wakes everyone up with a last signal to stop */
+		if (shutdown)
+			break;
+
+		/* nothing stamps the kick main starts the ring with */
+		if (stat->sent.tv_sec)
+			record_hop(par, calcdiff(after, stat->sent));
+
 		/*
 		 * If it is the first thread, sleep after every 16
 		 * round trips.
@@ -156,7 +417,8 @@ void *signalthread(void *param)
 
 		/* Get current time */
 		clock_gettime(CLOCK_MONOTONIC, &now);
-		pthread_kill(stat->tothread, SIGUSR1);
+		stat->tostat->sent = now;
+		send_signal(par, stat);
 
 		/* Skip the first cycle */
 		if (first) {
@@ -175,10 +437,9 @@ void *signalthread(void *param)
 
 		if (!stopped && tracelimit && (diff > tracelimit)) {
 			stopped++;
-			if (oldtrace)
-				gettimeofday(0,0);
-			else
-				prctl(0, 0);
+			tracemark("hit latency threshold (%ld > %d)\n",
+				  diff, tracelimit);
+			tracesnapshot();
 			shutdown++;
 		}
 		stat->act = diff;
@@ -192,6 +453,9 @@ void *signalthread(void *param)
 	}
 
 out:
+	if (sfd >= 0)
+		close(sfd);
+
 	/* switch to normal */
 	schedp.sched_priority = 0;
 	sched_setscheduler(0, SCHED_OTHER, &schedp);
@@ -210,7 +474,13 @@ static void display_help(void)
 	       "signaltest <options>\n\n"
 	       "-b USEC  --breaktrace=USEC send break trace command when latency > USEC\n"
 	       "-f                         function trace (when -b is active)\n"
+	       "-h USEC  --histogram=USEC  dump a latency histogram of the hop into\n"
+	       "                           each thread to stdout after the run,\n"
+	       "                           USEC is the max latency to track\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
+	       "-m MECH  --mechanism=MECH  how signals are sent: pthread_kill, tgkill,\n"
+	       "                           signalfd, sigqueue or all, which runs each\n"
+	       "                           in turn and compares their hop latencies\n"
 	       "-p PRIO  --prio=PRIO       priority of highest prio thread\n"
 	       "-q       --quiet           print only a summary on exit\n"
 	       "-t NUM   --threads=NUM     number of threads: default=2\n"
@@ -224,6 +494,30 @@ static int num_threads = 2;
 static int max_cycles;
 static int verbose;
 static int quiet;
+static int histogram;
+static int mechanisms[MECHS];
+static int nmechanisms;
+static int compare;
+
+static int parse_mechanism(char *name)
+{
+	int i;
+
+	if (!strcmp(name, "all")) {
+		for (i = 0; i < MECHS; i++)
+			mechanisms[i] = i;
+		nmechanisms = MECHS;
+		return 0;
+	}
+	for (i = 0; i < MECHS; i++) {
+		if (!strcmp(name, mech_names[i])) {
+			mechanisms[0] = i;
+			nmechanisms = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
 
 /* Process commandline options */
 static void process_options (int argc, char *argv[])
@@ -235,7 +529,9 @@ static void process_options (int argc, char *argv[])
 		static struct option long_options[] = {
 			{"breaktrace", required_argument, NULL, 'b'},
 			{"ftrace", no_argument, NULL, 'f'},
+			{"histogram", required_argument, NULL, 'h'},
 			{"loops", required_argument, NULL, 'l'},
+			{"mechanism", required_argument, NULL, 'm'},
 			{"priority", required_argument, NULL, 'p'},
 			{"quiet", no_argument, NULL, 'q'},
 			{"threads", required_argument, NULL, 't'},
@@ -243,13 +539,16 @@ static void process_options (int argc, char *argv[])
 			{"help", no_argument, NULL, '?'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long (argc, argv, "b:fl:p:qt:v",
+		int c = getopt_long (argc, argv, "b:fh:l:m:p:qt:v",
 			long_options, &option_index);
 		if (c == -1)
 			break;
 		switch (c) {
 		case 'b': tracelimit = atoi(optarg); break;
+		case 'f': ftrace = 1; break;
+		case 'h': histogram = atoi(optarg); break;
 		case 'l': max_cycles = atoi(optarg); break;
+		case 'm': error |= parse_mechanism(optarg); compare = 1; break;
 		case 'p': priority = atoi(optarg); break;
 		case 'q': quiet = 1; break;
 		case 't': num_threads = atoi(optarg); break;
@@ -264,27 +563,23 @@ static void process_options (int argc, char *argv[])
 	if (num_threads < 2)
 		error = 1;
 
+	if (histogram < 0)
+		error = 1;
+
+	/* each mechanism gets -l loops, so they can't be endless */
+	if (nmechanisms > 1 && max_cycles <= 0)
+		error = 1;
+
+	if (!nmechanisms)
+		nmechanisms = 1;
+
 	if (error)
 		display_help ();
 }
 
-static void check_kernel(void)
-{
-	size_t len;
-	char ver[256];
-	int fd, maj, min, sub;
-
-	fd = open("/proc/version", O_RDONLY, 0666);
-	len = read(fd, ver, 255);
-	close(fd);
-	ver[len-1] = 0x0;
-	sscanf(ver, "Linux version %d.%d.%d", &maj, &min, &sub);
-	if (maj == 2 && min == 6 && sub < 18)
-		oldtrace = 1;
-}
-
 static void sighand(int sig)
 {
+	interrupted = 1;
 	shutdown = 1;
 }
 
@@ -310,57 +605,161 @@ static void print_stat(struct thread_param *par, int index, int verbose)
 	}
 }
 
-int main(int argc, char **argv)
+static void print_hist(struct thread_param *par, int nthreads)
 {
-	sigset_t sigset;
-	int signum = SIGUSR1;
-	struct thread_param *par;
-	struct thread_stat *stat;
-	int i, ret = -1;
-
-	if (geteuid()) {
-		printf("need to run as root!\n");
-		exit(-1);
+	int i, j;
+	unsigned long k;
+
+	printf("# Histogram\n");
+	for (i = 0; i < histogram; i++) {
+		printf("%06d ", i);
+		for (j = 0; j < nthreads; j++) {
+			printf("%06lu", par[j].stats->hist[i]);
+			if (j < nthreads - 1)
+				printf("\t");
+		}
+		printf("\n");
+	}
+	printf("# Total:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %09lu", par[j].stats->hops);
+	printf("\n");
+	printf("# Min Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->hop_min);
+	printf("\n");
+	printf("# Avg Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->hops ?
+		       (long)(par[j].stats->hop_avg / par[j].stats->hops) : 0);
+	printf("\n");
+	printf("# Max Latencies:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05ld", par[j].stats->hop_max);
+	printf("\n");
+	printf("# Histogram Overflows:");
+	for (j = 0; j < nthreads; j++)
+		printf(" %05lu", par[j].stats->hist_overflow);
+	printf("\n");
+	printf("# Histogram Overflow at cycle number:\n");
+	for (j = 0; j < nthreads; j++) {
+		struct thread_stat *stat = par[j].stats;
+
+		printf("# Thread %d:", j);
+		for (k = 0; k < stat->hist_overflow && k < OFLOW_MAX; k++)
+			printf(" %05lu (%ld)", stat->overflows[k].cycle,
+			       stat->overflows[k].latency);
+		if (stat->hist_overflow > OFLOW_MAX)
+			printf(" # %05lu others", stat->hist_overflow - OFLOW_MAX);
+		printf("\n");
 	}
+}
 
-	process_options(argc, argv);
+/* hop latencies of all threads together, for comparing mechanisms */
+struct mech_stat {
+	unsigned long hops;
+	long min;
+	long max;
+	double sum;
+	unsigned long *hist;
+	unsigned long overflow;
+};
 
-	check_kernel();
+static struct mech_stat mech_stats[MECHS];
 
-	sigemptyset(&sigset);
-	sigaddset(&sigset, signum);
-	sigprocmask (SIG_BLOCK, &sigset, NULL);
+static void mech_record(struct mech_stat *ms, struct thread_param *par,
+			int nthreads)
+{
+	int i, j;
 
-	signal(SIGINT, sighand);
-	signal(SIGTERM, sighand);
+	ms->min = 1000000;
+	ms->max = -1000000;
+	for (j = 0; j < nthreads; j++) {
+		struct thread_stat *stat = par[j].stats;
 
-	par = calloc(num_threads, sizeof(struct thread_param));
-	if (!par)
-		goto out;
-	stat = calloc(num_threads, sizeof(struct thread_stat));
-	if (!stat)
-		goto outpar;
+		if (!stat->hops)
+			continue;
+		ms->hops += stat->hops;
+		ms->sum += stat->hop_avg;
+		if (stat->hop_min < ms->min)
+			ms->min = stat->hop_min;
+		if (stat->hop_max > ms->max)
+			ms->max = stat->hop_max;
+		ms->overflow += stat->hist_overflow;
+		for (i = 0; i < histogram; i++)
+			ms->hist[i] += stat->hist[i];
+	}
+}
 
-	for (i = 0; i < num_threads; i++) {
-		if (verbose) {
-			stat[i].values = calloc(VALBUF_SIZE, sizeof(long));
-			if (!stat[i].values)
-				goto outall;
-			par[i].bufmsk = VALBUF_SIZE - 1;
+/* formats the percentile, which may be past the end of the histogram */
+static void percentile(char *buf, size_t len, struct mech_stat *ms,
+		       double pct)
+{
+	unsigned long want = ms->hops * pct / 100, seen = 0;
+	int i;
+
+	for (i = 0; i < histogram; i++) {
+		seen += ms->hist[i];
+		if (seen > want) {
+			snprintf(buf, len, "%d", i);
+			return;
 		}
+	}
+	snprintf(buf, len, ">%d", histogram);
+}
 
-		par[i].id = i;
-		par[i].prio = priority;
-#if 0
-		if (priority)
-			priority--;
-#endif
-		par[i].signal = signum;
-		par[i].max_cycles = max_cycles;
-		par[i].stats = &stat[i];
+static void print_mech_summary(void)
+{
+	char p50[16], p99[16], p999[16];
+	int i;
+
+	printf("# Mechanism summary, hop latency in us over all threads:\n");
+	printf("# %-13s %10s %6s %6s %6s %6s %6s %8s\n", "Mechanism", "Hops",
+	       "Min", "Avg", "P50", "P99", "P99.9", "Max");
+	for (i = 0; i < nmechanisms; i++) {
+		struct mech_stat *ms = &mech_stats[i];
+
+		if (!ms->hops)
+			continue;
+		percentile(p50, sizeof(p50), ms, 50);
+		percentile(p99, sizeof(p99), ms, 99);
+		percentile(p999, sizeof(p999), ms, 99.9);
+		printf("# %-13s %10lu %6ld %6ld %6s %6s %6s %8ld\n",
+		       mech_names[mechanisms[i]], ms->hops, ms->min,
+		       (long)(ms->sum / ms->hops), p50, p99, p999, ms->max);
+	}
+}
+
+/* one run of the thread ring, with one mechanism under -m */
+static int run_phase(struct thread_param *par, struct thread_stat *stat,
+		     int phase, int show_hist)
+{
+	int signum = par[0].signal;
+	int i;
+
+	if (compare) {
+		printf("# Mechanism: %s\n", mech_names[mechanisms[phase]]);
+		fflush(stdout);
+	}
+
+	shutdown = 0;
+	for (i = 0; i < num_threads; i++) {
+		par[i].mechanism = mechanisms[phase];
+		stat[i].cycles = 0;
+		stat[i].cyclesread = 0;
 		stat[i].min = 1000000;
 		stat[i].max = -1000000;
+		stat[i].act = 0;
 		stat[i].avg = 0.0;
+		stat[i].hops = 0;
+		stat[i].hop_min = 1000000;
+		stat[i].hop_max = -1000000;
+		stat[i].hop_avg = 0.0;
+		if (histogram) {
+			memset(stat[i].hist, 0, histogram * sizeof(unsigned long));
+			stat[i].hist_overflow = 0;
+		}
+		memset(&stat[i].sent, 0, sizeof(stat[i].sent));
 		stat[i].threadstarted = 1;
 		pthread_create(&stat[i].thread, NULL, signalthread, &par[i]);
 	}
@@ -375,9 +774,13 @@ int main(int argc, char **argv)
 		if (!allstarted)
 			continue;
 
-		for (i = 0; i < num_threads - 1; i++)
-			stat[i].tothread = stat[i+1].thread;
-		stat[i].tothread = stat[0].thread;
+		for (i = 0; i < num_threads; i++) {
+			struct thread_stat *to = &stat[(i + 1) % num_threads];
+
+			stat[i].tothread = to->thread;
+			stat[i].tostat = to;
+			stat[i].totid = to->tid;
+		}
 		break;
 	}
 	pthread_kill(stat[0].thread, signum);
@@ -404,26 +807,121 @@ int main(int argc, char **argv)
 		if (!verbose && !quiet)
 			printf("\033[%dA", 3);
 	}
-	ret = 0;
- outall:
+
 	shutdown = 1;
 	usleep(50000);
 	if (quiet)
 		quiet = 2;
 	for (i = 0; i < num_threads; i++) {
+		/* a last signal gets waiting threads to see shutdown */
 		if (stat[i].threadstarted > 0)
-			pthread_kill(stat[i].thread, SIGTERM);
+			pthread_kill(stat[i].thread, signum);
 		if (stat[i].threadstarted) {
 			pthread_join(stat[i].thread, NULL);
+			stat[i].threadstarted = 0;
 			if (quiet)
 				print_stat(&par[i], i, 0);
 		}
-		if (stat[i].values)
-			free(stat[i].values);
 	}
+	if (compare)
+		mech_record(&mech_stats[phase], par, num_threads);
+	if (show_hist)
+		print_hist(par, num_threads);
+	if (quiet)
+		quiet = 1;
+
+	return interrupted;
+}
+
+int main(int argc, char **argv)
+{
+	sigset_t sigset;
+	int signum = SIGUSR1;
+	struct thread_param *par;
+	struct thread_stat *stat;
+	int i, phase, show_hist, ret = -1;
+
+	if (geteuid()) {
+		printf("need to run as root!\n");
+		exit(-1);
+	}
+
+	process_options(argc, argv);
+
+	/* the summary needs buckets for its percentiles even without -h */
+	show_hist = histogram;
+	if (compare && !histogram)
+		histogram = HIST_DEFAULT;
+
+	if (tracelimit)
+		setup_tracing();
+
+	pid = getpid();
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, signum);
+	sigprocmask (SIG_BLOCK, &sigset, NULL);
+
+	signal(SIGINT, sighand);
+	signal(SIGTERM, sighand);
+
+	par = calloc(num_threads, sizeof(struct thread_param));
+	if (!par)
+		goto out;
+	stat = calloc(num_threads, sizeof(struct thread_stat));
+	if (!stat)
+		goto outpar;
+
+	for (i = 0; i < num_threads; i++) {
+		if (verbose) {
+			stat[i].values = calloc(VALBUF_SIZE, sizeof(long));
+			if (!stat[i].values)
+				goto outall;
+			par[i].bufmsk = VALBUF_SIZE - 1;
+		}
+		if (histogram) {
+			stat[i].hist = calloc(histogram, sizeof(unsigned long));
+			stat[i].overflows = calloc(OFLOW_MAX,
+						   sizeof(struct overflow));
+			if (!stat[i].hist || !stat[i].overflows)
+				goto outall;
+			par[i].histogram = histogram;
+		}
+
+		par[i].id = i;
+		par[i].prio = priority;
+#if 0
+		if (priority)
+			priority--;
+#endif
+		par[i].signal = signum;
+		par[i].max_cycles = max_cycles;
+		par[i].stats = &stat[i];
+	}
+	for (i = 0; compare && i < nmechanisms; i++) {
+		mech_stats[i].hist = calloc(histogram, sizeof(unsigned long));
+		if (!mech_stats[i].hist)
+			goto outall;
+	}
+
+	for (phase = 0; phase < nmechanisms; phase++)
+		if (run_phase(par, stat, phase, show_hist))
+			break;
+	if (compare)
+		print_mech_summary();
+	ret = 0;
+ outall:
+	for (i = 0; i < num_threads; i++) {
+		free(stat[i].values);
+		free(stat[i].hist);
+		free(stat[i].overflows);
+	}
+	for (i = 0; i < MECHS; i++)
+		free(mech_stats[i].hist);
 	free(stat);
  outpar:
 	free(par);
  out:
+	restoretracevars();
 	exit(ret);
 }